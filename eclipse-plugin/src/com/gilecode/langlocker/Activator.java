@@ -1,5 +1,6 @@
 package com.gilecode.langlocker;
 
+import org.eclipse.core.runtime.Status;
 import org.eclipse.jface.resource.ImageDescriptor;
 import org.eclipse.ui.plugin.AbstractUIPlugin;
 import org.osgi.framework.BundleContext;
@@ -55,6 +56,23 @@ public class Activator extends AbstractUIPlugin {
 		return plugin;
 	}
 
+	/**
+	 * Logs the message into the plug-in's log, if the plug-in is active
+	 * 
+	 * @param severity
+	 *            the severity, like IStatus.WARNING
+	 * @param message
+	 *            the message
+	 * @param exception
+	 *            the exception, or null
+	 */
+	public static void log(int severity, String message, Throwable exception) {
+		Activator activator = plugin;
+		if (activator != null) {
+			activator.getLog().log(new Status(severity, PLUGIN_ID, message, exception));
+		}
+	}
+
 	/**
 	 * Returns an image descriptor for the image file at the given plug-in
 	 * relative path
@@ -1,5 +1,9 @@
 package com.gilecode.langlocker;
 
+import java.nio.ByteBuffer;
+
+import org.eclipse.core.runtime.IStatus;
+
 /**
  * Accessor to system-dependent native implementations of lock/unlock actions. 
  */
@@ -17,11 +21,127 @@ public class LockEngine {
 	 */
 	public static native long lockInputLanguage(long languageId);
 	
+	/**
+	 * Like {@link #lockInputLanguage(long)}, but permits the switches between several languages, e.g. between
+	 * the English layouts. The switches to other languages are reverted to the most recently used permitted one.
+	 * 
+	 * @param languageIds the permitted language IDs, up to 16
+	 * @param primaryLanguage the primary language (low 10 bits of LANGID) which layouts are all permitted, or 0
+	 * 
+	 * @return the ID of locked language, or 0 if failed to lock
+	 */
+	public static native long lockInputLanguageSet(long[] languageIds, int primaryLanguage);
+	
 	/**
 	 * Unlocks the language, if previously locked.
 	 */
 	public static native void unlockInputLanguage();
 	
+	/**
+	 * Locks the specified language for the native window (either top-level or child) and its child windows.
+	 * While the language is locked by {@link #lockInputLanguage(long)}, this language is used instead of
+	 * the globally locked one when the focus is in that window.
+	 *
+	 * @param hwnd the handle of the native window
+	 * @param languageId the language ID returned by {@link #lockInputLanguage(long)}
+	 *
+	 * @return whether succeeded; fails if too many windows have locked languages
+	 */
+	public static native boolean lockWindowInputLanguage(long hwnd, long languageId);
+
+	/**
+	 * Removes the language locked for the native window, so that the globally locked language is used for it.
+	 *
+	 * @param hwnd the handle of the native window
+	 */
+	public static native void unlockWindowInputLanguage(long hwnd);
+	
+	/**
+	 * Returns the direct buffer of the lock status block, which is updated by the native library.
+	 * Use {@link LockStatus#read()} to read it consistently.
+	 */
+	public static native ByteBuffer getStatusBuffer();
+	
+	/**
+	 * Returns the installed input languages (keyboard layouts), in the order of the system list. The languages
+	 * are indexed by the native library, so the call does not enumerate them each time.
+	 * 
+	 * @return two values per language: the language ID, as used by {@link #lockInputLanguage(long)}, and
+	 *   the Windows language identifier (LANGID), which low 10 bits are the primary language
+	 */
+	public static native long[] getInstalledLayouts();
+	
+	/**
+	 * Sets the rules which select the locking policies of the windows, like leaving popups free or locking
+	 * a specific language in some windows. The rules are applied at the next lock. See window-rules.h in the
+	 * native library for the syntax.
+	 * 
+	 * @param rules the rules, one per line; an empty string removes the rules
+	 * @return whether all rules are valid; the invalid ones are skipped
+	 */
+	public static native boolean setWindowRules(String rules);
+	
+	/**
+	 * Hints the language wanted in the current context, e.g. at the caret, while the language is locked. The hints
+	 * may be posted at any rate, e.g. on each caret move: only the latest one is applied, by changing the locked
+	 * language on the main thread, at most once per turn of its message loop.
+	 * 
+	 * @param languageId the wanted language ID
+	 * @return whether the hint is accepted; it is not if the language is not locked
+	 */
+	public static native boolean postLayoutHint(long languageId);
+	
+	/**
+	 * Returns the statistics of the hooks, see {@link LockStatistics#read()} for the interpretation.
+	 */
+	static native long[] getLockStatistics();
+	
+	/**
+	 * Starts the native thread which delivers the lock events to {@link #dispatchEvents(long[])}.
+	 * Does nothing if already started.
+	 * 
+	 * @return whether the events are supported
+	 */
+	private static native boolean startEventNotifier();
+	
+	private static volatile LockEventListener eventListener;
+	
+	/**
+	 * Sets the listener of the lock events, like failed reverts of the input language.
+	 * 
+	 * @param listener the listener, or {@code null} to ignore the events
+	 * 
+	 * @return whether the events are supported by the native library
+	 */
+	public static boolean setEventListener(LockEventListener listener) {
+		eventListener = listener;
+		try {
+			return startEventNotifier();
+		} catch (UnsatisfiedLinkError e) {
+			// an older native library
+			return false;
+		}
+	}
+	
+	/**
+	 * Invoked by the native notifier thread with {@link LockEvent#FIELDS} values per event.
+	 */
+	private static void dispatchEvents(long[] data) {
+		LockEventListener listener = eventListener;
+		if (listener == null) {
+			return;
+		}
+		LockEvent[] events = new LockEvent[data.length / LockEvent.FIELDS];
+		for (int i = 0; i < events.length; i++) {
+			events[i] = new LockEvent(data, i * LockEvent.FIELDS);
+		}
+		try {
+			listener.lockEventsOccurred(events);
+		} catch (Throwable e) {
+			Activator.log(IStatus.ERROR, "Failed to process the lock events", e);
+		}
+	}
+	
 	static {
 		System.loadLibrary("lang-locker");
 	}
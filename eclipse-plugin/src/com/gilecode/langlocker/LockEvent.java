@@ -0,0 +1,93 @@
+package com.gilecode.langlocker;
+
+/**
+ * The lock event reported by the native library, see {@link LockEngine#setEventListener(LockEventListener)}.
+ * The consecutive identical events are coalesced into one event with the count.
+ */
+public final class LockEvent {
+
+	/** An unwanted input language switch is reverted. */
+	public static final int REVERTED = 1;
+	/** Failed to revert an input language switch, see {@link #getError()}. */
+	public static final int REVERT_FAILED = 2;
+	/** Failed to set the hooks for a thread, so the language switches in its windows are not blocked. */
+	public static final int HOOK_FAILED = 3;
+	/** The list of the installed input languages is changed. */
+	public static final int LAYOUTS_CHANGED = 4;
+	/** Some events are lost as too many events occurred, the count is the number of the lost events. */
+	public static final int DROPPED = 5;
+
+	// the number of values per event in the array passed by the native library
+	static final int FIELDS = 6;
+
+	private final int type;
+	private final int count;
+	private final int threadId;
+	private final long languageId;
+	private final int error;
+	private final int sequence;
+
+	LockEvent(long[] data, int offset) {
+		this.type = (int) data[offset];
+		this.count = (int) data[offset + 1];
+		this.threadId = (int) data[offset + 2];
+		this.languageId = data[offset + 3];
+		this.error = (int) data[offset + 4];
+		this.sequence = (int) data[offset + 5];
+	}
+
+	/**
+	 * Returns the type of the event, e.g. {@link #REVERTED}.
+	 */
+	public int getType() {
+		return type;
+	}
+
+	/**
+	 * Returns the number of the coalesced identical events.
+	 */
+	public int getCount() {
+		return count;
+	}
+
+	/**
+	 * Returns the ID of the native thread which caused the event, or 0.
+	 */
+	public int getThreadId() {
+		return threadId;
+	}
+
+	/**
+	 * Returns the ID of the involved language, or 0.
+	 */
+	public long getLanguageId() {
+		return languageId;
+	}
+
+	/**
+	 * Returns the Windows error code for the failures, or 0.
+	 */
+	public int getError() {
+		return error;
+	}
+
+	/**
+	 * Returns the sequence number of the lock command completed by the event, or 0.
+	 */
+	int getSequence() {
+		return sequence;
+	}
+
+	/**
+	 * Returns whether the event reports a failure of the lock.
+	 */
+	public boolean isFailure() {
+		return type == REVERT_FAILED || type == HOOK_FAILED;
+	}
+
+	@Override
+	public String toString() {
+		return "LockEvent{type=" + type + ", count=" + count + ", threadId=" + threadId +
+				", languageId=0x" + Long.toHexString(languageId) + ", error=" + error + ", sequence=" + sequence + "}";
+	}
+}
@@ -0,0 +1,90 @@
+package com.gilecode.langlocker;
+
+/**
+ * Statistics of the native hooks, collected since the native library is loaded. The counters and the histogram
+ * mirror LockStatistics in lock-stats.h.
+ */
+public final class LockStatistics {
+
+	/** The number of the hook invocations for the window messages, except the ones passed by the fast path. */
+	public static final int GETMSG_CALLS = 0;
+	/** The number of the window messages passed without processing. */
+	public static final int GETMSG_SKIPPED = 1;
+	/** The number of the input language messages. */
+	public static final int GETMSG_LANGUAGE = 2;
+	/** The number of the checked key presses, which are checked only if windows have own locked languages. */
+	public static final int GETMSG_KEYDOWN = 3;
+	/** The number of the hook invocations for the shell events. */
+	public static final int SHELL_CALLS = 4;
+	/** The number of the input language change shell events. */
+	public static final int SHELL_LANGUAGE = 5;
+	/** The number of the input language change shell events which required no actions. */
+	public static final int SHELL_LANGUAGE_SKIPPED = 6;
+	/** The number of the blocked language switch requests. */
+	public static final int SWITCHES_BLOCKED = 7;
+	/** The number of the unwanted language switches which got through, and were to be reverted. */
+	public static final int SWITCHES_DETECTED = 8;
+	/** The number of the successful reverts. */
+	public static final int REVERTS = 9;
+	/** The number of the failed reverts. */
+	public static final int REVERTS_FAILED = 10;
+	/** The number of the revert opportunities skipped as unsafe on this system. */
+	public static final int REVERTS_DEFERRED = 11;
+	/** The number of the reverts performed at the expiration of the revert deadline. */
+	public static final int REVERTS_BY_DEADLINE = 12;
+	/** The number of the keys typed while a revert was pending, and re-emitted in the locked language. */
+	public static final int KEYS_REMAPPED = 13;
+
+	private static final int COUNTERS = 14;
+	private static final int LATENCY_BUCKETS = 32;
+
+	private final long[] values;
+
+	private LockStatistics(long[] values) {
+		this.values = values;
+	}
+
+	/**
+	 * Reads the current statistics.
+	 *
+	 * @return the statistics, or {@code null} if not supported by the native library
+	 */
+	public static LockStatistics read() {
+		long[] values;
+		try {
+			values = LockEngine.getLockStatistics();
+		} catch (UnsatisfiedLinkError e) {
+			// an older native library
+			return null;
+		}
+		return values != null && values.length == 1 + COUNTERS + LATENCY_BUCKETS ? new LockStatistics(values) : null;
+	}
+
+	/**
+	 * Returns the number of the currently hooked threads.
+	 */
+	public int getHookedThreads() {
+		return (int) values[0];
+	}
+
+	/**
+	 * Returns the value of the counter, like {@link #REVERTS}.
+	 */
+	public long getCounter(int counter) {
+		if (counter < 0 || counter >= COUNTERS) {
+			throw new IllegalArgumentException("Unknown counter: " + counter);
+		}
+		return values[1 + counter];
+	}
+
+	/**
+	 * Returns the histogram of the times from the detection of an unwanted language switch to its revert.
+	 * The element {@code i} is the number of the reverts with the latency in [2^i, 2^(i+1)) microseconds,
+	 * the element 0 counts all latencies below 2 microseconds, and the last one counts all longer latencies.
+	 */
+	public long[] getRevertLatencyHistogram() {
+		long[] histogram = new long[LATENCY_BUCKETS];
+		System.arraycopy(values, 1 + COUNTERS, histogram, 0, LATENCY_BUCKETS);
+		return histogram;
+	}
+}
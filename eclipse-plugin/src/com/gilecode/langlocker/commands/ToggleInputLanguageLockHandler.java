@@ -6,13 +6,18 @@ import org.eclipse.core.commands.ExecutionException;
 import org.eclipse.core.commands.IHandler;
 import org.eclipse.core.commands.IHandlerListener;
 import org.eclipse.core.commands.State;
+import org.eclipse.core.runtime.IStatus;
 import org.eclipse.core.runtime.preferences.IEclipsePreferences;
 import org.eclipse.core.runtime.preferences.InstanceScope;
 import org.eclipse.ui.PlatformUI;
 import org.eclipse.ui.commands.ICommandService;
 import org.eclipse.ui.handlers.RegistryToggleState;
 
+import com.gilecode.langlocker.Activator;
 import com.gilecode.langlocker.LockEngine;
+import com.gilecode.langlocker.LockEvent;
+import com.gilecode.langlocker.LockEventListener;
+import com.gilecode.langlocker.LockStatus;
 
 /**
  * The handler which processes clicks on "Lock/unlock input language" button.
@@ -27,12 +32,24 @@ public class ToggleInputLanguageLockHandler implements IHandler {
 	 * persisted lock state.
 	 */
 	public ToggleInputLanguageLockHandler() {
+		LockEngine.setEventListener(new LockEventListener() {
+			@Override
+			public void lockEventsOccurred(LockEvent[] events) {
+				for (LockEvent event : events) {
+					if (event.isFailure() || event.getType() == LockEvent.DROPPED) {
+						Activator.log(IStatus.WARNING, "Input language lock problem: " + event, null);
+					}
+				}
+			}
+		});
 		restoreLockState();
 	}
 
 	/**
 	 * Restores the persisted lock state (whether is locked) and, if
-	 * was locked, the previously locked language.
+	 * was locked, the previously locked language. The native library may
+	 * have already restored the lock persisted by itself, then it is only
+	 * adopted, and the preferences are the fallback.
 	 */
 	private void restoreLockState() {
 		ICommandService commandService = (ICommandService) PlatformUI
@@ -44,6 +61,14 @@ public class ToggleInputLanguageLockHandler implements IHandler {
 			return;
 		}
 		
+		LockStatus status = LockStatus.read();
+		State state = command.getState(RegistryToggleState.STATE_ID);
+		if (status != null && status.isLocked() && state != null) {
+			getPreferences().putLong(PREFID_LANGUAGE, status.getLockedLanguage());
+			state.setValue(Boolean.TRUE);
+			return;
+		}
+		
 		// apply the lock according to the current state
 		updateLockStates(command, false);
 	}
@@ -72,6 +97,13 @@ public class ToggleInputLanguageLockHandler implements IHandler {
 		// check if locked
 		boolean prevLocked, newLocked; // previous and new command states
 		prevLocked = ((Boolean) state.getValue()).booleanValue();
+		if (toggle) {
+			// toggle the actual state published by the native library, if available
+			LockStatus status = LockStatus.read();
+			if (status != null) {
+				prevLocked = status.isLocked();
+			}
+		}
 		newLocked = toggle ? !prevLocked : prevLocked;
 		
 		// locked language is stored in preferences. It is used only in 'restore' action, as while
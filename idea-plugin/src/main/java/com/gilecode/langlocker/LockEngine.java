@@ -1,14 +1,22 @@
 package com.gilecode.langlocker;
 
 import com.intellij.openapi.diagnostic.Logger;
-import com.intellij.openapi.util.io.FileUtil;
-import com.intellij.util.io.IOUtil;
 
 import java.io.*;
 import java.net.URL;
+import java.nio.ByteBuffer;
+import java.util.ArrayList;
+import java.util.Iterator;
+import java.util.LinkedHashMap;
+import java.util.List;
+import java.util.Map;
+import java.util.concurrent.CompletableFuture;
 
 /**
  * Accessor to system-dependent native implementations of lock/unlock actions.
+ * <p>
+ * The native library is loaded lazily, by {@link #ensureLoaded()}, which is called by the asynchronous lock
+ * methods. The native methods may be called directly only after it succeeds.
  *
  * @author Andrey Mogilev
  */
@@ -16,6 +24,7 @@ public class LockEngine {
 
     private static final Logger log = Logger.getInstance(LockEngine.class);
     private static final String LOCKER_DLL = "lang-locker.dll";
+    private static final String LOCKER_SO = "liblang-locker.so";
 
     /**
      * If the specified languageId is zero, then blocks input language switches
@@ -29,49 +38,315 @@ public class LockEngine {
      */
     public static native long lockInputLanguage(long languageId);
 
+    /**
+     * Like {@link #lockInputLanguage(long)}, but permits the switches between several languages, e.g. between
+     * the English layouts. The switches to other languages are reverted to the most recently used permitted one.
+     *
+     * @param languageIds the permitted language IDs, up to 16
+     * @param primaryLanguage the primary language (low 10 bits of LANGID) which layouts are all permitted, or 0
+     *
+     * @return the ID of locked language, or 0 if failed to lock
+     */
+    public static native long lockInputLanguageSet(long[] languageIds, int primaryLanguage);
+
     /**
      * Unlocks the language, if previously locked.
      */
     public static native void unlockInputLanguage();
 
-    static {
-        // TODO: check if throws are logged properly
-        String osName = System.getProperty("os.name");
-        if (osName == null || !osName.toLowerCase().startsWith("windows")) {
-            throw new IllegalStateException("This plug-in works only for Windows, but 'os.name'=" + osName);
+    /**
+     * Locks the specified language for the native window (either top-level or child) and its child windows.
+     * While the language is locked by {@link #lockInputLanguage(long)}, this language is used instead of
+     * the globally locked one when the focus is in that window.
+     *
+     * @param hwnd the handle of the native window
+     * @param languageId the language ID returned by {@link #lockInputLanguage(long)}
+     *
+     * @return whether succeeded; fails if too many windows have locked languages
+     */
+    public static native boolean lockWindowInputLanguage(long hwnd, long languageId);
+
+    /**
+     * Removes the language locked for the native window, so that the globally locked language is used for it.
+     *
+     * @param hwnd the handle of the native window
+     */
+    public static native void unlockWindowInputLanguage(long hwnd);
+
+    /**
+     * Returns the direct buffer of the lock status block, which is updated by the native library.
+     * Use {@link LockStatus#read()} to read it consistently.
+     */
+    public static native ByteBuffer getStatusBuffer();
+
+    /**
+     * Returns the installed input languages (keyboard layouts), in the order of the system list. The languages
+     * are indexed by the native library, so the call does not enumerate them each time.
+     *
+     * @return two values per language: the language ID, as used by {@link #lockInputLanguage(long)}, and
+     *   the Windows language identifier (LANGID), which low 10 bits are the primary language
+     */
+    public static native long[] getInstalledLayouts();
+
+    /**
+     * Sets the rules which select the locking policies of the windows, like leaving popups free or locking
+     * a specific language in some windows. The rules are applied at the next lock. See window-rules.h in the
+     * native library for the syntax.
+     *
+     * @param rules the rules, one per line; an empty string removes the rules
+     * @return whether all rules are valid; the invalid ones are skipped
+     */
+    public static native boolean setWindowRules(String rules);
+
+    /**
+     * Hints the language wanted in the current context, e.g. at the caret, while the language is locked. The hints
+     * may be posted at any rate, e.g. on each caret move: only the latest one is applied, by changing the locked
+     * language on the main thread, at most once per turn of its message loop.
+     *
+     * @param languageId the wanted language ID
+     * @return whether the hint is accepted; it is not if the language is not locked
+     */
+    public static native boolean postLayoutHint(long languageId);
+
+    /**
+     * Returns the statistics of the hooks, see {@link LockStatistics#read()} for the interpretation.
+     */
+    static native long[] getLockStatistics();
+
+    /**
+     * Starts the native thread which delivers the lock events to {@link #dispatchEvents(long[])}.
+     * Does nothing if already started.
+     *
+     * @return whether the events are supported
+     */
+    private static native boolean startEventNotifier();
+
+    // the types of the commands for postLockCommand(), see lock-commands.h
+    private static final int COMMAND_LOCK = 1;
+    private static final int COMMAND_UNLOCK = 2;
+
+    /**
+     * Queues the command for the main thread of the IDE. The command completes with {@link LockEvent#COMMAND_COMPLETED}
+     * with the specified sequence number.
+     *
+     * @return whether the command is queued; if not, it shall be executed synchronously
+     */
+    private static native boolean postLockCommand(int type, long languageId, int sequence);
+
+    // the futures of the queued commands by their sequence numbers, in the order of queuing
+    private static final Map<Integer, CompletableFuture<Long>> pendingCommands = new LinkedHashMap<>();
+    private static int lastCommandSequence;
+
+    private static volatile LockEventListener eventListener;
+
+    /**
+     * Like {@link #lockInputLanguage(long)}, but the lock is performed on the main thread of the IDE, which
+     * receives the input language switches, so the caller never blocks on the OS.
+     *
+     * @param languageId the language ID returned by previous invocations, or 0 to lock the current language
+     *
+     * @return the future of the ID of locked language, which is 0 if failed to lock
+     */
+    public static CompletableFuture<Long> lockInputLanguageAsync(long languageId) {
+        return postCommand(COMMAND_LOCK, languageId);
+    }
+
+    /**
+     * Like {@link #unlockInputLanguage()}, but the unlock is performed on the main thread of the IDE.
+     *
+     * @return the future which completes with 0 when unlocked
+     */
+    public static CompletableFuture<Long> unlockInputLanguageAsync() {
+        return postCommand(COMMAND_UNLOCK, 0);
+    }
+
+    private static CompletableFuture<Long> postCommand(int type, long languageId) {
+        if (!ensureLoaded()) {
+            return CompletableFuture.completedFuture(0L);
         }
 
+        // the commands complete with the events, so the notifier is required
+        if (startNotifier()) {
+            synchronized (pendingCommands) {
+                try {
+                    int sequence = ++lastCommandSequence;
+                    if (postLockCommand(type, languageId, sequence)) {
+                        CompletableFuture<Long> future = new CompletableFuture<>();
+                        pendingCommands.put(sequence, future);
+                        return future;
+                    }
+                } catch (UnsatisfiedLinkError e) {
+                    // an older native library
+                }
+            }
+        }
+
+        if (type == COMMAND_LOCK) {
+            return CompletableFuture.completedFuture(lockInputLanguage(languageId));
+        }
+        unlockInputLanguage();
+        return CompletableFuture.completedFuture(0L);
+    }
+
+    private static boolean startNotifier() {
+        try {
+            return startEventNotifier();
+        } catch (UnsatisfiedLinkError e) {
+            // an older native library
+            return false;
+        }
+    }
+
+    /**
+     * Completes the futures of the queued commands by the completion events, matched by the sequence numbers.
+     * <p>
+     * If the completions are dropped, {@link LockEvent#DROPPED} carries the sequence number of the last command
+     * executed by then, so only the commands up to it are completed, with the actual state. E.g. if commands 1-3 are
+     * queued and the drop is reported after 1 is executed, it completes 1, while 2 and 3 are completed later by their
+     * own events. An event of a command which is already completed by a drop is ignored.
+     */
+    private static void completeCommands(LockEvent[] events) {
+        List<CompletableFuture<Long>> completed = new ArrayList<>();
+        List<Long> results = new ArrayList<>();
+        synchronized (pendingCommands) {
+            for (LockEvent event : events) {
+                if (event.getType() == LockEvent.COMMAND_COMPLETED) {
+                    CompletableFuture<Long> future = pendingCommands.remove(event.getSequence());
+                    if (future != null) {
+                        completed.add(future);
+                        results.add(event.getLanguageId());
+                    }
+                } else if (event.getType() == LockEvent.DROPPED && !pendingCommands.isEmpty()) {
+                    // the completions of the executed commands may be lost, so complete them with the actual state
+                    LockStatus status = LockStatus.read();
+                    Iterator<Map.Entry<Integer, CompletableFuture<Long>>> it = pendingCommands.entrySet().iterator();
+                    while (it.hasNext()) {
+                        Map.Entry<Integer, CompletableFuture<Long>> entry = it.next();
+                        // the sequence numbers may wrap around
+                        if (entry.getKey() - event.getSequence() > 0) {
+                            break;
+                        }
+                        it.remove();
+                        completed.add(entry.getValue());
+                        results.add(status != null ? status.getLockedLanguage() : 0L);
+                    }
+                }
+            }
+        }
+        // the dependent actions run outside of the lock
+        for (int i = 0; i < completed.size(); i++) {
+            completed.get(i).complete(results.get(i));
+        }
+    }
+
+    /**
+     * Sets the listener of the lock events, like failed reverts of the input language.
+     *
+     * @param listener the listener, or {@code null} to ignore the events
+     *
+     * @return whether the events are supported by the native library; if it is not loaded yet, the events
+     *   are started when it is loaded
+     */
+    public static boolean setEventListener(LockEventListener listener) {
+        synchronized (loadLock) {
+            eventListener = listener;
+            return loaded && startNotifier();
+        }
+    }
+
+    /**
+     * Invoked by the native notifier thread with {@link LockEvent#FIELDS} values per event.
+     */
+    private static void dispatchEvents(long[] data) {
+        LockEvent[] events = new LockEvent[data.length / LockEvent.FIELDS];
+        for (int i = 0; i < events.length; i++) {
+            events[i] = new LockEvent(data, i * LockEvent.FIELDS);
+        }
+        completeCommands(events);
+
+        LockEventListener listener = eventListener;
+        if (listener == null) {
+            return;
+        }
+        try {
+            listener.lockEventsOccurred(events);
+        } catch (Throwable e) {
+            log.error("Failed to process the lock events", e);
+        }
+    }
+
+    private static final Object loadLock = new Object();
+    private static volatile boolean loaded;
+    private static boolean loadAttempted;
+
+    /**
+     * Returns whether the native library is loaded. The native methods may be called only if it is.
+     */
+    static boolean isLoaded() {
+        return loaded;
+    }
+
+    /**
+     * Loads the native library, at the first call. The library is loaded at the first lock rather than at the
+     * class load, so that the IDE start is not slowed down while the lock is not used.
+     *
+     * @return whether the library is loaded
+     */
+    public static boolean ensureLoaded() {
+        if (loaded) {
+            return true;
+        }
+        synchronized (loadLock) {
+            if (!loadAttempted) {
+                loadAttempted = true;
+                try {
+                    loadLibrary();
+                    loaded = true;
+                } catch (Throwable e) {
+                    log.error("Failed to load the native library", e);
+                }
+                if (loaded && eventListener != null) {
+                    // the listener is set before the library is loaded
+                    startNotifier();
+                }
+            }
+            return loaded;
+        }
+    }
+
+    private static void loadLibrary() throws IOException {
+        String osName = System.getProperty("os.name");
         String arch = System.getProperty("sun.arch.data.model");
-        String libPath;
-        if ("64".equals(arch)) {
-            libPath = "libs/x64/";
-        } else if ("32".equals(arch)){
-            libPath = "libs/win32/";
+        String libName, libPath;
+        if (osName != null && osName.toLowerCase().startsWith("windows")) {
+            libName = LOCKER_DLL;
+            if ("64".equals(arch)) {
+                libPath = "libs/x64/";
+            } else if ("32".equals(arch)){
+                libPath = "libs/win32/";
+            } else {
+                throw new IllegalStateException("Unexpected value for 'sun.arch.data.model':" + arch);
+            }
+        } else if (osName != null && osName.toLowerCase().startsWith("linux")) {
+            // the X11 library, which locks the XKB groups
+            libName = LOCKER_SO;
+            if ("64".equals(arch)) {
+                libPath = "libs/linux64/";
+            } else {
+                throw new IllegalStateException("Unexpected value for 'sun.arch.data.model':" + arch);
+            }
         } else {
-            throw new IllegalStateException("Unexpected value for 'sun.arch.data.model':" + arch);
+            throw new IllegalStateException("This plug-in works only for Windows and Linux, but 'os.name'=" + osName);
         }
 
-        URL libUrl = LockEngine.class.getClassLoader().getResource(libPath + LOCKER_DLL);
+        URL libUrl = LockEngine.class.getClassLoader().getResource(libPath + libName);
 
         if (libUrl == null) {
-            log.error("Could not find " + LOCKER_DLL);
+            throw new FileNotFoundException("Could not find " + libName);
         } else if (!new File(libUrl.getFile()).isFile()) {
-            // probably, we are inside JAR. Copy DLL to a temporary file
+            // probably, we are inside JAR. Extract the library to the cache
             // NOTE: this case is not expected since 2.2, but kept supported
-            try {
-                File tmpDll = FileUtil.createTempFile("tempLangLocker", ".dll");
-                try(InputStream is = LockEngine.class.getClassLoader().getResourceAsStream(libPath + LOCKER_DLL);
-                    OutputStream out = new FileOutputStream(tmpDll)
-                ) {
-                    FileUtil.copy(is, out);
-                }
-                tmpDll.deleteOnExit();
-
-                // load native methods from the temporary DLL
-                System.load(tmpDll.getAbsolutePath());
-            } catch (IOException e) {
-                log.error("Failed to create a temporary file", e);
-            }
+            System.load(NativeLibraryCache.extract(libPath + libName, libName).getAbsolutePath());
         } else {
             // load native methods from the plugin-hosted DLL
             System.load(libUrl.getFile());
@@ -0,0 +1,18 @@
+package com.gilecode.langlocker;
+
+/**
+ * Listener of the lock events reported by the native library.
+ *
+ * @author Andrey Mogilev
+ */
+public interface LockEventListener {
+
+    /**
+     * Invoked with a batch of the events. The batches are delivered not more often than a few times per second.
+     * <p/>
+     * NOTE: invoked in the native notifier thread, so the UI shall be updated in the UI thread.
+     *
+     * @param events the events, in the order of their occurrence
+     */
+    void lockEventsOccurred(LockEvent[] events);
+}
@@ -0,0 +1,129 @@
+package com.gilecode.langlocker;
+
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+
+/**
+ * Snapshot of the lock status published by the native library in a shared memory block, see
+ * {@link LockEngine#getStatusBuffer()}. Reading it requires no native calls, so it is cheap enough
+ * for the action updates.
+ * <p/>
+ * The layout mirrors LockStatusBlock in lock-status.h. The block is protected by a seqlock: the
+ * sequence is odd while the native code changes the fields, so the reader retries if the sequence
+ * is odd or has changed during the reading.
+ *
+ * @author Andrey Mogilev
+ */
+public final class LockStatus {
+
+    private static final int STATUS_VERSION = 1;
+
+    private static final int SEQUENCE_OFFSET = 0;
+    private static final int VERSION_OFFSET = 4;
+    private static final int LOCKED_LANGUAGE_OFFSET = 8;
+    private static final int CURRENT_LANGUAGE_OFFSET = 16;
+    private static final int REVERT_COUNT_OFFSET = 24;
+    private static final int LAST_ERROR_OFFSET = 32;
+
+    // the buffer is opened at the first read after the native library is loaded, see LockEngine#ensureLoaded()
+    private static class BufferHolder {
+        static final ByteBuffer buffer = openBuffer();
+    }
+
+    // the volatile accesses order the plain reads of the buffer between the reads of the sequence
+    private static volatile int barrier;
+
+    private final long lockedLanguage;
+    private final long currentLanguage;
+    private final long revertCount;
+    private final int lastError;
+
+    private LockStatus(long lockedLanguage, long currentLanguage, long revertCount, int lastError) {
+        this.lockedLanguage = lockedLanguage;
+        this.currentLanguage = currentLanguage;
+        this.revertCount = revertCount;
+        this.lastError = lastError;
+    }
+
+    private static ByteBuffer openBuffer() {
+        ByteBuffer buffer;
+        try {
+            buffer = LockEngine.getStatusBuffer();
+        } catch (UnsatisfiedLinkError e) {
+            // an older native library
+            return null;
+        }
+        if (buffer == null) {
+            return null;
+        }
+        buffer.order(ByteOrder.nativeOrder());
+        return buffer.getInt(VERSION_OFFSET) == STATUS_VERSION ? buffer : null;
+    }
+
+    /**
+     * Reads the current lock status.
+     *
+     * @return the consistent snapshot of the status, or {@code null} if not supported by the native library,
+     *   or it is not loaded yet
+     */
+    public static LockStatus read() {
+        if (!LockEngine.isLoaded()) {
+            return null;
+        }
+        ByteBuffer buffer = BufferHolder.buffer;
+        if (buffer == null) {
+            return null;
+        }
+        while (true) {
+            int seq = buffer.getInt(SEQUENCE_OFFSET);
+            if ((seq & 1) != 0) {
+                // being changed right now
+                Thread.yield();
+                continue;
+            }
+            int b = barrier;
+            LockStatus status = new LockStatus(buffer.getLong(LOCKED_LANGUAGE_OFFSET),
+                    buffer.getLong(CURRENT_LANGUAGE_OFFSET), buffer.getLong(REVERT_COUNT_OFFSET),
+                    buffer.getInt(LAST_ERROR_OFFSET));
+            barrier = b;
+            if (buffer.getInt(SEQUENCE_OFFSET) == seq) {
+                return status;
+            }
+        }
+    }
+
+    /**
+     * Returns whether the input language is locked.
+     */
+    public boolean isLocked() {
+        return lockedLanguage != 0;
+    }
+
+    /**
+     * Returns the ID of the locked language, or 0 if not locked.
+     */
+    public long getLockedLanguage() {
+        return lockedLanguage;
+    }
+
+    /**
+     * Returns the ID of the input language at the last language change, or 0 if unknown.
+     */
+    public long getCurrentLanguage() {
+        return currentLanguage;
+    }
+
+    /**
+     * Returns the number of the language switches reverted since the library is loaded.
+     */
+    public long getRevertCount() {
+        return revertCount;
+    }
+
+    /**
+     * Returns the Windows error code of the last failed language switch or hook setting, or 0.
+     */
+    public int getLastError() {
+        return lastError;
+    }
+}
@@ -0,0 +1,101 @@
+package com.gilecode.langlocker;
+
+import com.intellij.openapi.application.PathManager;
+import com.intellij.openapi.diagnostic.Logger;
+import com.intellij.openapi.util.io.FileUtil;
+import com.intellij.openapi.util.text.StringUtil;
+
+import java.io.*;
+import java.nio.file.Files;
+import java.nio.file.StandardCopyOption;
+import java.security.MessageDigest;
+import java.security.NoSuchAlgorithmException;
+
+/**
+ * The cache of the native libraries extracted from the plugin JAR, in the system directory of the IDE.
+ * <p>
+ * Each library is extracted to a directory named by the hash of its content, so the extracted file is reused
+ * by the next IDE starts, and a new version of the plugin never loads a stale library. The file is written
+ * to a temporary name and then renamed, so that several IDE instances starting at once never see it partially
+ * written.
+ *
+ * @author Andrey Mogilev
+ */
+class NativeLibraryCache {
+
+    private static final Logger log = Logger.getInstance(NativeLibraryCache.class);
+    private static final String CACHE_DIR = "lang-locker";
+
+    // the length of the hash prefix used in the names of the directories
+    private static final int HASH_PREFIX_LENGTH = 16;
+
+    /**
+     * Returns the cached copy of the library resource, extracting it if not cached yet.
+     *
+     * @param resource the path of the resource
+     * @param libName the file name of the library
+     */
+    static File extract(String resource, String libName) throws IOException {
+        byte[] content;
+        try (InputStream is = LockEngine.class.getClassLoader().getResourceAsStream(resource)) {
+            if (is == null) {
+                throw new FileNotFoundException("Could not find " + resource);
+            }
+            content = FileUtil.loadBytes(is);
+        }
+
+        File cacheDir = new File(PathManager.getSystemPath(), CACHE_DIR);
+        String dirName = hash(content).substring(0, HASH_PREFIX_LENGTH);
+        File dir = new File(cacheDir, dirName);
+        File target = new File(dir, libName);
+
+        // the directory name checks the content, so the length is enough to detect a truncated file
+        if (target.isFile() && target.length() == content.length) {
+            return target;
+        }
+
+        if (!dir.isDirectory() && !dir.mkdirs()) {
+            throw new IOException("Failed to create " + dir);
+        }
+        File tmp = File.createTempFile(libName, ".tmp", dir);
+        try {
+            try (OutputStream out = new FileOutputStream(tmp)) {
+                out.write(content);
+            }
+            try {
+                Files.move(tmp.toPath(), target.toPath(), StandardCopyOption.ATOMIC_MOVE);
+            } catch (IOException e) {
+                // the target may be already written by another IDE instance, and loaded, so locked by Windows
+                if (!target.isFile() || target.length() != content.length) {
+                    throw e;
+                }
+            }
+        } finally {
+            FileUtil.delete(tmp);
+        }
+
+        removeStaleDirs(cacheDir, dirName);
+        return target;
+    }
+
+    private static String hash(byte[] content) throws IOException {
+        try {
+            return StringUtil.toHexString(MessageDigest.getInstance("SHA-256").digest(content));
+        } catch (NoSuchAlgorithmException e) {
+            throw new IOException(e);
+        }
+    }
+
+    // removes the libraries of the previous versions; those loaded by running IDE instances are locked and kept
+    private static void removeStaleDirs(File cacheDir, String currentDirName) {
+        File[] dirs = cacheDir.listFiles();
+        if (dirs == null) {
+            return;
+        }
+        for (File dir : dirs) {
+            if (dir.isDirectory() && !dir.getName().equals(currentDirName) && !FileUtil.delete(dir)) {
+                log.debug("Failed to remove the stale library directory " + dir);
+            }
+        }
+    }
+}
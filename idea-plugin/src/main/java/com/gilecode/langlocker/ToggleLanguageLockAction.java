@@ -5,27 +5,62 @@ import com.intellij.openapi.actionSystem.AnAction;
 import com.intellij.openapi.actionSystem.AnActionEvent;
 import com.intellij.openapi.actionSystem.ToggleAction;
 import com.intellij.openapi.application.ApplicationManager;
+import com.intellij.openapi.diagnostic.Logger;
 
 import java.awt.*;
+import java.util.concurrent.CompletableFuture;
+import java.util.function.Consumer;
 
 /**
  * @author Andrey Mogilev
  */
 public class ToggleLanguageLockAction extends ToggleAction {
 
+    private static final Logger log = Logger.getInstance(ToggleLanguageLockAction.class);
     private static final String PREF_LANGUAGE = "com.gilecode.langlocker.lockedLanguageId";
 
     private static boolean isLocked = false;
 
     public ToggleLanguageLockAction() {
+        LockEngine.setEventListener(new LockEventListener() {
+            @Override
+            public void lockEventsOccurred(LockEvent[] events) {
+                for (LockEvent event : events) {
+                    if (event.isFailure() || event.getType() == LockEvent.DROPPED) {
+                        log.warn("Input language lock problem: " + event);
+                    } else if (log.isDebugEnabled()) {
+                        log.debug(event.toString());
+                    }
+                }
+            }
+        });
+        // the native library restores the lock persisted by itself as soon as it is loaded and the main thread
+        // is detected, so load it right away if locked
+        if (!"0".equals(PropertiesComponent.getInstance().getValue(PREF_LANGUAGE, "0"))) {
+            LockEngine.ensureLoaded();
+        }
         ApplicationManager.getApplication().invokeLater(new Runnable() {
             @Override
             public void run() {
-                toggleOrRestoreLanguageLock(false);
+                restoreLanguageLock();
             }
         });
     }
 
+    /**
+     * Restores the lock at IDEA startup, unless it is already restored by the native library. The persisted
+     * language is the fallback, e.g. if the native state is missing.
+     */
+    private void restoreLanguageLock() {
+        LockStatus status = LockStatus.read();
+        if (status != null && status.isLocked()) {
+            isLocked = true;
+            PropertiesComponent.getInstance().setValue(PREF_LANGUAGE, Long.toString(status.getLockedLanguage()));
+        } else {
+            toggleOrRestoreLanguageLock(false);
+        }
+    }
+
     /**
      * Tries to apply the lock state, either by a toggle action, or by restoring it at IDEA startup.
      * <p/>
@@ -49,30 +84,47 @@ public class ToggleLanguageLockAction extends ToggleAction {
         prevLocked = isLocked;
         newLocked = toggle ? !prevLocked : langId > 0;
 
-        // try apply the new state
+        if (!toggle && !newLocked && !LockEngine.isLoaded()) {
+            // nothing to unlock, and the native library is loaded only at the first lock
+            isLocked = false;
+            return;
+        }
+
+        // try apply the new state. It is applied on the main thread of IDEA, so wait for the result without
+        // blocking, and then persist it in the EDT
+        CompletableFuture<Long> result;
         if (!newLocked) {
-            LockEngine.unlockInputLanguage();
-            langId = 0;
+            result = LockEngine.unlockInputLanguageAsync();
         } else {
             // lock either current or specified language, depending on whether langId is 0
-            langId = LockEngine.lockInputLanguage(langId);
-            if (langId == 0) {
-                // failed to lock, revert the command/button state to "unlocked"
-                newLocked = false;
-            }
+            result = LockEngine.lockInputLanguageAsync(langId);
         }
-
-        // persist the new states
-        props.setValue(PREF_LANGUAGE, Long.toString(langId));
+        // assume success until completed, so that a quick repeated toggle is applied to the new state
         isLocked = newLocked;
 
-//        System.out.println("  END toggleOrRestoreLanguageLock(): toggle=" + toggle + "; isLocked=" + isLocked  +
-//                "; langId=" + langId  +  "; prop = " + props.getValue(PREF_LANGUAGE));
+        result.thenAccept(new Consumer<Long>() {
+            @Override
+            public void accept(final Long lockedLangId) {
+                ApplicationManager.getApplication().invokeLater(new Runnable() {
+                    @Override
+                    public void run() {
+                        // if failed to lock, lockedLangId is 0, so the command/button state is reverted to "unlocked"
+                        PropertiesComponent.getInstance().setValue(PREF_LANGUAGE, Long.toString(lockedLangId));
+                        isLocked = lockedLangId != 0;
+
+//                        System.out.println("  END toggleOrRestoreLanguageLock(): toggle=" + toggle + "; isLocked=" + isLocked  +
+//                                "; langId=" + lockedLangId  +  "; prop = " + props.getValue(PREF_LANGUAGE));
+                    }
+                });
+            }
+        });
     }
 
     @Override
     public boolean isSelected(AnActionEvent anActionEvent) {
-        return isLocked;
+        // prefer the actual state published by the native library, as the lock may be changed not by this action
+        LockStatus status = LockStatus.read();
+        return status != null ? status.isLocked() : isLocked;
     }
 
     @Override
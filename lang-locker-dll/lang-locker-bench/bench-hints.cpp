@@ -0,0 +1,81 @@
+/*
+ * bench-hints.cpp : simulates bursts of caret moves, each posting a layout hint, see PostLayoutHint().
+ *
+ * The current thread plays the main thread: it posts a burst of the hints alternating between two layouts, and
+ * then pumps its messages, so that the command hook applies the latest hint. The activations are counted by
+ * a platform table wrapping the default one, to show how many hints are coalesced into one activation.
+ */
+
+#include "stdafx.h"
+#include <stdio.h>
+#include "lang-locker.h"
+#include "platform.h"
+#include "lock-commands.h"
+#include "bench.h"
+
+const int HINT_BURSTS = 1000;
+const int HINTS_PER_BURST = 1000;
+
+static Platform countingPlatform;
+static HKL (WINAPI *defaultActivateKeyboardLayout)(HKL, UINT);
+static long long activations = 0;
+
+static HKL WINAPI CountingActivateKeyboardLayout(HKL languageHandle, UINT flags) {
+	activations++;
+	return defaultActivateKeyboardLayout(languageHandle, flags);
+}
+
+static void PumpMessages() {
+	MSG msg;
+	while (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE)) {
+		DispatchMessage(&msg);
+	}
+}
+
+void BenchLayoutHints() {
+	HKL curLang = GetKeyboardLayout(0);
+	HKL otherLang = FindOtherLayout(curLang);
+	if (!otherLang) {
+		printf("  skipped: at least two keyboard layouts are required\n");
+		return;
+	}
+
+	countingPlatform = *platform;
+	defaultActivateKeyboardLayout = countingPlatform.activateKeyboardLayout;
+	countingPlatform.activateKeyboardLayout = CountingActivateKeyboardLayout;
+	SetPlatform(&countingPlatform);
+
+	// the language is locked with no hooks, only the command hook is set
+	mainThreadId = GetCurrentThreadId();
+	SetLockedLanguage(curLang);
+	if (!StartLockCommands()) {
+		printf("  skipped: failed to set the command hook\n");
+		SetLockedLanguage(NULL);
+		SetPlatform(NULL);
+		return;
+	}
+
+	long long hints = 0;
+	Stopwatch postWatch;
+	double pumpSeconds = 0;
+	for (int burst = 0; burst < HINT_BURSTS; burst++) {
+		for (int i = 0; i < HINTS_PER_BURST; i++) {
+			PostLayoutHint((burst + i) & 1 ? otherLang : curLang);
+			hints++;
+		}
+		Stopwatch pumpWatch;
+		PumpMessages();
+		pumpSeconds += pumpWatch.ElapsedSeconds();
+	}
+	double seconds = postWatch.ElapsedSeconds();
+
+	ReportBench("post hint", hints, seconds - pumpSeconds);
+	ReportBench("apply per burst", HINT_BURSTS, pumpSeconds);
+	printf("  %lld hints, %lld activations\n", hints, activations);
+
+	StopLockCommands();
+	PumpMessages();
+	SetLockedLanguage(NULL);
+	ActivateKeyboardLayout(curLang, 0);
+	SetPlatform(NULL);
+}
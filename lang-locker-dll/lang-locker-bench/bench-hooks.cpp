@@ -0,0 +1,61 @@
+/*
+ * bench-hooks.cpp : measures the cost of HookGetMsgProc per message, for different lock states.
+ *
+ * The hook procedure is invoked directly, i.e. with no hooks actually set. CallNextHookEx() is cheap
+ * in this case, so the results mostly show the overhead of the hook itself.
+ */
+
+#include "stdafx.h"
+#include "lang-locker.h"
+#include "window-locks.h"
+#include "bench.h"
+
+// a fake window which gets the messages
+static const HWND BENCH_WINDOW = (HWND)0x10010;
+
+static void RunHookGetMsgProc(const char* name, UINT message, long long count, HookedThread* requestRevert) {
+	MSG msg = { 0 };
+	msg.hwnd = BENCH_WINDOW;
+	msg.message = message;
+
+	Stopwatch watch;
+	for (long long i = 0; i < count; i++) {
+		if (requestRevert) {
+			RequestLanguageRevert(requestRevert);
+		}
+		HookGetMsgProc(HC_ACTION, PM_REMOVE, (LPARAM)&msg);
+	}
+	ReportBench(name, count, watch.ElapsedSeconds());
+}
+
+void BenchHookGetMsgProc() {
+	HKL curLang = GetKeyboardLayout(0);
+	mainThreadId = GetCurrentThreadId();
+	HookedThread* thread = AddHookedThread(mainThreadId);
+
+	SetLockedLanguage(NULL);
+	RunHookGetMsgProc("unlocked, WM_TIMER", WM_TIMER, 50000000, NULL);
+
+	SetLockedLanguage(curLang);
+	RunHookGetMsgProc("locked-idle, WM_TIMER", WM_TIMER, 50000000, NULL);
+	RunHookGetMsgProc("locked-idle, WM_PAINT", WM_PAINT, 50000000, NULL);
+
+	// each message performs the actual revert, i.e. calls ActivateKeyboardLayout()
+	RunHookGetMsgProc("revert-pending, WM_TIMER", WM_TIMER, 100000, thread);
+
+	// with the languages locked for windows, the key presses resolve the layout of the focused window, which is
+	// cached by the thread
+	SetWindowLockLayout(BENCH_WINDOW, HKLToLayout(curLang));
+	SetWindowBindingsFlag(true);
+	RunHookGetMsgProc("window bindings, WM_TIMER", WM_TIMER, 50000000, NULL);
+	RunHookGetMsgProc("window bindings, WM_KEYDOWN", WM_KEYDOWN, 10000000, NULL);
+	SetWindowLockLayout(BENCH_WINDOW, 0);
+	SetWindowBindingsFlag(false);
+
+	// a revert pending in another GUI thread disables the fast path, but does not cause reverts in this one
+	RequestLanguageRevert(AddHookedThread(mainThreadId + 4));
+	RunHookGetMsgProc("revert-pending in other thread, WM_TIMER", WM_TIMER, 10000000, NULL);
+
+	SetLockedLanguage(NULL);
+	ClearHookedThreads();
+}
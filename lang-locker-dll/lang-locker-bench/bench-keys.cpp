@@ -0,0 +1,40 @@
+/*
+ * bench-keys.cpp : measures the cost of HookKeyboardProc per key while no revert is pending, see key-remap.h.
+ *
+ * The hook procedure is invoked directly, i.e. with no hooks actually set. The key remapping is only useful
+ * if it does not slow down the usual typing, so this is the path which matters.
+ */
+
+#include "stdafx.h"
+#include "lang-locker.h"
+#include "bench.h"
+
+// the key 'A', repeat count 1, and the same with the "key up" transition
+static const LPARAM KEY_DOWN_A = 0x001E0001;
+static const LPARAM KEY_UP_A = 0xC01E0001;
+
+static void RunHookKeyboardProc(const char* name, long long count) {
+	Stopwatch watch;
+	for (long long i = 0; i < count; i += 2) {
+		HookKeyboardProc(HC_ACTION, 'A', KEY_DOWN_A);
+		HookKeyboardProc(HC_ACTION, 'A', KEY_UP_A);
+	}
+	ReportBench(name, count, watch.ElapsedSeconds());
+}
+
+void BenchHookKeyboardProc() {
+	bool wasEnabled = keyRemapEnabled;
+	keyRemapEnabled = true;
+	mainThreadId = GetCurrentThreadId();
+	AddHookedThread(mainThreadId);
+
+	SetLockedLanguage(NULL);
+	RunHookKeyboardProc("unlocked, key down/up", 50000000);
+
+	SetLockedLanguage(GetKeyboardLayout(0));
+	RunHookKeyboardProc("locked-idle, key down/up", 50000000);
+
+	SetLockedLanguage(NULL);
+	ClearHookedThreads();
+	keyRemapEnabled = wasEnabled;
+}
@@ -0,0 +1,72 @@
+/*
+ * bench-main-thread.cpp : measures the detection of the main thread, see main-thread.h.
+ *
+ * A synthetic window source simulates a large process, where each of SYNTHETIC_THREADS threads owns a hidden
+ * window, and the main thread owns a few visible ones. It needs no OS windows, so it runs in the portable build
+ * too, e.g. on Linux (see CMakeLists.txt).
+ */
+
+#include "stdafx.h"
+#include <stdio.h>
+#include "lang-locker.h"
+#include "main-thread.h"
+#include "bench.h"
+
+const DWORD SYNTHETIC_THREADS = 10000;
+const DWORD SYNTHETIC_MAIN_WINDOWS = 16;
+const DWORD SYNTHETIC_WINDOWS = SYNTHETIC_THREADS + SYNTHETIC_MAIN_WINDOWS;
+
+// the IDs of the synthetic threads are 1..SYNTHETIC_THREADS, and the main thread is the next one
+const DWORD SYNTHETIC_MAIN_THREAD = SYNTHETIC_THREADS + 1;
+
+// The synthetic window with index i has handle (i + 1). The windows of the main thread are enumerated last
+static DWORD SyntheticWindowThread(DWORD index) {
+	return index < SYNTHETIC_THREADS ? index + 1 : SYNTHETIC_MAIN_THREAD;
+}
+
+static void EnumSyntheticWindows(WindowCallback callback, void* context) {
+	for (DWORD i = 0; i < SYNTHETIC_WINDOWS; i++) {
+		WindowInfo window = { (HWND)(ULONG_PTR)(i + 1), SyntheticWindowThread(i), i >= SYNTHETIC_THREADS };
+		if (!callback(window, context)) {
+			break;
+		}
+	}
+}
+
+static DWORD GetSyntheticWindowThread(HWND hwnd) {
+	ULONG_PTR index = (ULONG_PTR)hwnd - 1;
+	return index < SYNTHETIC_WINDOWS ? SyntheticWindowThread((DWORD)index) : 0;
+}
+
+static const WindowSource syntheticWindowSource = { EnumSyntheticWindows, GetSyntheticWindowThread };
+
+static void RunFindMainThread(const char* name, long long count, bool invalidate) {
+	DWORD found = 0;
+	Stopwatch watch;
+	for (long long i = 0; i < count; i++) {
+		if (invalidate) {
+			InvalidateMainThread();
+		}
+		found |= FindMainThread() ^ SYNTHETIC_MAIN_THREAD;
+	}
+	ReportBench(name, count, watch.ElapsedSeconds());
+	if (found) {
+		printf("  ERROR: unexpected main thread detected\n");
+	}
+}
+
+void BenchMainThreadDetection() {
+	SetWindowSource(&syntheticWindowSource);
+	RunFindMainThread("detect, 10000 threads with windows", 2000, true);
+	RunFindMainThread("cached", 10000000, false);
+	SetWindowSource(NULL);
+
+#ifdef _WIN32
+	// the real windows of this process, for reference. The portable build has none
+	Stopwatch watch;
+	DWORD tid = FindMainThread();
+	ReportBench("detect, real windows", 1, watch.ElapsedSeconds());
+	printf("  detected main thread: %lu\n", (unsigned long)tid);
+#endif
+	InvalidateMainThread();
+}
@@ -0,0 +1,72 @@
+/*
+ * bench-main.cpp : entry point of lang-locker micro-benchmarks.
+ *
+ * Usage: lang-locker-bench [name...]
+ * Runs either all benchmarks, or only the ones with the specified names.
+ */
+
+#include "stdafx.h"
+#include <stdio.h>
+#include <string.h>
+#include "lang-locker.h"
+#include "bench.h"
+
+// the benchmarks are linked with the DLL sources, but without dllmain.cpp
+HMODULE module;
+
+// The portable build (see CMakeLists.txt) runs only the benchmarks which replace the OS functions
+
+static struct Benchmark
+{
+	const char* name;
+	void (*run)();
+} Benchmarks[] =
+{
+#ifdef _WIN32
+	{ "hooks", BenchHookGetMsgProc },
+#endif
+	{ "main-thread", BenchMainThreadDetection },
+	{ "sim", BenchSimulatedOS },
+#ifdef _WIN32
+	{ "keys", BenchHookKeyboardProc },
+#endif
+	{ "transitions", BenchLockTransitions },
+#ifdef _WIN32
+	{ "hints", BenchLayoutHints },
+	{ "threads", BenchThreadCreation },
+#endif
+	{ "stress", BenchLockStress },
+};
+
+void ReportBench(const char* name, long long ops, double seconds) {
+	printf("  %-40s %10.2f ns/op  (%lld ops)\n", name, seconds * 1e9 / ops, ops);
+}
+
+static bool IsSelected(const char* name, int argc, char* argv[]) {
+	if (argc <= 1) {
+		return true;
+	}
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(name, argv[i]) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+int main(int argc, char* argv[]) {
+#ifdef _WIN32
+	module = GetModuleHandle(NULL);
+#endif
+	EnsureInitialized();
+
+	for (size_t i = 0; i < sizeof(Benchmarks) / sizeof(Benchmark); i++) {
+		if (IsSelected(Benchmarks[i].name, argc, argv)) {
+			printf("%s:\n", Benchmarks[i].name);
+			Benchmarks[i].run();
+		}
+	}
+
+	Cleanup();
+	return 0;
+}
@@ -0,0 +1,111 @@
+/*
+ * bench-sim.cpp : drives synthetic messages and layout switches through the lock functions and the hooks,
+ * using the simulated OS (see sim-platform.h), and measures the throughput and the time-to-revert.
+ *
+ * The simulation is deterministic, so the time-to-revert (in the virtual milliseconds and in the pumped messages)
+ * is reproducible, and may be compared between the versions of the locking logic.
+ */
+
+#include "stdafx.h"
+#include <stdio.h>
+#include "lang-locker.h"
+#include "sim-platform.h"
+#include "bench.h"
+
+const int SIM_THREADS = 4;
+const int SIM_STEPS = 2000000;
+// a user switch is simulated once per this number of the steps
+const int SIM_SWITCH_INTERVAL = 500;
+// the virtual time is advanced by 1 ms once per this number of the steps
+const int SIM_STEPS_PER_MS = 10;
+
+static const HKL simLayouts[] = { (HKL)0x04090409, (HKL)0x04190419, (HKL)0x04070407 };
+static const int SIM_LAYOUTS = sizeof(simLayouts) / sizeof(HKL);
+
+// the messages posted to the threads between the switches
+static const UINT simMessages[] = { WM_MOUSEMOVE, WM_PAINT, WM_TIMER, WM_KEYDOWN, WM_USER + 1 };
+
+// deterministic pseudo-random numbers
+static uint32_t simSeed = 1;
+static uint32_t SimRandom(uint32_t bound) {
+	simSeed = simSeed * 1664525u + 1013904223u;
+	return (simSeed >> 8) % bound;
+}
+
+static bool AllThreadsLocked(HKL lockedLang) {
+	for (int i = 0; i < SIM_THREADS; i++) {
+		if (SimThreadLayout(i) != lockedLang) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void BenchSimulatedOS() {
+	SimReset(SIM_THREADS, simLayouts, SIM_LAYOUTS);
+	SetPlatform(&simPlatform);
+	SetWindowSource(&simWindowSource);
+	simSeed = 1;
+
+	SimSetCurrentThread(0);
+	HKL lockedLang = LockInputLanguage(simLayouts[0]);
+	if (lockedLang != simLayouts[0]) {
+		printf("  ERROR: failed to lock the simulated layout\n");
+	}
+
+	long long messages = 0, switches = 0, reverted = 0;
+	long long totalMs = 0, totalMessages = 0, maxMs = 0, maxMessages = 0;
+	bool switchPending = false;
+	DWORD switchTime = 0;
+	long long switchMessages = 0;
+
+	Stopwatch watch;
+	for (int step = 0; step < SIM_STEPS; step++) {
+		if (step % SIM_SWITCH_INTERVAL == 0 && !switchPending) {
+			SimUserSwitch(SimRandom(SIM_THREADS), simLayouts[1 + SimRandom(SIM_LAYOUTS - 1)]);
+			switches++;
+			switchPending = true;
+			switchTime = SimTime();
+			switchMessages = messages;
+		}
+		SimPostMessage(SimRandom(SIM_THREADS), simMessages[SimRandom(sizeof(simMessages) / sizeof(UINT))]);
+		for (int i = 0; i < SIM_THREADS; i++) {
+			messages += SimPumpMessage(i);
+		}
+		if (step % SIM_STEPS_PER_MS == 0) {
+			SimAdvanceTime(1);
+		}
+
+		if (switchPending && AllThreadsLocked(lockedLang)) {
+			switchPending = false;
+			reverted++;
+			long long ms = SimTime() - switchTime;
+			long long count = messages - switchMessages;
+			totalMs += ms;
+			totalMessages += count;
+			maxMs = ms > maxMs ? ms : maxMs;
+			maxMessages = count > maxMessages ? count : maxMessages;
+		}
+	}
+	ReportBench("simulated messages through the hooks", messages, watch.ElapsedSeconds());
+
+	printf("  switches: %lld, reverted: %lld\n", switches, reverted);
+	if (reverted) {
+		printf("  time-to-revert: avg %.2f ms (max %lld ms), avg %.1f messages (max %lld)\n",
+			(double)totalMs / reverted, maxMs, (double)totalMessages / reverted, maxMessages);
+	}
+
+	LockStatistics stats;
+	stats.size = sizeof(stats);
+	GetLockStatistics(&stats);
+	printf("  reverts: %llu, deferred: %llu, by deadline: %llu, failed: %llu\n",
+		(unsigned long long)stats.counters[LOCK_STAT_REVERTS], (unsigned long long)stats.counters[LOCK_STAT_REVERTS_DEFERRED],
+		(unsigned long long)stats.counters[LOCK_STAT_REVERTS_BY_DEADLINE],
+		(unsigned long long)stats.counters[LOCK_STAT_REVERTS_FAILED]);
+
+	UnlockInputLanguage();
+	SetWindowSource(NULL);
+	SetPlatform(NULL);
+	mainThreadId = 0;
+	uiThreadId = 0;
+}
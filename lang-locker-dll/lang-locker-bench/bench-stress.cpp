@@ -0,0 +1,336 @@
+/*
+ * bench-stress.cpp : runs the lock functions concurrently from several threads, while a GUI thread gets the input
+ * language messages through the hooks, and checks that the lock state ends as the last request.
+ *
+ * Unlike the simulated OS (see sim-platform.h), the threads are real, so the platform below only fakes the layouts,
+ * the hooks and the timers in a thread-safe way. The lockers record the order of their requests under the guard of
+ * the lock functions (see LockApiGuard), so the expected final state is known. The throughput of the lock functions
+ * under the contention is reported for the different numbers of the lockers.
+ *
+ * The threads are standard ones, so the stress runs in the portable build too, e.g. on Linux under ThreadSanitizer
+ * (see LANGLOCKER_TSAN in CMakeLists.txt).
+ */
+
+#include "stdafx.h"
+#include <stdio.h>
+#include <thread>
+#include "lang-locker.h"
+#include "platform.h"
+#include "main-thread.h"
+#include "layout-index.h"
+#include "lock-status.h"
+#include "bench.h"
+
+const DWORD STRESS_DURATION_MS = 1000;
+const int STRESS_MAX_LOCKERS = 8;
+// the messages dispatched to the GUI thread after each switch
+const int STRESS_MESSAGES_PER_SWITCH = 8;
+// the messages dispatched after the lockers are stopped, so that the pending revert is completed
+const int STRESS_QUIET_MESSAGES = 1000;
+
+static const HKL stressLayouts[] = { (HKL)0x04090409, (HKL)0x04190419, (HKL)0x04070407 };
+static const int STRESS_LAYOUTS = sizeof(stressLayouts) / sizeof(HKL);
+
+// the messages dispatched to the GUI thread between the switches
+static const UINT stressMessages[] = { WM_MOUSEMOVE, WM_PAINT, WM_TIMER, WM_KEYDOWN, WM_USER + 1 };
+
+// the process-wide layout, i.e. the one of the GUI thread
+static std::atomic<HKL> stressLayout;
+static std::atomic<UINT_PTR> stressHandles;
+// set by the GUI thread when started
+static std::atomic<DWORD> stressGuiThreadId;
+static std::atomic<bool> stopLockers;
+static std::atomic<bool> stopGui;
+
+// the last lock request, written under LockApiGuard
+static HKL lastRequested;
+static long long stressErrors;
+
+static HKL WINAPI StressActivateKeyboardLayout(HKL languageHandle, UINT flags) {
+	return stressLayout.exchange(languageHandle);
+}
+
+static HKL WINAPI StressGetKeyboardLayout(DWORD threadId) {
+	return stressLayout.load();
+}
+
+static int WINAPI StressGetKeyboardLayoutList(int maxCount, HKL* languageHandles) {
+	if (!maxCount) {
+		return STRESS_LAYOUTS;
+	}
+	int count = maxCount < STRESS_LAYOUTS ? maxCount : STRESS_LAYOUTS;
+	for (int i = 0; i < count; i++) {
+		languageHandles[i] = stressLayouts[i];
+	}
+	return count;
+}
+
+static HHOOK WINAPI StressSetWindowsHook(int hookType, HOOKPROC proc, DWORD threadId) {
+	return (HHOOK)++stressHandles;
+}
+
+static BOOL WINAPI StressUnhookWindowsHook(HHOOK hook) {
+	return TRUE;
+}
+
+static LRESULT WINAPI StressCallNextHook(int nCode, WPARAM wParam, LPARAM lParam) {
+	return 0;
+}
+
+static UINT_PTR WINAPI StressSetThreadTimer(UINT elapseMs, TIMERPROC proc) {
+	return ++stressHandles;
+}
+
+static BOOL WINAPI StressKillThreadTimer(UINT_PTR timerId) {
+	return TRUE;
+}
+
+static HWND WINAPI StressGetFocus() {
+	return NULL;
+}
+
+// the stress uses neither the lock commands, nor the window bindings, nor the key remapping
+static UINT WINAPI StressRegisterWindowMessage(const char* name) {
+	return 0xC000;
+}
+
+static BOOL WINAPI StressPostMessage(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam) {
+	return TRUE;
+}
+
+static BOOL WINAPI StressPostThreadMessage(DWORD threadId, UINT message, WPARAM wParam, LPARAM lParam) {
+	return TRUE;
+}
+
+static HWND WINAPI StressGetWindow(HWND hwnd, UINT command) {
+	return NULL;
+}
+
+static DWORD WINAPI StressGetWindowThreadProcessId(HWND hwnd, DWORD* processId) {
+	if (processId) {
+		*processId = GetCurrentProcessId();
+	}
+	return stressGuiThreadId.load();
+}
+
+static BOOL WINAPI StressIsWindow(HWND hwnd) {
+	return TRUE;
+}
+
+static HWND WINAPI StressGetAncestor(HWND hwnd, UINT flags) {
+	return flags == GA_PARENT ? NULL : hwnd;
+}
+
+static LONG_PTR WINAPI StressGetWindowLongPtr(HWND hwnd, int index) {
+	return 0;
+}
+
+static int WINAPI StressGetWindowString(HWND hwnd, char* text, int maxCount) {
+	text[0] = 0;
+	return 0;
+}
+
+static SHORT WINAPI StressGetKeyState(int virtualKey) {
+	return 0;
+}
+
+static UINT WINAPI StressMapVirtualKey(UINT code, UINT mapType, HKL languageHandle) {
+	return 0;
+}
+
+static int WINAPI StressToUnicode(UINT virtualKey, UINT scanCode, const BYTE* keyState, wchar_t* buf, int bufSize,
+		UINT flags, HKL languageHandle) {
+	return 0;
+}
+
+static const Platform stressPlatform = {
+	StressActivateKeyboardLayout,
+	StressGetKeyboardLayout,
+	StressGetKeyboardLayoutList,
+	StressSetWindowsHook,
+	StressUnhookWindowsHook,
+	StressCallNextHook,
+	StressSetThreadTimer,
+	StressKillThreadTimer,
+	GetCurrentThreadId,
+	StressGetFocus,
+	GetTickCount,
+	StressRegisterWindowMessage,
+	StressPostThreadMessage,
+	StressPostMessage,
+	StressGetFocus,
+	StressGetWindowThreadProcessId,
+	StressIsWindow,
+	StressGetAncestor,
+	StressGetWindow,
+	StressGetWindowLongPtr,
+	StressGetWindowString,
+	StressGetWindowString,
+	StressGetKeyState,
+	StressMapVirtualKey,
+	StressToUnicode,
+};
+
+// the only window, owned by the GUI thread
+static const HWND STRESS_WINDOW = (HWND)0x10010;
+
+static void StressEnumWindows(WindowCallback callback, void* context) {
+	WindowInfo window = { STRESS_WINDOW, stressGuiThreadId.load(), true };
+	callback(window, context);
+}
+
+static DWORD StressGetWindowThread(HWND hwnd) {
+	return hwnd == STRESS_WINDOW ? stressGuiThreadId.load() : 0;
+}
+
+static const WindowSource stressWindowSource = { StressEnumWindows, StressGetWindowThread };
+
+// per-thread pseudo-random numbers
+static uint32_t StressRandom(uint32_t& seed, uint32_t bound) {
+	seed = seed * 1664525u + 1013904223u;
+	return (seed >> 8) % bound;
+}
+
+static void DispatchStressMessage(UINT message, WPARAM wParam, LPARAM lParam) {
+	MSG msg = { 0 };
+	msg.hwnd = message == WM_TIMER ? NULL : STRESS_WINDOW;
+	msg.message = message;
+	msg.wParam = wParam;
+	msg.lParam = lParam;
+	HookGetMsgProc(HC_ACTION, PM_REMOVE, (LPARAM)&msg);
+}
+
+// Simulates the user switching the layouts, like in bench-sim.cpp, and counts the dispatched messages
+static void StressGuiThreadProc(long long* messageCount) {
+	long long& messages = *messageCount;
+	uint32_t seed = 1;
+	stressGuiThreadId.store(GetCurrentThreadId());
+	while (!stopGui.load()) {
+		HKL layout = stressLayouts[StressRandom(seed, STRESS_LAYOUTS)];
+		DispatchStressMessage(WM_INPUTLANGCHANGEREQUEST, 0, (LPARAM)layout);
+		stressLayout.store(layout);
+		HookShellProc(HSHELL_LANGUAGE, 0, (LPARAM)layout);
+		DispatchStressMessage(WM_INPUTLANGCHANGE, 0, (LPARAM)layout);
+		messages += 2;
+
+		for (int i = 0; i < STRESS_MESSAGES_PER_SWITCH && !stopGui.load(); i++) {
+			DispatchStressMessage(stressMessages[StressRandom(seed, sizeof(stressMessages) / sizeof(UINT))], 0, 0);
+			messages++;
+		}
+	}
+
+	// no more switches, the revert is performed at the latest by the deadline timer of the thread
+	for (int i = 0; i < STRESS_QUIET_MESSAGES; i++) {
+		DispatchStressMessage(stressMessages[i % (sizeof(stressMessages) / sizeof(UINT))], 0, 0);
+		HookedThread* thread = FindOwnHookedThread(GetCurrentThreadId());
+		if (thread && thread->revertTimer) {
+			DispatchStressMessage(WM_TIMER, thread->revertTimer, 0);
+		}
+		messages++;
+	}
+}
+
+// Locks, unlocks and toggles the lock like the plugins do, and counts the calls
+static void StressLockerThreadProc(long long* opCount) {
+	long long& ops = *opCount;
+	uint32_t seed = (uint32_t)(ULONG_PTR)&ops;
+	while (!stopLockers.load()) {
+		uint32_t op = StressRandom(seed, 4);
+		LockApiGuard guard;
+		if (op == 0) {
+			UnlockInputLanguage();
+			lastRequested = 0;
+		}
+		else if (op < 3) {
+			HKL layout = stressLayouts[op - 1];
+			if (LockInputLanguage(layout) != layout) {
+				stressErrors++;
+			}
+			lastRequested = layout;
+		}
+		else if (GetLockedLanguage()) {
+			UnlockInputLanguage();
+			lastRequested = 0;
+		}
+		else {
+			lastRequested = LockInputLanguage(0);
+			if (!lastRequested) {
+				stressErrors++;
+			}
+		}
+		ops++;
+	}
+}
+
+static void RunStress(int lockers) {
+	long long messages = 0;
+	long long ops[STRESS_MAX_LOCKERS] = { 0 };
+	std::thread threads[STRESS_MAX_LOCKERS];
+	stopLockers = false;
+	stopGui = false;
+	lastRequested = 0;
+	stressGuiThreadId = 0;
+
+	std::thread gui(StressGuiThreadProc, &messages);
+	// the lockers detect the GUI thread as the main one by its window
+	while (!stressGuiThreadId.load()) {
+		std::this_thread::yield();
+	}
+	Stopwatch watch;
+	for (int i = 0; i < lockers; i++) {
+		threads[i] = std::thread(StressLockerThreadProc, &ops[i]);
+	}
+	Sleep(STRESS_DURATION_MS);
+	stopLockers = true;
+	for (int i = 0; i < lockers; i++) {
+		threads[i].join();
+	}
+	double seconds = watch.ElapsedSeconds();
+	stopGui = true;
+	gui.join();
+
+	long long totalOps = 0;
+	for (int i = 0; i < lockers; i++) {
+		totalOps += ops[i];
+	}
+	char name[64];
+	_snprintf_s(name, sizeof(name), _TRUNCATE, "lock calls, %d locker(s)", lockers);
+	ReportBench(name, totalOps, seconds);
+	printf("  GUI thread messages: %lld\n", messages);
+
+	HKL lockedLang = GetLockedLanguage();
+	if (lockedLang != lastRequested) {
+		printf("  ERROR: locked %p, but the last request is %p\n", lockedLang, lastRequested);
+	}
+	if ((HKL)(LONG_PTR)lockStatus.lockedLanguage != lastRequested) {
+		printf("  ERROR: the status shows %p locked, but the last request is %p\n",
+			(HKL)(LONG_PTR)lockStatus.lockedLanguage, lastRequested);
+	}
+	if (lockedLang && stressLayout.load() != lockedLang) {
+		printf("  ERROR: the layout %p is not reverted to the locked %p\n", stressLayout.load(), lockedLang);
+	}
+
+	UnlockInputLanguage();
+	mainThreadId = 0;
+	uiThreadId = 0;
+	InvalidateMainThread();
+}
+
+void BenchLockStress() {
+	SetPlatform(&stressPlatform);
+	SetWindowSource(&stressWindowSource);
+	InvalidateLayoutIndex();
+	stressLayout = stressLayouts[0];
+	stressErrors = 0;
+
+	for (int lockers = 1; lockers <= STRESS_MAX_LOCKERS; lockers *= 2) {
+		RunStress(lockers);
+	}
+	if (stressErrors) {
+		printf("  ERROR: %lld lock calls failed\n", stressErrors);
+	}
+
+	SetWindowSource(NULL);
+	SetPlatform(NULL);
+	InvalidateLayoutIndex();
+}
@@ -0,0 +1,59 @@
+/*
+ * bench-threads.cpp : measures the creation of short-lived threads with the DLL loaded, like the JVM creates them
+ * for GC, JIT and pools. A DLL which gets the thread notifications is called in DllMain under the loader lock at
+ * the start and the end of each thread, so that concurrently spawned threads are serialized.
+ *
+ * The DLL is loaded by LoadLibrary() from the path in LANGLOCKER_BENCH_DLL environment variable, or
+ * lang-locker.dll from the current directory, so that the builds before and after a change may be compared.
+ */
+
+#include "stdafx.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include "lang-locker.h"
+#include "bench.h"
+
+// several spawners at once, like the pools of the JVM
+const int THREAD_SPAWNERS = 8;
+const int THREADS_PER_SPAWNER = 500;
+
+static DWORD WINAPI ShortLivedThreadProc(LPVOID param) {
+	return 0;
+}
+
+static DWORD WINAPI SpawnerThreadProc(LPVOID param) {
+	for (int i = 0; i < THREADS_PER_SPAWNER; i++) {
+		HANDLE thread = CreateThread(NULL, 0, ShortLivedThreadProc, NULL, 0, NULL);
+		if (thread) {
+			WaitForSingleObject(thread, INFINITE);
+			CloseHandle(thread);
+		}
+	}
+	return 0;
+}
+
+static void RunSpawners(const char* name) {
+	HANDLE spawners[THREAD_SPAWNERS];
+	Stopwatch watch;
+	for (int i = 0; i < THREAD_SPAWNERS; i++) {
+		spawners[i] = CreateThread(NULL, 0, SpawnerThreadProc, NULL, 0, NULL);
+	}
+	WaitForMultipleObjects(THREAD_SPAWNERS, spawners, TRUE, INFINITE);
+	ReportBench(name, THREAD_SPAWNERS * THREADS_PER_SPAWNER, watch.ElapsedSeconds());
+	for (int i = 0; i < THREAD_SPAWNERS; i++) {
+		CloseHandle(spawners[i]);
+	}
+}
+
+void BenchThreadCreation() {
+	RunSpawners("spawn, no DLL");
+
+	const char* path = getenv("LANGLOCKER_BENCH_DLL");
+	HMODULE dll = LoadLibraryA(path ? path : "lang-locker.dll");
+	if (!dll) {
+		printf("  skipped: failed to load %s, error=%lu\n", path ? path : "lang-locker.dll", GetLastError());
+		return;
+	}
+	RunSpawners("spawn, DLL loaded");
+	FreeLibrary(dll);
+}
@@ -0,0 +1,55 @@
+/*
+ * bench-transitions.cpp : measures the decisions of the lock logic, see LOCK_TRANSITIONS in lock-logic.h.
+ *
+ * Walks every transition of the table, and then decides on a mix of messages and shell events like the hooks do.
+ * The results are accumulated, so that the compiler does not drop the lookups.
+ */
+
+#include "stdafx.h"
+#include <stdio.h>
+#include "lang-locker.h"
+#include "lock-logic.h"
+#include "bench.h"
+
+static const uint32_t BENCH_LAYOUT = 0x04090409;
+static const uint32_t BENCH_OTHER_LAYOUT = 0x04190419;
+
+static void RunAllTransitions(const char* name, long long rounds) {
+	const int count = LOCK_PHASES * LOCK_TRIGGERS * 2;
+	unsigned sum = 0;
+	Stopwatch watch;
+	for (long long i = 0; i < rounds; i++) {
+		for (int j = 0; j < count; j++) {
+			LockTransition t = LockTransitionOf((LockPhase)(j / 2 / LOCK_TRIGGERS), (LockTrigger)(j / 2 % LOCK_TRIGGERS), (j & 1) != 0);
+			sum += t.next + t.actions;
+		}
+	}
+	ReportBench(name, rounds * count, watch.ElapsedSeconds());
+	printf("  (checksum %u)\n", sum);
+}
+
+static void RunDecisions(const char* name, LockStateWord state, long long count) {
+	static const uint32_t messages[] = { MSG_TIMER, MSG_PAINT, MSG_KEYFIRST, MSG_INPUTLANGCHANGE, MSG_DESTROY, MSG_MOUSEFIRST };
+	static const int shellEvents[] = { SHELL_WINDOWACTIVATED, SHELL_LANGUAGE, 1 };
+	const int messagesCount = sizeof(messages) / sizeof(messages[0]);
+	const int shellEventsCount = sizeof(shellEvents) / sizeof(shellEvents[0]);
+
+	unsigned sum = 0;
+	Stopwatch watch;
+	for (long long i = 0; i < count; i += 2) {
+		uint32_t layout = (i & 2) ? BENCH_OTHER_LAYOUT : BENCH_LAYOUT;
+		sum += DecideOnMessage(state, messages[i % messagesCount], layout);
+		sum += DecideOnShellEvent(state, shellEvents[i % shellEventsCount], layout);
+	}
+	ReportBench(name, count, watch.ElapsedSeconds());
+	printf("  (checksum %u)\n", sum);
+}
+
+void BenchLockTransitions() {
+	RunAllTransitions("all transitions", 10000000);
+
+	LockStateWord locked = NextLockState(0, BENCH_LAYOUT, false);
+	RunDecisions("unlocked, decisions", 0, 100000000);
+	RunDecisions("locked-idle, decisions", locked, 100000000);
+	RunDecisions("revert-pending, decisions", NextLockState(locked, BENCH_LAYOUT, true), 100000000);
+}
@@ -0,0 +1,42 @@
+/*
+ * bench.h : common stuff for lang-locker micro-benchmarks.
+ *
+ * The benchmarks are compiled together with the DLL sources, so they may call the internal functions
+ * directly. Use 'Release' configuration for any meaningful numbers.
+ */
+
+#pragma once
+
+// Measures elapsed time with the performance counter
+class Stopwatch {
+public:
+	Stopwatch() {
+		QueryPerformanceFrequency(&frequency);
+		QueryPerformanceCounter(&start);
+	}
+
+	double ElapsedSeconds() const {
+		LARGE_INTEGER now;
+		QueryPerformanceCounter(&now);
+		return (double)(now.QuadPart - start.QuadPart) / frequency.QuadPart;
+	}
+
+private:
+	LARGE_INTEGER frequency;
+	LARGE_INTEGER start;
+};
+
+// Prints the result of a benchmark as nanoseconds per operation
+void ReportBench(const char* name, long long ops, double seconds);
+
+//
+// The benchmarks. Each one prints its own results.
+//
+void BenchHookGetMsgProc();
+void BenchMainThreadDetection();
+void BenchSimulatedOS();
+void BenchHookKeyboardProc();
+void BenchLockTransitions();
+void BenchLayoutHints();
+void BenchThreadCreation();
+void BenchLockStress();
@@ -0,0 +1,434 @@
+/*
+ * sim-platform.cpp : deterministic simulated OS, see sim-platform.h
+ */
+
+#include "stdafx.h"
+#include <string.h>
+#include "lang-locker.h"
+#include "sim-platform.h"
+
+const int SIM_QUEUE_SIZE = 64;
+const int SIM_MAX_TIMERS = 32;
+
+// the slots of the hooks of a thread, one per supported hook type
+enum SimHookSlot {
+	SIM_HOOK_MESSAGES,      // WH_GETMESSAGE
+	SIM_HOOK_SHELL,         // WH_SHELL
+	SIM_HOOK_KEYBOARD,      // WH_KEYBOARD
+
+	SIM_HOOK_SLOTS
+};
+
+// a posted message, or a shell event if shellCode is not 0
+struct SimMessage {
+	UINT message;
+	int shellCode;
+	WPARAM wParam;
+	LPARAM lParam;
+};
+
+struct SimThread {
+	DWORD id;
+	HWND window;
+	HKL layout;
+	// the process layout is changed, but not yet applied to this thread
+	bool layoutStale;
+	HOOKPROC hooks[SIM_HOOK_SLOTS];
+	SimMessage queue[SIM_QUEUE_SIZE];
+	int queueHead;
+	int queueCount;
+};
+
+struct SimTimer {
+	UINT_PTR id;
+	int thread;
+	DWORD due;
+	DWORD period;
+	TIMERPROC proc;
+};
+
+static SimThread simThreads[SIM_MAX_THREADS];
+static int simThreadCount = 0;
+static int currentThread = 0;
+
+static HKL simLayouts[SIM_MAX_LAYOUTS];
+static int simLayoutCount = 0;
+static HKL processLayout = 0;
+
+static SimTimer simTimers[SIM_MAX_TIMERS];
+static UINT_PTR lastTimerId = 0;
+static DWORD simTime = 0;
+
+static void PushSimMessage(SimThread& thread, UINT message, int shellCode, WPARAM wParam, LPARAM lParam) {
+	if (thread.queueCount == SIM_QUEUE_SIZE) {
+		// like a full message queue, the message is lost
+		return;
+	}
+	SimMessage& msg = thread.queue[(thread.queueHead + thread.queueCount++) % SIM_QUEUE_SIZE];
+	msg.message = message;
+	msg.shellCode = shellCode;
+	msg.wParam = wParam;
+	msg.lParam = lParam;
+}
+
+// Changes the layout of the thread and notifies it
+static void SetThreadLayout(SimThread& thread, HKL layout) {
+	if (thread.layout == layout) {
+		return;
+	}
+	thread.layout = layout;
+	PushSimMessage(thread, WM_INPUTLANGCHANGE, 0, 0, (LPARAM)layout);
+	PushSimMessage(thread, 0, HSHELL_LANGUAGE, (WPARAM)thread.window, (LPARAM)layout);
+}
+
+static bool IsSimLayout(HKL layout) {
+	for (int i = 0; i < simLayoutCount; i++) {
+		if (simLayouts[i] == layout) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static int FindSimThread(DWORD threadId) {
+	for (int i = 0; i < simThreadCount; i++) {
+		if (simThreads[i].id == threadId) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+void SimReset(int threadCount, const HKL* layouts, int layoutCount) {
+	simThreadCount = threadCount < SIM_MAX_THREADS ? threadCount : SIM_MAX_THREADS;
+	simLayoutCount = layoutCount < SIM_MAX_LAYOUTS ? layoutCount : SIM_MAX_LAYOUTS;
+	for (int i = 0; i < simLayoutCount; i++) {
+		simLayouts[i] = layouts[i];
+	}
+	processLayout = simLayouts[0];
+	for (int i = 0; i < simThreadCount; i++) {
+		SimThread& thread = simThreads[i];
+		memset(&thread, 0, sizeof(thread));
+		// like the real thread IDs, multiples of 4
+		thread.id = 1000 + i * 4;
+		thread.window = (HWND)(ULONG_PTR)(0x10000 + i * 0x10);
+		thread.layout = processLayout;
+	}
+	memset(simTimers, 0, sizeof(simTimers));
+	currentThread = 0;
+	simTime = 0;
+}
+
+void SimSetCurrentThread(int index) {
+	currentThread = index;
+}
+
+DWORD SimThreadId(int index) {
+	return simThreads[index].id;
+}
+
+HKL SimThreadLayout(int index) {
+	return simThreads[index].layout;
+}
+
+DWORD SimTime() {
+	return simTime;
+}
+
+void SimUserSwitch(int index, HKL layout) {
+	SimThread& thread = simThreads[index];
+	PushSimMessage(thread, WM_INPUTLANGCHANGEREQUEST, 0, 0, (LPARAM)layout);
+	// since Windows XP, blocking of the request does not prevent the switch
+	SetThreadLayout(thread, layout);
+}
+
+void SimPostMessage(int index, UINT message) {
+	PushSimMessage(simThreads[index], message, 0, 0, 0);
+}
+
+bool SimPumpMessage(int index) {
+	SimThread& thread = simThreads[index];
+	currentThread = index;
+	if (thread.layoutStale) {
+		thread.layoutStale = false;
+		SetThreadLayout(thread, processLayout);
+	}
+	if (!thread.queueCount) {
+		return false;
+	}
+	SimMessage msg = thread.queue[thread.queueHead];
+	thread.queueHead = (thread.queueHead + 1) % SIM_QUEUE_SIZE;
+	thread.queueCount--;
+
+	if (msg.shellCode) {
+		if (thread.hooks[SIM_HOOK_SHELL]) {
+			thread.hooks[SIM_HOOK_SHELL](msg.shellCode, msg.wParam, msg.lParam);
+		}
+		return true;
+	}
+	// the keyboard hook gets the key messages before the message hook, and may discard them
+	if ((msg.message == WM_KEYDOWN || msg.message == WM_KEYUP) && thread.hooks[SIM_HOOK_KEYBOARD]
+			&& thread.hooks[SIM_HOOK_KEYBOARD](HC_ACTION, msg.wParam, msg.lParam)) {
+		return true;
+	}
+
+	MSG winMsg = { 0 };
+	winMsg.hwnd = thread.window;
+	winMsg.message = msg.message;
+	winMsg.wParam = msg.wParam;
+	winMsg.lParam = msg.lParam;
+	if (thread.hooks[SIM_HOOK_MESSAGES]) {
+		thread.hooks[SIM_HOOK_MESSAGES](HC_ACTION, PM_REMOVE, (LPARAM)&winMsg);
+	}
+	// DispatchMessage() of WM_TIMER calls the timer procedure
+	if (winMsg.message == WM_TIMER && winMsg.lParam) {
+		((TIMERPROC)winMsg.lParam)(NULL, WM_TIMER, winMsg.wParam, simTime);
+	}
+	return true;
+}
+
+void SimAdvanceTime(DWORD ms) {
+	simTime += ms;
+	for (int i = 0; i < SIM_MAX_TIMERS; i++) {
+		SimTimer& timer = simTimers[i];
+		if (timer.id && (int)(simTime - timer.due) >= 0) {
+			PushSimMessage(simThreads[timer.thread], WM_TIMER, 0, timer.id, (LPARAM)timer.proc);
+			timer.due = simTime + timer.period;
+		}
+	}
+}
+
+//
+// The simulated OS functions
+//
+
+static HKL WINAPI SimActivateKeyboardLayout(HKL languageHandle, UINT flags) {
+	if (!IsSimLayout(languageHandle)) {
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return 0;
+	}
+	SimThread& thread = simThreads[currentThread];
+	HKL prev = thread.layout;
+	SetThreadLayout(thread, languageHandle);
+	if (flags & KLF_SETFORPROCESS) {
+		processLayout = languageHandle;
+		for (int i = 0; i < simThreadCount; i++) {
+			simThreads[i].layoutStale = i != currentThread;
+		}
+	}
+	return prev;
+}
+
+static HKL WINAPI SimGetKeyboardLayout(DWORD threadId) {
+	int index = threadId ? FindSimThread(threadId) : currentThread;
+	return index >= 0 ? simThreads[index].layout : 0;
+}
+
+static int WINAPI SimGetKeyboardLayoutList(int maxCount, HKL* languageHandles) {
+	if (!maxCount) {
+		return simLayoutCount;
+	}
+	int count = maxCount < simLayoutCount ? maxCount : simLayoutCount;
+	for (int i = 0; i < count; i++) {
+		languageHandles[i] = simLayouts[i];
+	}
+	return count;
+}
+
+// the hook handles are (thread index + 1) * SIM_HOOK_SLOTS + the slot of the hook type
+static HHOOK WINAPI SimSetWindowsHook(int hookType, HOOKPROC proc, DWORD threadId) {
+	int index = FindSimThread(threadId);
+	int slot = hookType == WH_GETMESSAGE ? SIM_HOOK_MESSAGES : hookType == WH_SHELL ? SIM_HOOK_SHELL
+		: hookType == WH_KEYBOARD ? SIM_HOOK_KEYBOARD : -1;
+	if (index < 0 || slot < 0) {
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return NULL;
+	}
+	simThreads[index].hooks[slot] = proc;
+	return (HHOOK)(ULONG_PTR)((index + 1) * SIM_HOOK_SLOTS + slot);
+}
+
+static BOOL WINAPI SimUnhookWindowsHook(HHOOK hook) {
+	ULONG_PTR value = (ULONG_PTR)hook;
+	int index = (int)(value / SIM_HOOK_SLOTS) - 1;
+	if (index < 0 || index >= simThreadCount) {
+		return FALSE;
+	}
+	simThreads[index].hooks[value % SIM_HOOK_SLOTS] = NULL;
+	return TRUE;
+}
+
+static LRESULT WINAPI SimCallNextHook(int nCode, WPARAM wParam, LPARAM lParam) {
+	return 0;
+}
+
+static UINT_PTR WINAPI SimSetThreadTimer(UINT elapseMs, TIMERPROC proc) {
+	for (int i = 0; i < SIM_MAX_TIMERS; i++) {
+		SimTimer& timer = simTimers[i];
+		if (!timer.id) {
+			timer.id = ++lastTimerId;
+			timer.thread = currentThread;
+			timer.due = simTime + elapseMs;
+			timer.period = elapseMs;
+			timer.proc = proc;
+			return timer.id;
+		}
+	}
+	return 0;
+}
+
+static BOOL WINAPI SimKillThreadTimer(UINT_PTR timerId) {
+	for (int i = 0; i < SIM_MAX_TIMERS; i++) {
+		if (simTimers[i].id == timerId) {
+			simTimers[i].id = 0;
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+static DWORD WINAPI SimGetCurrentThreadId() {
+	return simThreads[currentThread].id;
+}
+
+static HWND WINAPI SimGetFocus() {
+	return simThreads[currentThread].window;
+}
+
+static DWORD WINAPI SimGetTickCount() {
+	return simTime;
+}
+
+static int FindSimWindow(HWND hwnd) {
+	for (int i = 0; i < simThreadCount; i++) {
+		if (simThreads[i].window == hwnd) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static UINT WINAPI SimRegisterWindowMessage(const char* name) {
+	// the range of the registered messages
+	return 0xC000;
+}
+
+static BOOL WINAPI SimPostThreadMessage(DWORD threadId, UINT message, WPARAM wParam, LPARAM lParam) {
+	int index = FindSimThread(threadId);
+	if (index < 0) {
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+	PushSimMessage(simThreads[index], message, 0, wParam, lParam);
+	return TRUE;
+}
+
+static BOOL WINAPI SimPostMessage(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam) {
+	int index = FindSimWindow(hwnd);
+	if (index < 0) {
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+	PushSimMessage(simThreads[index], message, 0, wParam, lParam);
+	return TRUE;
+}
+
+static HWND WINAPI SimGetForegroundWindow() {
+	return simThreads[currentThread].window;
+}
+
+static DWORD WINAPI SimGetWindowThreadProcessId(HWND hwnd, DWORD* processId) {
+	int index = FindSimWindow(hwnd);
+	if (processId) {
+		*processId = index >= 0 ? GetCurrentProcessId() : 0;
+	}
+	return index >= 0 ? simThreads[index].id : 0;
+}
+
+static BOOL WINAPI SimIsWindow(HWND hwnd) {
+	return FindSimWindow(hwnd) >= 0;
+}
+
+// the simulated windows are top-level, with no owners, styles or titles
+static HWND WINAPI SimGetAncestor(HWND hwnd, UINT flags) {
+	return flags == GA_PARENT ? NULL : hwnd;
+}
+
+static HWND WINAPI SimGetWindow(HWND hwnd, UINT command) {
+	return NULL;
+}
+
+static LONG_PTR WINAPI SimGetWindowLongPtr(HWND hwnd, int index) {
+	return 0;
+}
+
+static int WINAPI SimGetClassName(HWND hwnd, char* className, int maxCount) {
+	return FindSimWindow(hwnd) >= 0 ? _snprintf_s(className, maxCount, _TRUNCATE, "SimWindow") : 0;
+}
+
+static int WINAPI SimGetWindowText(HWND hwnd, char* text, int maxCount) {
+	text[0] = 0;
+	return 0;
+}
+
+// no keys are pressed, and no layout has character keys
+static SHORT WINAPI SimGetKeyState(int virtualKey) {
+	return 0;
+}
+
+static UINT WINAPI SimMapVirtualKey(UINT code, UINT mapType, HKL languageHandle) {
+	return 0;
+}
+
+static int WINAPI SimToUnicode(UINT virtualKey, UINT scanCode, const BYTE* keyState, wchar_t* buf, int bufSize,
+		UINT flags, HKL languageHandle) {
+	return 0;
+}
+
+const Platform simPlatform = {
+	SimActivateKeyboardLayout,
+	SimGetKeyboardLayout,
+	SimGetKeyboardLayoutList,
+	SimSetWindowsHook,
+	SimUnhookWindowsHook,
+	SimCallNextHook,
+	SimSetThreadTimer,
+	SimKillThreadTimer,
+	SimGetCurrentThreadId,
+	SimGetFocus,
+	SimGetTickCount,
+	SimRegisterWindowMessage,
+	SimPostThreadMessage,
+	SimPostMessage,
+	SimGetForegroundWindow,
+	SimGetWindowThreadProcessId,
+	SimIsWindow,
+	SimGetAncestor,
+	SimGetWindow,
+	SimGetWindowLongPtr,
+	SimGetClassName,
+	SimGetWindowText,
+	SimGetKeyState,
+	SimMapVirtualKey,
+	SimToUnicode,
+};
+
+//
+// The simulated windows, for the detection of the main thread
+//
+
+static void EnumSimWindows(WindowCallback callback, void* context) {
+	for (int i = 0; i < simThreadCount; i++) {
+		WindowInfo window = { simThreads[i].window, simThreads[i].id, true };
+		if (!callback(window, context)) {
+			break;
+		}
+	}
+}
+
+static DWORD GetSimWindowThread(HWND hwnd) {
+	int index = FindSimWindow(hwnd);
+	return index >= 0 ? simThreads[index].id : 0;
+}
+
+const WindowSource simWindowSource = { EnumSimWindows, GetSimWindowThread };
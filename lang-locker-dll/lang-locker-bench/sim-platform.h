@@ -0,0 +1,50 @@
+/*
+ * sim-platform.h : deterministic simulated OS for the lock functions and the hooks, see platform.h.
+ *
+ * All simulated threads run in the calling thread: the simulation switches the "current" thread and dispatches
+ * its queued messages to the hooks set for it. The time is virtual, advanced only by SimAdvanceTime().
+ *
+ * The model follows the observed behaviour of Windows:
+ *  - each thread has its own keyboard layout, reported to it by WM_INPUTLANGCHANGE and HSHELL_LANGUAGE
+ *  - a user switch (like Alt+Shift) changes the layout of the thread even if WM_INPUTLANGCHANGEREQUEST is blocked
+ *  - KLF_SETFORPROCESS changes the layout of the other threads lazily, when they get their next message
+ *  - thread timers post WM_TIMER, which is dispatched to the timer procedure after the hook
+ *  - the keyboard hook gets WM_KEYDOWN and WM_KEYUP before the message hook, and discards them if it returns non-zero
+ *  - the posted messages are queued like the ones posted by SimPostMessage()
+ *  - the windows are top-level, and no layout produces characters, so the keys are never remapped
+ */
+
+#pragma once
+
+#include "platform.h"
+#include "main-thread.h"
+
+const int SIM_MAX_THREADS = 16;
+const int SIM_MAX_LAYOUTS = 8;
+
+// Resets the simulation: each thread owns a visible window, the thread 0 is the current one and thus is detected
+// as the main thread. All threads start with the first layout
+void SimReset(int threadCount, const HKL* layouts, int layoutCount);
+
+// The simulated OS functions and windows
+extern const Platform simPlatform;
+extern const WindowSource simWindowSource;
+
+// Makes the simulated thread the current one, e.g. to call the lock functions from it
+void SimSetCurrentThread(int index);
+
+DWORD SimThreadId(int index);
+HKL SimThreadLayout(int index);
+DWORD SimTime();
+
+// Simulates the user switching the layout while the thread is active
+void SimUserSwitch(int index, HKL layout);
+
+// Posts the message to the thread
+void SimPostMessage(int index, UINT message);
+
+// Dispatches the next message of the thread through the hooks. Returns false if the thread had no messages
+bool SimPumpMessage(int index);
+
+// Advances the virtual time, and posts WM_TIMER for the expired timers
+void SimAdvanceTime(DWORD ms);
@@ -1,12 +1,291 @@
+/*
+ * JNILockEngine.cpp : native methods of com.gilecode.langlocker.LockEngine, registered in JNI_OnLoad().
+ */
+
 #include "stdafx.h"
 #include "lang-locker.h"
+#include "lock-status.h"
+#include "lock-events.h"
+#include "lock-commands.h"
+#include "permitted-layouts.h"
+#include "lock-state-file.h"
+
+static const char* LOCK_ENGINE_CLASS = "com/gilecode/langlocker/LockEngine";
+
+// The events are delivered to LockEngine.dispatchEvents(long[]) in batches, LOCK_EVENT_FIELDS values per event.
+// The batches are delivered not more often than once per LOCK_EVENTS_INTERVAL_MS, so that a storm of the language
+// switches results in a few coalesced events rather than flooding the UI thread of the IDE
+const int MAX_LOCK_EVENTS_BATCH = 64;
+const int LOCK_EVENT_FIELDS = 6;
+const DWORD LOCK_EVENTS_INTERVAL_MS = 250;
+
+static JavaVM* javaVM = NULL;
+static jclass lockEngineClass = NULL;
+static jmethodID dispatchEventsMethod = NULL;
+// set by the notifier thread once attached to JVM, and reset if it has failed to attach
+static std::atomic<bool> notifierStarted(false);
+
+// passed to the notifier thread, which signals attachedEvent after the attempt to attach to JVM
+struct NotifierStart {
+	HMODULE self;
+	HANDLE attachedEvent;
+};
+
+static void DeliverLockEvents(JNIEnv* env, const LockEvent* events, int count) {
+	jlong data[MAX_LOCK_EVENTS_BATCH * LOCK_EVENT_FIELDS];
+	for (int i = 0; i < count; i++) {
+		jlong* fields = &data[i * LOCK_EVENT_FIELDS];
+		fields[0] = events[i].type;
+		fields[1] = events[i].count;
+		fields[2] = events[i].threadId;
+		fields[3] = events[i].language;
+		fields[4] = events[i].error;
+		fields[5] = events[i].sequence;
+	}
 
-extern "C" {
-JNIEXPORT jlong JNICALL Java_com_gilecode_langlocker_LockEngine_lockInputLanguage(JNIEnv * env, jclass clazz, jlong language) {
+	jlongArray array = env->NewLongArray(count * LOCK_EVENT_FIELDS);
+	if (!array) {
+		env->ExceptionClear();
+		return;
+	}
+	env->SetLongArrayRegion(array, 0, count * LOCK_EVENT_FIELDS, data);
+	env->CallStaticVoidMethod(lockEngineClass, dispatchEventsMethod, array);
+	if (env->ExceptionCheck()) {
+		env->ExceptionDescribe();
+		env->ExceptionClear();
+	}
+	env->DeleteLocalRef(array);
+}
+
+static DWORD WINAPI LockEventsNotifierProc(LPVOID param) {
+	// the start data is owned by the starting thread, which waits only until attachedEvent is set
+	NotifierStart* start = (NotifierStart*)param;
+	HMODULE self = start->self;
+
+	JNIEnv* env;
+	JavaVMAttachArgs args = { JNI_VERSION_1_6, (char*)"lang-locker events notifier", NULL };
+	bool attached = javaVM->AttachCurrentThreadAsDaemon((void**)&env, &args) == JNI_OK;
+	notifierStarted.store(attached);
+	SetEvent(start->attachedEvent);
+
+	if (attached) {
+		LockEvent events[MAX_LOCK_EVENTS_BATCH];
+		while (WaitLockEvents()) {
+			int count = TakeLockEvents(events, MAX_LOCK_EVENTS_BATCH);
+			if (count) {
+				DeliverLockEvents(env, events, count);
+				Sleep(LOCK_EVENTS_INTERVAL_MS);
+			}
+		}
+		javaVM->DetachCurrentThread();
+	}
+	else {
+		Log("Failed to attach the events notifier thread to JVM");
+	}
+
+	// release the reference obtained in LockEngine_startEventNotifier()
+	FreeLibraryAndExitThread(self, 0);
+	return 0;
+}
+
+static jlong JNICALL LockEngine_lockInputLanguage(JNIEnv * env, jclass clazz, jlong language) {
 	return (jlong)LockInputLanguage((HKL)language);
 }
 
-JNIEXPORT void JNICALL Java_com_gilecode_langlocker_LockEngine_unlockInputLanguage(JNIEnv * env, jclass clazz) {
+static jlong JNICALL LockEngine_lockInputLanguageSet(JNIEnv * env, jclass clazz, jlongArray languages, jint primaryLanguage) {
+	HKL languageHandles[MAX_PERMITTED_LAYOUTS];
+	jsize count = languages ? env->GetArrayLength(languages) : 0;
+	if (count > MAX_PERMITTED_LAYOUTS) {
+		count = MAX_PERMITTED_LAYOUTS;
+	}
+	jlong values[MAX_PERMITTED_LAYOUTS];
+	if (count) {
+		env->GetLongArrayRegion(languages, 0, count, values);
+	}
+	for (int i = 0; i < count; i++) {
+		languageHandles[i] = (HKL)values[i];
+	}
+	return (jlong)LockInputLanguageSet(languageHandles, count, (LANGID)primaryLanguage);
+}
+
+static void JNICALL LockEngine_unlockInputLanguage(JNIEnv * env, jclass clazz) {
 	UnlockInputLanguage();
 }
-}	
\ No newline at end of file
+
+static jboolean JNICALL LockEngine_lockWindowInputLanguage(JNIEnv * env, jclass clazz, jlong hwnd, jlong language) {
+	return LockWindowInputLanguage((HWND)hwnd, (HKL)language) ? JNI_TRUE : JNI_FALSE;
+}
+
+static void JNICALL LockEngine_unlockWindowInputLanguage(JNIEnv * env, jclass clazz, jlong hwnd) {
+	UnlockWindowInputLanguage((HWND)hwnd);
+}
+
+static jobject JNICALL LockEngine_getStatusBuffer(JNIEnv * env, jclass clazz) {
+	return env->NewDirectByteBuffer(&lockStatus, sizeof(lockStatus));
+}
+
+static jlongArray JNICALL LockEngine_getLockStatistics(JNIEnv * env, jclass clazz) {
+	LockStatistics stats;
+	stats.size = sizeof(stats);
+	GetLockStatistics(&stats);
+
+	// the number of the hooked threads, the counters, and then the latency histogram
+	const jsize length = 1 + LOCK_STAT_COUNTERS + LOCK_STAT_LATENCY_BUCKETS;
+	jlong values[length];
+	values[0] = stats.hookedThreads;
+	for (int i = 0; i < LOCK_STAT_COUNTERS; i++) {
+		values[1 + i] = (jlong)stats.counters[i];
+	}
+	for (int i = 0; i < LOCK_STAT_LATENCY_BUCKETS; i++) {
+		values[1 + LOCK_STAT_COUNTERS + i] = (jlong)stats.revertLatency[i];
+	}
+
+	jlongArray array = env->NewLongArray(length);
+	if (array) {
+		env->SetLongArrayRegion(array, 0, length, values);
+	}
+	return array;
+}
+
+static jlongArray JNICALL LockEngine_getInstalledLayouts(JNIEnv * env, jclass clazz) {
+	InstalledLayout layouts[MAX_INSTALLED_LAYOUTS];
+	int count = GetInstalledLayouts(layouts, MAX_INSTALLED_LAYOUTS);
+
+	// the handle and the language ID of each layout
+	jlong values[MAX_INSTALLED_LAYOUTS * 2];
+	for (int i = 0; i < count; i++) {
+		values[i * 2] = layouts[i].handle;
+		values[i * 2 + 1] = layouts[i].languageId;
+	}
+
+	jlongArray array = env->NewLongArray(count * 2);
+	if (array) {
+		env->SetLongArrayRegion(array, 0, count * 2, values);
+	}
+	return array;
+}
+
+static jboolean JNICALL LockEngine_setWindowRules(JNIEnv * env, jclass clazz, jstring rules) {
+	if (!rules) {
+		return SetWindowRules(NULL) ? JNI_TRUE : JNI_FALSE;
+	}
+	const char* text = env->GetStringUTFChars(rules, NULL);
+	if (!text) {
+		return JNI_FALSE;
+	}
+	BOOL valid = SetWindowRules(text);
+	env->ReleaseStringUTFChars(rules, text);
+	return valid ? JNI_TRUE : JNI_FALSE;
+}
+
+static jboolean JNICALL LockEngine_startEventNotifier(JNIEnv * env, jclass clazz) {
+	if (!dispatchEventsMethod) {
+		return JNI_FALSE;
+	}
+	// the starts are serialized, so that a failed one may be retried, but only one notifier is started
+	LockApiGuard guard;
+	if (notifierStarted.load()) {
+		return JNI_TRUE;
+	}
+
+	// the notifier thread holds a reference to the DLL, like the log writer thread
+	NotifierStart start = { NULL, CreateEventA(NULL, TRUE, FALSE, NULL) };
+	if (!start.attachedEvent) {
+		Log("Failed to start the events notifier, error=", GetLastError());
+		return JNI_FALSE;
+	}
+	if (!StartLockEvents() || !GetModuleHandleExA(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS, (LPCSTR)&LockEventsNotifierProc, &start.self)) {
+		Log("Failed to start the events notifier, error=", GetLastError());
+		StopLockEvents();
+		CloseHandle(start.attachedEvent);
+		return JNI_FALSE;
+	}
+	HANDLE thread = CreateThread(NULL, 0, LockEventsNotifierProc, &start, 0, NULL);
+	if (!thread) {
+		Log("Failed to start the events notifier, error=", GetLastError());
+		StopLockEvents();
+		FreeLibrary(start.self);
+		CloseHandle(start.attachedEvent);
+		return JNI_FALSE;
+	}
+	CloseHandle(thread);
+
+	// the commands are accepted only when their completion events may be delivered
+	WaitForSingleObject(start.attachedEvent, INFINITE);
+	CloseHandle(start.attachedEvent);
+	if (!notifierStarted.load()) {
+		StopLockEvents();
+		return JNI_FALSE;
+	}
+	return JNI_TRUE;
+}
+
+static jboolean JNICALL LockEngine_postLockCommand(JNIEnv * env, jclass clazz, jint type, jlong language, jint sequence) {
+	// the commands complete with the events, so they are not accepted without the notifier
+	if (!notifierStarted || (type != LOCK_COMMAND_LOCK && type != LOCK_COMMAND_UNLOCK)) {
+		return JNI_FALSE;
+	}
+	return PostLockCommand((LockCommandType)type, (HKL)language, (uint32_t)sequence) ? JNI_TRUE : JNI_FALSE;
+}
+
+static jboolean JNICALL LockEngine_postLayoutHint(JNIEnv * env, jclass clazz, jlong language) {
+	return PostLayoutHint((HKL)language) ? JNI_TRUE : JNI_FALSE;
+}
+
+static JNINativeMethod LockEngineMethods[] =
+{
+	{ (char*)"lockInputLanguage", (char*)"(J)J", (void*)LockEngine_lockInputLanguage },
+	{ (char*)"unlockInputLanguage", (char*)"()V", (void*)LockEngine_unlockInputLanguage },
+	{ (char*)"lockWindowInputLanguage", (char*)"(JJ)Z", (void*)LockEngine_lockWindowInputLanguage },
+	{ (char*)"unlockWindowInputLanguage", (char*)"(J)V", (void*)LockEngine_unlockWindowInputLanguage },
+	{ (char*)"getStatusBuffer", (char*)"()Ljava/nio/ByteBuffer;", (void*)LockEngine_getStatusBuffer },
+	{ (char*)"startEventNotifier", (char*)"()Z", (void*)LockEngine_startEventNotifier },
+	{ (char*)"getLockStatistics", (char*)"()[J", (void*)LockEngine_getLockStatistics },
+	{ (char*)"postLockCommand", (char*)"(IJI)Z", (void*)LockEngine_postLockCommand },
+	{ (char*)"getInstalledLayouts", (char*)"()[J", (void*)LockEngine_getInstalledLayouts },
+	{ (char*)"lockInputLanguageSet", (char*)"([JI)J", (void*)LockEngine_lockInputLanguageSet },
+	{ (char*)"postLayoutHint", (char*)"(J)Z", (void*)LockEngine_postLayoutHint },
+	{ (char*)"setWindowRules", (char*)"(Ljava/lang/String;)Z", (void*)LockEngine_setWindowRules },
+};
+
+extern "C" JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM* vm, void* reserved) {
+	// the status buffer and the events are used without the other exports, so initialize here
+	EnsureInitialized();
+	// only the plugins persist the lock, and restore it as early as possible
+	OpenLockStateFile();
+
+	JNIEnv* env;
+	if (vm->GetEnv((void**)&env, JNI_VERSION_1_6) != JNI_OK) {
+		return JNI_ERR;
+	}
+
+	jclass clazz = env->FindClass(LOCK_ENGINE_CLASS);
+	if (!clazz) {
+		env->ExceptionClear();
+		Log("JNI_OnLoad: LockEngine class is not found");
+		return JNI_VERSION_1_6;
+	}
+
+	// the methods are registered one by one, as an older plugin may miss some of them
+	for (int i = 0; i < sizeof(LockEngineMethods) / sizeof(JNINativeMethod); i++) {
+		if (env->RegisterNatives(clazz, &LockEngineMethods[i], 1) != JNI_OK) {
+			env->ExceptionClear();
+			char text[128];
+			_snprintf_s(text, sizeof(text), _TRUNCATE, "JNI_OnLoad: native method %s is not registered", LockEngineMethods[i].name);
+			Log(text);
+		}
+	}
+
+	// the class is looked up here, as the notifier thread has no access to the class loader of the plugin
+	dispatchEventsMethod = env->GetStaticMethodID(clazz, "dispatchEvents", "([J)V");
+	if (dispatchEventsMethod) {
+		javaVM = vm;
+		lockEngineClass = (jclass)env->NewGlobalRef(clazz);
+	}
+	else {
+		env->ExceptionClear();
+		Log("JNI_OnLoad: LockEngine.dispatchEvents() is not found, the events are disabled");
+	}
+	env->DeleteLocalRef(clazz);
+	return JNI_VERSION_1_6;
+}
@@ -0,0 +1,90 @@
+/*
+ * bounded-queue.h : fixed-capacity lock-free queue for passing records between threads.
+ *
+ * Any number of producers and consumers is supported (the algorithm by D. Vyukov): each cell has a sequence
+ * number which tells whether it is ready for the next push or the next pop, so neither TryPush() nor TryPop()
+ * ever blocks or allocates. When the queue is full, TryPush() just fails and the caller decides what to do.
+ *
+ * NOTE: this header does not depend on Windows headers.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+template <typename T, size_t Capacity>
+class BoundedQueue {
+	static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "Capacity shall be a power of 2");
+
+public:
+	BoundedQueue() : enqueuePos(0), dequeuePos(0) {
+		for (size_t i = 0; i < Capacity; i++) {
+			cells[i].sequence.store(i, std::memory_order_relaxed);
+		}
+	}
+
+	// Copies the value into the queue. Returns false if the queue is full
+	bool TryPush(const T& value) {
+		Cell* cell;
+		size_t pos = enqueuePos.load(std::memory_order_relaxed);
+		for (;;) {
+			cell = &cells[pos & (Capacity - 1)];
+			size_t seq = cell->sequence.load(std::memory_order_acquire);
+			intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+			if (diff == 0) {
+				if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					break;
+				}
+			} else if (diff < 0) {
+				return false;
+			} else {
+				pos = enqueuePos.load(std::memory_order_relaxed);
+			}
+		}
+		cell->data = value;
+		cell->sequence.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Moves the oldest value out of the queue. Returns false if the queue is empty
+	bool TryPop(T& value) {
+		Cell* cell;
+		size_t pos = dequeuePos.load(std::memory_order_relaxed);
+		for (;;) {
+			cell = &cells[pos & (Capacity - 1)];
+			size_t seq = cell->sequence.load(std::memory_order_acquire);
+			intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+			if (diff == 0) {
+				if (dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					break;
+				}
+			} else if (diff < 0) {
+				return false;
+			} else {
+				pos = dequeuePos.load(std::memory_order_relaxed);
+			}
+		}
+		value = cell->data;
+		cell->sequence.store(pos + Capacity, std::memory_order_release);
+		return true;
+	}
+
+	// Whether the queue looks empty. Is exact only if no pushes are performed concurrently
+	bool IsEmpty() const {
+		return enqueuePos.load(std::memory_order_acquire) == dequeuePos.load(std::memory_order_acquire);
+	}
+
+private:
+	struct Cell {
+		std::atomic<size_t> sequence;
+		T data;
+	};
+
+	Cell cells[Capacity];
+
+	// the producers and the consumers positions are kept in different cache lines
+	alignas(64) std::atomic<size_t> enqueuePos;
+	alignas(64) std::atomic<size_t> dequeuePos;
+};
@@ -3,49 +3,13 @@
 #include "lang-locker.h"
 
 
-int nAttachedProcs = 0, nAttachedThreads = 0;
-bool initialized = false;
 HMODULE module;
 
-void onAttach(bool isProc, HMODULE hModule) {
-	if (!initialized) {
-		initialized = true;
-		module = hModule;
-		Init();
-	}
-	if (isProc) {
-		nAttachedProcs++;
-		Log("PROCESS_ATTACH, threadId=", GetCurrentThreadId());
-
-		/*
-		// uncomment for logging module and process names
-		char modName[1000];
-		GetModuleFileNameA(NULL, modName, 1000);
-		Log(modName);
-		GetModuleFileNameA(hModule, modName, 1000);
-		Log(modName);
-		*/
-	}
-	else {
-		nAttachedThreads++;
-//		Log("THREAD_ATTACH, threadId=", GetCurrentThreadId());
-	}
-
-}
-
-void onDetach(bool isProc) {
-	if (isProc) {
-		nAttachedProcs--;
-		Log("PROCESS_DETACH, threadId=", GetCurrentThreadId());
-	} else {
-//		Log("THREAD_DETACH, threadId=", GetCurrentThreadId());
-		nAttachedThreads--;
-	}
-	if (nAttachedProcs <= 0 && nAttachedThreads <= 0) {
-		Cleanup();
-	}
-}
-
+//
+// Nothing is initialized here, under the loader lock: the DLL is initialized by the first call of its exports,
+// see EnsureInitialized(). The thread notifications are ignored, as the DLL keeps no per-thread state. They are
+// not disabled by DisableThreadLibraryCalls(), as the static CRT needs them to free its per-thread data.
+//
 BOOL APIENTRY DllMain( HMODULE hModule,
                        DWORD  ul_reason_for_call,
                        LPVOID lpReserved
@@ -54,16 +18,13 @@ BOOL APIENTRY DllMain( HMODULE hModule,
 	switch (ul_reason_for_call)
 	{
 	case DLL_PROCESS_ATTACH:
-		onAttach(true, hModule);
-		break;
-	case DLL_THREAD_ATTACH:
-		onAttach(false, hModule);
-		break;
-	case DLL_THREAD_DETACH:
-		onDetach(false);
+		module = hModule;
 		break;
 	case DLL_PROCESS_DETACH:
-		onDetach(true);
+		if (IsInitialized()) {
+			Log("PROCESS_DETACH, threadId=", GetCurrentThreadId());
+			Cleanup();
+		}
 		break;
 	}
 	return TRUE;
@@ -0,0 +1,100 @@
+/*
+ * hooked-threads.h : table of the GUI threads with the hooks set while the language is locked.
+ *
+ * The hook procedures find the entry of the current thread by its ID. The table is a fixed open-addressing
+ * hash table, with the keys kept apart from the entries, so that a lookup usually reads a single cache line.
+ * The table is changed only by the lock/unlock functions (serialized by LockApiGuard), while the hooks are not set.
+ *
+ * The hooks of a thread may still run for a while after the unlock, and then the entry may be added again by the
+ * next lock. So the fields used only by the hooked thread itself are never written by the lock functions: instead,
+ * the hooks reset them at their first call after the entry is added, see FindOwnHookedThread().
+ */
+
+#pragma once
+
+#include "lock-stats.h"
+#include "key-remap.h"
+
+// The number of the slots is a power of 2. Only a half of them may be used, to keep the probes short
+const int HOOKED_THREADS_SLOTS_BITS = 6;
+const int HOOKED_THREADS_SLOTS = 1 << HOOKED_THREADS_SLOTS_BITS;
+const int MAX_HOOKED_THREADS = HOOKED_THREADS_SLOTS / 2;
+
+struct HookedThread {
+	// the hooks, set and unset by the lock functions
+	HHOOK messagesHook;
+	HHOOK shellHook;
+	// the optional keyboard hook, see key-remap.h
+	HHOOK keyboardHook;
+	// whether an unwanted language switch was detected in this thread, and shall be reverted.
+	// The "revert required" flag of the lock state word is set if it is set for any thread
+	std::atomic<bool> revertPending;
+	// the time when the pending revert was requested, see StatTimestamp()
+	std::atomic<int64_t> revertRequestedAt;
+	// changed each time the entry is added by the lock functions
+	std::atomic<uint32_t> generation;
+
+	// The fields below are owned by the hooked thread, and valid only while ownedGeneration equals generation
+	uint32_t ownedGeneration;
+	// the keys typed while a revert is pending, see key-remap.h
+	KeyBuffer keys;
+	// the timer which bounds the time until the revert, or 0, see revert-scheduler.h
+	UINT_PTR revertTimer;
+	// the last performed revert, which is not yet known to stick
+	bool lastRevertUnconfirmed;
+	uint8_t lastRevertClass;
+	DWORD lastRevertTime;
+
+	// the layout locked for the last focused window of this thread, cached by the hooks, see window-locks.h
+	HWND focusWindow;
+	uint32_t focusLayout;
+	DWORD focusVersion;
+
+	// the counters of this thread, see lock-stats.h. Atomic, as they are also retired by the lock functions
+	ThreadStatistics stats;
+};
+
+// IDs of the hooked threads, 0 for free slots
+extern std::atomic<DWORD> hookedThreadIds[HOOKED_THREADS_SLOTS];
+extern HookedThread hookedThreads[HOOKED_THREADS_SLOTS];
+extern int hookedThreadsCount;
+
+inline int HookedThreadSlot(DWORD threadId) {
+	// Fibonacci hashing, the thread IDs are multiples of 4
+	return (int)(((uint32_t)threadId * 0x9E3779B1u) >> (32 - HOOKED_THREADS_SLOTS_BITS));
+}
+
+// Returns the entry of the specified thread, or NULL if it is not hooked
+inline HookedThread* FindHookedThread(DWORD threadId) {
+	for (int slot = HookedThreadSlot(threadId); ; slot = (slot + 1) & (HOOKED_THREADS_SLOTS - 1)) {
+		DWORD id = hookedThreadIds[slot].load(std::memory_order_acquire);
+		if (id == 0) {
+			return NULL;
+		}
+		if (id == threadId) {
+			return &hookedThreads[slot];
+		}
+	}
+}
+
+// Resets the fields owned by the hooked thread
+void ResetHookedThread(HookedThread* thread, uint32_t generation);
+
+// Returns the entry of the current thread for use by its hooks, or NULL if it is not hooked. The fields owned by
+// the thread are reset if the entry is added since the last call
+inline HookedThread* FindOwnHookedThread(DWORD currentThreadId) {
+	HookedThread* thread = FindHookedThread(currentThreadId);
+	if (thread) {
+		uint32_t generation = thread->generation.load(std::memory_order_relaxed);
+		if (generation != thread->ownedGeneration) {
+			ResetHookedThread(thread, generation);
+		}
+	}
+	return thread;
+}
+
+// Adds the thread into the table, or returns the existing entry. Returns NULL if the table is full
+HookedThread* AddHookedThread(DWORD threadId);
+
+// Removes all threads from the table
+void ClearHookedThreads();
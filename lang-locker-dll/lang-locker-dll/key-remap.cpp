@@ -0,0 +1,172 @@
+/*
+ * key-remap.cpp : optional remapping of the keys typed while a revert is pending, see key-remap.h
+ */
+
+#include "stdafx.h"
+#include "lang-locker.h"
+#include "platform.h"
+#include "key-remap.h"
+
+bool keyRemapEnabled = false;
+
+// The characters produced by the scan codes in a layout, for each state of Shift and Caps Lock,
+// 0 for non-character keys
+struct RemapTable {
+	std::atomic<uint32_t> layout;
+	wchar_t chars[REMAP_MODIFIER_STATES][REMAP_SCAN_CODES];
+};
+
+const int MAX_REMAP_LAYOUTS = 8;
+
+// The tables are only added, before the hooks are set; a table is published by the release store of its layout
+static RemapTable remapTables[MAX_REMAP_LAYOUTS];
+static int remapTablesCount = 0;
+
+void InitKeyRemap() {
+	char buf[16];
+	DWORD len = GetEnvironmentVariableA("LANGLOCKER_REMAP_KEYS", buf, sizeof(buf));
+	keyRemapEnabled = len > 0 && len < sizeof(buf) && !(len == 1 && buf[0] == '0');
+	if (keyRemapEnabled) {
+		Log("Remapping of the keys typed during the reverts is enabled");
+	}
+}
+
+static void BuildRemapTable(RemapTable& table, HKL languageHandle) {
+	BYTE keyState[256] = { 0 };
+	for (int modifiers = 0; modifiers < REMAP_MODIFIER_STATES; modifiers++) {
+		keyState[VK_SHIFT] = modifiers & (REMAP_SHIFT >> 7) ? 0x80 : 0;
+		// the low bit is the toggled state
+		keyState[VK_CAPITAL] = modifiers & (REMAP_CAPS_LOCK >> 7) ? 0x01 : 0;
+		table.chars[modifiers][0] = 0;
+		for (UINT scan = 1; scan < REMAP_SCAN_CODES; scan++) {
+			UINT vk = platform->mapVirtualKey(scan, MAPVK_VSC_TO_VK, languageHandle);
+			wchar_t buf[4];
+			int count = vk ? platform->toUnicode(vk, scan, keyState, buf, 4, 0, languageHandle) : 0;
+			if (count < 0) {
+				// a dead key; repeat it to clear the dead key state kept for the thread
+				platform->toUnicode(vk, scan, keyState, buf, 4, 0, languageHandle);
+			}
+			// the control characters, like Enter or Backspace, are not remapped
+			table.chars[modifiers][scan] = count == 1 && buf[0] >= 0x20 ? buf[0] : 0;
+		}
+	}
+	table.layout.store(HKLToLayout(languageHandle), std::memory_order_release);
+}
+
+static const RemapTable* FindRemapTable(uint32_t layout) {
+	for (int i = 0; i < MAX_REMAP_LAYOUTS; i++) {
+		uint32_t tableLayout = remapTables[i].layout.load(std::memory_order_acquire);
+		if (tableLayout == layout) {
+			return &remapTables[i];
+		}
+		if (!tableLayout) {
+			break;
+		}
+	}
+	return NULL;
+}
+
+void PrepareKeyRemap() {
+	if (!keyRemapEnabled) {
+		return;
+	}
+	InstalledLayout layouts[MAX_INSTALLED_LAYOUTS];
+	int count = GetIndexedLayouts(layouts, MAX_INSTALLED_LAYOUTS);
+	for (int i = 0; i < count && remapTablesCount < MAX_REMAP_LAYOUTS; i++) {
+		HKL languageHandle = (HKL)(LONG_PTR)layouts[i].handle;
+		if (!FindRemapTable(HKLToLayout(languageHandle))) {
+			BuildRemapTable(remapTables[remapTablesCount++], languageHandle);
+		}
+	}
+}
+
+static wchar_t RemapChar(const RemapTable* table, uint16_t key) {
+	return table->chars[key >> 7][key & (REMAP_SCAN_CODES - 1)];
+}
+
+static void CancelRemapDelay(KeyBuffer& keys) {
+	if (keys.delayTimer) {
+		platform->killThreadTimer(keys.delayTimer);
+		keys.delayTimer = 0;
+	}
+}
+
+void FlushRemappedKeys(HookedThread* thread, HKL languageHandle) {
+	KeyBuffer& keys = thread->keys;
+	CancelRemapDelay(keys);
+	const RemapTable* table = FindRemapTable(HKLToLayout(languageHandle));
+	for (int i = 0; i < keys.count; i++) {
+		wchar_t ch = table ? RemapChar(table, keys.keys[i]) : 0;
+		if (ch) {
+			// the posted messages are retrieved before the input, so the characters precede the keys typed later
+			LPARAM lParam = 1 | ((LPARAM)(keys.keys[i] & (REMAP_SCAN_CODES - 1)) << 16);
+			platform->postMessage(keys.target, WM_CHAR, ch, lParam);
+			CountStat(thread->stats, LOCK_STAT_KEYS_REMAPPED);
+		}
+	}
+	keys.count = 0;
+}
+
+// Invoked in the hooked thread when the keys are kept for too long
+static VOID CALLBACK RemapDelayProc(HWND hwnd, UINT message, UINT_PTR timerId, DWORD time) {
+	HookedThread* thread = FindOwnHookedThread(platform->getCurrentThreadId());
+	if (!thread || thread->keys.delayTimer != timerId) {
+		platform->killThreadTimer(timerId);
+		return;
+	}
+	Log("RemapDelayProc: the revert is late, re-emit the keys");
+	FlushRemappedKeys(thread, GetLockedLanguage());
+}
+
+inline bool IsKeyPressed(const KeyBuffer& keys, UINT scan) {
+	return (keys.pressed[scan / 32] & (1u << (scan % 32))) != 0;
+}
+
+LRESULT WINAPI HookKeyboardProc(int nCode, WPARAM wParam, LPARAM lParam) {
+	HookedThread* thread = FindOwnHookedThread(platform->getCurrentThreadId());
+	// fast path: no revert is pending, and no keys are buffered or swallowed
+	if (!thread || nCode != HC_ACTION || (!thread->revertPending.load(std::memory_order_relaxed)
+			&& !thread->keys.count && !thread->keys.pressedCount)) {
+		return platform->callNextHook(nCode, wParam, lParam);
+	}
+
+	KeyBuffer& keys = thread->keys;
+	UINT scan = (lParam >> 16) & 0xFF;
+	bool extended = (lParam & 0x01000000) != 0;
+	bool keyUp = (lParam & 0x80000000) != 0;
+	if (keyUp) {
+		if (!extended && scan < REMAP_SCAN_CODES && IsKeyPressed(keys, scan)) {
+			keys.pressed[scan / 32] &= ~(1u << (scan % 32));
+			keys.pressedCount--;
+			return 1;
+		}
+		return platform->callNextHook(nCode, wParam, lParam);
+	}
+
+	HKL lockedLang = GetLockedLanguage();
+	const RemapTable* table = lockedLang ? FindRemapTable(HKLToLayout(lockedLang)) : NULL;
+	uint16_t key = (uint16_t)(scan | (platform->getKeyState(VK_SHIFT) < 0 ? REMAP_SHIFT : 0)
+		| (platform->getKeyState(VK_CAPITAL) & 1 ? REMAP_CAPS_LOCK : 0));
+	if (!thread->revertPending.load(std::memory_order_relaxed) || !table || extended || scan >= REMAP_SCAN_CODES
+			|| platform->getKeyState(VK_CONTROL) < 0 || platform->getKeyState(VK_MENU) < 0 || !RemapChar(table, key)) {
+		// not a character key, or the revert is done; keep the order of the input
+		if (keys.count) {
+			FlushRemappedKeys(thread, lockedLang);
+		}
+		return platform->callNextHook(nCode, wParam, lParam);
+	}
+
+	if (keys.count == REMAP_MAX_KEYS) {
+		FlushRemappedKeys(thread, lockedLang);
+	}
+	if (!keys.count) {
+		keys.target = platform->getFocus();
+		keys.delayTimer = platform->setThreadTimer(REMAP_MAX_DELAY_MS, RemapDelayProc);
+	}
+	keys.keys[keys.count++] = key;
+	if (!IsKeyPressed(keys, scan)) {
+		keys.pressed[scan / 32] |= 1u << (scan % 32);
+		keys.pressedCount++;
+	}
+	return 1;
+}
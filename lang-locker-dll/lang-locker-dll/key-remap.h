@@ -0,0 +1,57 @@
+/*
+ * key-remap.h : optional remapping of the keys typed while a revert is pending.
+ *
+ * However fast the revert is, the keys pressed between an unwanted switch and its revert are translated in the
+ * wrong layout. If LANGLOCKER_REMAP_KEYS environment variable is set (to any value but "0"), a WH_KEYBOARD hook
+ * is set for each hooked thread. While a revert is pending in the thread, it swallows the character keys and
+ * buffers them; when the revert is performed, the buffered keys are re-emitted as WM_CHAR of the locked layout.
+ * The characters are taken from the tables built once per installed layout when the hooks are set, so the
+ * re-emitted text does not depend on whether the revert actually succeeded.
+ *
+ * The added latency is bounded by REMAP_MAX_DELAY_MS: then the buffered keys are re-emitted even if the revert
+ * is still pending. Any non-character key (or a key with Ctrl or Alt) re-emits the buffered keys before it,
+ * to keep the order of the input. While no revert is pending, the hook only checks the flag of the thread.
+ */
+
+#pragma once
+
+// The maximal number of the buffered keys, and the maximal time to keep them
+const int REMAP_MAX_KEYS = 32;
+const DWORD REMAP_MAX_DELAY_MS = 100;
+
+// The scan codes with the tables; the extended keys are never remapped
+const int REMAP_SCAN_CODES = 128;
+// The modifiers of a buffered key, above its scan code, so that key >> 7 is the index of the table row
+const uint16_t REMAP_SHIFT = 0x80;
+const uint16_t REMAP_CAPS_LOCK = 0x100;
+const int REMAP_MODIFIER_STATES = 4;
+static_assert((REMAP_SHIFT | REMAP_CAPS_LOCK) >> 7 == REMAP_MODIFIER_STATES - 1, "Unexpected remap modifiers");
+
+struct KeyBuffer {
+	uint8_t count;
+	// the scan codes of the buffered keys, with REMAP_SHIFT if Shift was pressed, and REMAP_CAPS_LOCK if
+	// Caps Lock was on
+	uint16_t keys[REMAP_MAX_KEYS];
+	// the number of the swallowed keys which are still pressed, and their scan codes, to swallow their key-ups too
+	uint8_t pressedCount;
+	uint32_t pressed[REMAP_SCAN_CODES / 32];
+	// the window focused at the first buffered key
+	HWND target;
+	// the timer which bounds the time the keys are kept
+	UINT_PTR delayTimer;
+};
+
+struct HookedThread;
+
+extern bool keyRemapEnabled;
+
+// Reads the setting of the remapping
+void InitKeyRemap();
+
+// Builds the tables for the installed layouts, if not yet. Called before the hooks are set
+void PrepareKeyRemap();
+
+// Re-emits the buffered keys of the thread as the characters of the specified layout. Called in the thread
+void FlushRemappedKeys(HookedThread* thread, HKL languageHandle);
+
+LRESULT WINAPI HookKeyboardProc(int nCode, WPARAM wParam, LPARAM lParam);
@@ -4,139 +4,356 @@
 
 #include "stdafx.h"
 #include "lang-locker.h"
+#include "platform.h"
+#include "lock-logic.h"
+#include "trace.h"
+#include "main-thread.h"
+#include "window-locks.h"
+#include "window-rules.h"
+#include "lock-status.h"
+#include "lock-events.h"
+#include "lock-commands.h"
+#include "shared-lock.h"
+#include "layout-index.h"
+#include "permitted-layouts.h"
+#include "lock-state-file.h"
+#include "revert-scheduler.h"
 #include "msgnames.h"
 
-// Determines the current locking state
-HKL lockedLanguageHandle = 0;
+// Determines the current locking state, see lock-state.h for the layout of the word.
+// Changed with CAS from either the UI thread (lock/unlock) or the hooked threads, read by hooks with a relaxed load
+std::atomic<LockStateWord> lockState(0);
 
-// Set if unwanted language switch was not blocked, and thus shall be reverted at first possibility
-bool revertLanguageRequired = false;
-
-HHOOK messagesHook = 0;
-HHOOK shellHook = 0;
+// The threads with the hooks set, see hooked-threads.h
+std::atomic<DWORD> hookedThreadIds[HOOKED_THREADS_SLOTS];
+HookedThread hookedThreads[HOOKED_THREADS_SLOTS];
+int hookedThreadsCount = 0;
 
 // it is preferred that all checks and sets of the language are performed on 'main' thread, which gets widnows messages
 // this ID is set at the first caught message; until that, value of '0' means 'current thread'
-DWORD mainThreadId = 0;
+std::atomic<DWORD> mainThreadId(0);
+
+// UI thread is usually "EventQueue" thread, from which the lock/unlock commands are received. It is the main thread
+// for the commands posted by PostLockCommand()
+std::atomic<DWORD> uiThreadId(0);
+
+// serializes the lock functions, see LockApiGuard
+static CRITICAL_SECTION lockApiSection;
+
+// the generation of the last added entry of the hooked threads, see HookedThread::generation
+static uint32_t hookedThreadsGeneration = 0;
+
+void EnterLockApi() {
+	EnterCriticalSection(&lockApiSection);
+}
+
+void LeaveLockApi() {
+	LeaveCriticalSection(&lockApiSection);
+}
+
+void SetLockedLanguage(HKL languageHandle) {
+	LockStateWord state = lockState.load(std::memory_order_relaxed);
+	while (!lockState.compare_exchange_weak(state, NextLockState(state, HKLToLayout(languageHandle), false))) {
+	}
+}
+
+bool RequestLanguageRevert(HookedThread* thread) {
+	if (!thread || thread->revertPending.load(std::memory_order_relaxed)) {
+		return false;
+	}
+	thread->revertRequestedAt.store(StatTimestamp(), std::memory_order_relaxed);
+	thread->revertPending.store(true);
+
+	// the flag in the state word is updated with a new generation even if it is already set, so that a concurrent
+	// TakeLanguageRevert() in another thread fails to reset it
+	LockStateWord state = lockState.load(std::memory_order_relaxed);
+	do {
+		if (!IsLocked(state)) {
+			return false;
+		}
+	} while (!lockState.compare_exchange_weak(state, NextLockState(state, LockedLayoutOf(state), true)));
+	return true;
+}
+
+static bool IsAnyRevertPending() {
+	for (int slot = 0; slot < HOOKED_THREADS_SLOTS; slot++) {
+		if (hookedThreadIds[slot].load(std::memory_order_relaxed) && hookedThreads[slot].revertPending.load()) {
+			return true;
+		}
+	}
+	return false;
+}
+
+HKL TakeLanguageRevert(HookedThread* thread, uint32_t windowLayout) {
+	if (!thread || !thread->revertPending.exchange(false)) {
+		return 0;
+	}
+
+	// reset the flag in the state word, unless other threads need to revert too
+	LockStateWord state = lockState.load();
+	while (IsRevertRequired(state) && !IsAnyRevertPending()) {
+		if (lockState.compare_exchange_weak(state, NextLockState(state, LockedLayoutOf(state), false))) {
+			break;
+		}
+	}
+	return LayoutToHKL(windowLayout ? windowLayout : LockedLayoutOf(state));
+}
+
+void SetWindowBindingsFlag(bool hasBindings) {
+	LockStateWord state = lockState.load(std::memory_order_relaxed);
+	LockStateWord next;
+	do {
+		next = NextLockState(state, LockedLayoutOf(state), IsRevertRequired(state)) & ~LOCK_STATE_WINDOW_BINDINGS;
+		if (hasBindings) {
+			next |= LOCK_STATE_WINDOW_BINDINGS;
+		}
+	} while (!lockState.compare_exchange_weak(state, next));
+}
+
+// Returns the layout locked for the focused window of the hooked thread, either explicitly or by the window rules,
+// WINDOW_LAYOUT_FREE if the window is free of the lock, or 0 if the process-wide one shall be used
+static uint32_t ResolveWindowLayout(HookedThread* thread, HWND focus) {
+	DWORD version = windowLocksVersion.load(std::memory_order_acquire);
+	if (focus != thread->focusWindow || version != thread->focusVersion) {
+		uint32_t layout = FindWindowLockLayout(focus);
+		thread->focusWindow = focus;
+		thread->focusLayout = layout ? layout : FindWindowRuleLayout(focus);
+		thread->focusVersion = version;
+	}
+	return thread->focusLayout;
+}
+
+void ResetHookedThread(HookedThread* thread, uint32_t generation) {
+	thread->keys = KeyBuffer();
+	thread->revertTimer = 0;
+	thread->lastRevertUnconfirmed = false;
+	thread->focusWindow = NULL;
+	thread->focusVersion = 0;
+	thread->ownedGeneration = generation;
+}
+
+HookedThread* AddHookedThread(DWORD threadId) {
+	HookedThread* thread = FindHookedThread(threadId);
+	if (thread || hookedThreadsCount >= MAX_HOOKED_THREADS) {
+		return thread;
+	}
+	int slot = HookedThreadSlot(threadId);
+	while (hookedThreadIds[slot].load(std::memory_order_relaxed)) {
+		slot = (slot + 1) & (HOOKED_THREADS_SLOTS - 1);
+	}
+	thread = &hookedThreads[slot];
+	thread->messagesHook = NULL;
+	thread->shellHook = NULL;
+	thread->keyboardHook = NULL;
+	thread->revertPending.store(false, std::memory_order_relaxed);
+	thread->revertRequestedAt.store(0, std::memory_order_relaxed);
+	// the fields owned by the hooked thread are reset by its hooks, as they may still run after the unlock
+	thread->generation.store(++hookedThreadsGeneration, std::memory_order_relaxed);
+	hookedThreadIds[slot].store(threadId, std::memory_order_release);
+	hookedThreadsCount++;
+	return thread;
+}
 
-// UI thread is usually "EventQueue" thread, from which the lock/unlock commands are received
-DWORD uiThreadId = 0;
+void ClearHookedThreads() {
+	for (int slot = 0; slot < HOOKED_THREADS_SLOTS; slot++) {
+		if (hookedThreadIds[slot].load(std::memory_order_relaxed)) {
+			RetireThreadStatistics(hookedThreads[slot].stats);
+		}
+		hookedThreadIds[slot].store(0, std::memory_order_relaxed);
+	}
+	hookedThreadsCount = 0;
+}
 
 // activates the specified language if it is avalable.
-// returns whether activation succeeded
+// returns whether activation succeeded; if not, the error is kept as the last error of the thread
 bool SetInputLanguage(HKL languageHandle) {
-	HKL result = ActivateKeyboardLayout(languageHandle, KLF_ACTIVATE | KLF_SUBSTITUTE_OK | KLF_SETFORPROCESS);
+	HKL result = platform->activateKeyboardLayout(languageHandle, KLF_ACTIVATE | KLF_SUBSTITUTE_OK | KLF_SETFORPROCESS);
+	DWORD error = result ? 0 : GetLastError();
 	Log("SetInputLanguage() to ", languageHandle);
+	TraceEvent(TRACE_SOURCE_SET_LANGUAGE, 0, 0, result != 0, 0, (LPARAM)languageHandle, lockState.load(std::memory_order_relaxed));
+	if (!result) {
+		// the layout may be removed
+		InvalidateLayoutIndex();
+		PublishLockError(error);
+		SetLastError(error);
+	}
 
 	return result != 0;
 }
 
-#ifdef _DEBUG
-char* findMessageName(UINT code) {
-	for (int i = 0; i < sizeof(WindowsMessages) / sizeof(WindowsMessage); i++) {
-		if (WindowsMessages[i].msgid == code) {
-			return WindowsMessages[i].pname;
+// the revert deadline timer of the thread is not needed anymore, or is expired
+static void CancelRevertDeadline(HookedThread* thread) {
+	if (thread->revertTimer) {
+		platform->killThreadTimer(thread->revertTimer);
+		thread->revertTimer = 0;
+	}
+}
+
+// Whether the layout switched to is permitted by the lock, but is not the locked one. The layouts locked for
+// specific windows are strict
+inline bool IsPermittedSwitch(LockStateWord state, uint32_t windowLayout, uint32_t layout) {
+	return !windowLayout && IsLocked(state) && layout != LockedLayoutOf(state)
+		&& HasPermittedLayouts() && IsPermittedLayout(layout);
+}
+
+// Makes the permitted layout switched to the locked one, so that the switch is kept, and the later reverts restore
+// it. Returns the updated lock state as seen by the thread
+static LockStateWord AdoptPermittedLayout(HookedThread* thread, uint32_t layout) {
+	// a revert requested before the switch is not needed anymore
+	if (TakeLanguageRevert(thread, 0)) {
+		CancelRevertDeadline(thread);
+	}
+	LockStateWord state = lockState.load(std::memory_order_relaxed);
+	while (IsLocked(state) && !lockState.compare_exchange_weak(state, NextLockState(state, layout, IsRevertRequired(state)))) {
+	}
+	Log("Switched to a permitted language ", LayoutToHKL(layout));
+	return ThreadLockState(lockState.load(std::memory_order_relaxed), thread);
+}
+
+// reverts the unwanted language switch detected by the hooks in the thread, and notifies about the result
+static void RevertInputLanguage(HookedThread* thread, HKL languageHandle, RevertClass revertClass) {
+	CancelRevertDeadline(thread);
+	if (SetInputLanguage(languageHandle)) {
+		NoteRevert(thread, revertClass);
+		CountStat(thread->stats, LOCK_STAT_REVERTS);
+		int64_t requestedAt = thread->revertRequestedAt.load(std::memory_order_relaxed);
+		if (requestedAt) {
+			CountRevertLatency(thread->stats, requestedAt);
 		}
+		PublishRevert(languageHandle);
+		PostLockEvent(LOCK_EVENT_REVERTED, platform->getCurrentThreadId(), languageHandle, 0);
+	}
+	else {
+		CountStat(thread->stats, LOCK_STAT_REVERTS_FAILED);
+		PostLockEvent(LOCK_EVENT_REVERT_FAILED, platform->getCurrentThreadId(), languageHandle, GetLastError());
+	}
+	if (thread->keys.count) {
+		FlushRemappedKeys(thread, languageHandle);
 	}
-	Log("Unknown Message: ", code);
-	return "Unknown";
 }
+
+// Invoked in the hooked thread by DispatchMessage() of WM_TIMER, if the revert was not performed earlier
+static VOID CALLBACK RevertDeadlineProc(HWND hwnd, UINT message, UINT_PTR timerId, DWORD time) {
+	HookedThread* thread = FindOwnHookedThread(platform->getCurrentThreadId());
+	if (!thread || thread->revertTimer != timerId) {
+		// left after the revert, or after the hooks are unset
+		platform->killThreadTimer(timerId);
+		return;
+	}
+	CancelRevertDeadline(thread);
+
+	LockStateWord state = lockState.load(std::memory_order_relaxed);
+	uint32_t windowLayout = 0;
+	if (HasWindowBindings(state) && IsLocked(state)) {
+		windowLayout = ResolveWindowLayout(thread, platform->getFocus());
+		if (windowLayout == WINDOW_LAYOUT_FREE) {
+			// the revert waits until the focus leaves the free window
+			return;
+		}
+	}
+	HKL revertLang = TakeLanguageRevert(thread, windowLayout);
+	if (revertLang) {
+		Log("RevertDeadlineProc: revert the input language to ", revertLang);
+		CountStat(thread->stats, LOCK_STAT_REVERTS_BY_DEADLINE);
+		RevertInputLanguage(thread, revertLang, REVERT_CLASS_DEADLINE);
+	}
+}
+
+// Requests the revert of the unwanted switch detected by the hooks in the current thread, and bounds the time
+// until the revert with the deadline timer
+static void RequestRevertInThread(HookedThread* thread) {
+	NoteSwitchDetected(thread);
+	RequestLanguageRevert(thread);
+	if (!thread->revertTimer) {
+		thread->revertTimer = platform->setThreadTimer(REVERT_DEADLINE_MS, RevertDeadlineProc);
+	}
+}
+
+// Whether the message is the expiration of the revert deadline timer of the thread
+inline bool IsRevertDeadlineMessage(const HookedThread* thread, const MSG* pmsg) {
+	return pmsg->message == WM_TIMER && pmsg->hwnd == NULL && thread->revertTimer && pmsg->wParam == thread->revertTimer;
+}
+
+#if LANGLOCKER_LOG_LEVEL >= LOG_LEVEL_TRACE
+static void LogHookMessage(int nCode, const MSG* pmsg) {
+	char text[200];
+	int len = _snprintf_s(text, sizeof(text), _TRUNCATE, "HookGetMsgProc(%d): ", nCode);
+	FormatWindowMessage(text + len, sizeof(text) - len, pmsg->message, pmsg->wParam, pmsg->lParam);
+	Log(text);
+}
+
+static void LogHookShellEvent(int nCode, WPARAM wParam, LPARAM lParam) {
+	char text[200];
+	int len = _snprintf_s(text, sizeof(text), _TRUNCATE, "HookShellProc: ");
+	FormatShellEvent(text + len, sizeof(text) - len, nCode, wParam, lParam);
+	Log(text);
+}
+#else
+inline void LogHookMessage(int nCode, const MSG* pmsg) {}
+inline void LogHookShellEvent(int nCode, WPARAM wParam, LPARAM lParam) {}
 #endif
 
 void Init() {
-#ifdef _DEBUG
-//	char buf[100];
-//	sprintf_s(buf, "C:/temp/lang-locker-%d.log", GetCurrentProcessId());
-//	logfile.open(buf);
-	logfile.open("lang-locker.log");
-
+	// never deleted, as the lock functions may be called by other threads until the process exit
+	InitializeCriticalSection(&lockApiSection);
+	InitLog();
 #ifdef MYWIN64
 	Log("lang-locker.dll 64-bit initialized");
 #else
 	Log("lang-locker.dll 32-bit initialized");
 #endif
-#endif
+	InitTrace();
+	InitLockStatus();
+	InitKeyRemap();
+	OpenSharedLock();
 }
 
-void Cleanup() {
-	UnlockInputLanguage();
-#ifdef _DEBUG
-	Log("lang-locker.dll detached, cleanup");
-	logfile.close();
-#endif
-}
+static INIT_ONCE initOnce = INIT_ONCE_STATIC_INIT;
+static std::atomic<bool> initialized(false);
 
-BOOL CALLBACK EnumThreadWndProc(HWND hwnd, LPARAM lParam) {
-	*(BOOL*)lParam = TRUE;
-	return FALSE;
+static BOOL CALLBACK InitOnceProc(PINIT_ONCE initOnce, PVOID param, PVOID* context) {
+	Init();
+	initialized.store(true, std::memory_order_release);
+	return TRUE;
 }
 
-BOOL HasWindow(DWORD threadId) {
-	BOOL hasWnd = FALSE;
-	EnumThreadWindows(threadId, &EnumThreadWndProc, (LPARAM)&hasWnd);
-	return hasWnd;
+void EnsureInitialized() {
+	if (!initialized.load(std::memory_order_acquire)) {
+		// the concurrent callers wait for the first one to complete the initialization
+		InitOnceExecuteOnce(&initOnce, InitOnceProc, NULL, NULL);
+	}
 }
 
-DWORD FindSingleWindowThreadId()
-{
-	DWORD procId = GetCurrentProcessId();
-	DWORD foundThreadId = NULL;
-	HANDLE hThreadSnap = INVALID_HANDLE_VALUE;
-	THREADENTRY32 te32;
-	te32.dwSize = sizeof(THREADENTRY32);
-
-	hThreadSnap = CreateToolhelp32Snapshot(TH32CS_SNAPTHREAD, 0);
-	if (hThreadSnap == INVALID_HANDLE_VALUE)
-	{
-		Log("CreateToolhelp32Snapshot failed");
-		return NULL;
-	}
-
-	if (!Thread32First(hThreadSnap, &te32))
-	{
-		Log("Thread32First Failed");
-		CloseHandle(hThreadSnap);
-		return NULL;
-	}
-
-	// walk the thread list, for each thread of this process, check if it has any windows
-	do
-	{
-		if (te32.th32OwnerProcessID == procId)
-		{
-			if (HasWindow(te32.th32ThreadID)) {
-				Log("Thread with window(s): ", te32.th32ThreadID);
-				if (foundThreadId) {
-					Log("Multiple threads with windows found, give up...");
-					return NULL;
-				}
-				else {
-					foundThreadId = te32.th32ThreadID;
-				}
-			}
-		}
-	} while (Thread32Next(hThreadSnap, &te32));
-	CloseHandle(hThreadSnap);
+bool IsInitialized() {
+	return initialized.load(std::memory_order_acquire);
+}
 
-	return foundThreadId;
+void Cleanup() {
+	StopLockCommands();
+	// the other instances keep their lock
+	UnlockInputLanguageLocally();
+	StopLockEvents();
+	CloseSharedLock();
+	CloseLockStateFile();
+	CloseTrace();
+	Log("lang-locker.dll detached, cleanup");
+	CloseLog();
 }
 
 void DetectMainThread() {
-	DWORD currentThreadId = GetCurrentThreadId();
-	if (HasWindow(currentThreadId)) {
-		Log("DetectMainThread() detected the current thread as the main thread: ", currentThreadId);
-		mainThreadId = currentThreadId;
+	if (hookedThreadsCount) {
+		// the hooks are set for the current main thread
+		return;
 	}
-	else {
-		DWORD tid = FindSingleWindowThreadId();
-		if (tid) {
+	DWORD tid = FindMainThread();
+	if (tid) {
+		if (mainThreadId.exchange(tid) != tid) {
 			Log("DetectMainThread() detected the main thread: ", tid);
-			mainThreadId = tid;
-		}
-		else {
-			Log("DetectMainThread() failed to detect the main thread!");
 		}
 	}
+	else {
+		Log("DetectMainThread() failed to detect the main thread!");
+	}
 }
 
 LRESULT WINAPI HookShellProc(int nCode, WPARAM wParam, LPARAM lParam)
@@ -145,113 +362,261 @@ LRESULT WINAPI HookShellProc(int nCode, WPARAM wParam, LPARAM lParam)
 	// 1) catches 'language change' events (HSHELL_LANGUAGE)
 	// 2) ensures the correct language at the first activation of the window (e.g. if 
 	//     Alt-Tab from another window with another language)
-	if (!mainThreadId) {
-		mainThreadId = GetCurrentThreadId();
-		Log("HookShellProc sets mainThread=", GetCurrentThreadId());
+	LogHookShellEvent(nCode, wParam, lParam);
+
+	if (nCode == HSHELL_WINDOWCREATED || nCode == HSHELL_WINDOWDESTROYED) {
+		// the main thread may be changed
+		InvalidateMainThread();
 	}
-	
-	switch (nCode) {
-	case HSHELL_WINDOWACTIVATED:
-	case HSHELL_LANGUAGE:
-		if (!revertLanguageRequired && lockedLanguageHandle && GetKeyboardLayout(mainThreadId) != lockedLanguageHandle) {
-			Log("HookShellProc: Detected a need to change the input language");
-			revertLanguageRequired = true;
+
+	DWORD noThreadId = 0;
+	if (!mainThreadId.load(std::memory_order_relaxed) && mainThreadId.compare_exchange_strong(noThreadId, platform->getCurrentThreadId())) {
+		Log("HookShellProc sets mainThread=", platform->getCurrentThreadId());
+	}
+
+	HookedThread* thread = FindOwnHookedThread(platform->getCurrentThreadId());
+	if (!thread) {
+		// the hooks are being unset
+		return platform->callNextHook(nCode, wParam, lParam);
+	}
+	CountStat(thread->stats, LOCK_STAT_SHELL_CALLS);
+
+	LockStateWord state = ThreadLockState(lockState.load(std::memory_order_relaxed), thread);
+	uint32_t windowLayout = 0;
+	if (HasWindowBindings(state) && IsLocked(state)) {
+		HWND focus = platform->getFocus();
+		windowLayout = ResolveWindowLayout(thread, focus ? focus : (HWND)wParam);
+		state = WithWindowLayout(state, windowLayout);
+	}
+	TraceEvent(TRACE_SOURCE_SHELL, nCode, nCode, 0, wParam, lParam, state);
+
+	uint32_t currentLayout = HKLToLayout(platform->getKeyboardLayout(0));
+	if ((nCode == HSHELL_LANGUAGE || nCode == HSHELL_WINDOWACTIVATED) && IsPermittedSwitch(state, windowLayout, currentLayout)) {
+		state = AdoptPermittedLayout(thread, currentLayout);
+	}
+	int actions = DecideOnShellEvent(state, nCode, currentLayout);
+	if (actions & HOOK_ACTION_REQUEST_REVERT) {
+		Log("HookShellProc: Detected a need to change the input language");
+		CountStat(thread->stats, LOCK_STAT_SWITCHES_DETECTED);
+		RequestRevertInThread(thread);
+	}
+	if (nCode == HSHELL_LANGUAGE) {
+		CountStat(thread->stats, LOCK_STAT_SHELL_LANGUAGE);
+		if (!actions) {
+			CountStat(thread->stats, LOCK_STAT_SHELL_LANGUAGE_SKIPPED);
 		}
+		PublishLockStatus((HKL)lParam);
+		// the event is also sent when a new layout is loaded
+		NoteActiveLayout((HKL)lParam);
 	}
-	if (revertLanguageRequired && lockedLanguageHandle && nCode == HSHELL_WINDOWACTIVATED) {
-		// seems safe to change the language at this event
-		revertLanguageRequired = false;
-		Log("HookShellProc: revert the input language to ", lockedLanguageHandle);
-		SetInputLanguage(lockedLanguageHandle);
+	if (actions & HOOK_ACTION_REVERT) {
+		if (IsRevertSafeAt(REVERT_CLASS_ACTIVATION)) {
+			HKL revertLang = TakeLanguageRevert(thread, windowLayout);
+			if (revertLang) {
+				Log("HookShellProc: revert the input language to ", revertLang);
+				RevertInputLanguage(thread, revertLang, REVERT_CLASS_ACTIVATION);
+			}
+		}
+		else {
+			CountStat(thread->stats, LOCK_STAT_REVERTS_DEFERRED);
+		}
 	}
 
-	return CallNextHookEx(NULL, nCode, wParam, lParam);
+	return platform->callNextHook(nCode, wParam, lParam);
+}
+
+// WM_INPUTLANGCHANGEREQUEST and WM_INPUTLANGCHANGE are checked by a single comparison in the fast path below
+static_assert(WM_INPUTLANGCHANGE == WM_INPUTLANGCHANGEREQUEST + 1, "Unexpected values of WM_INPUTLANGCHANGE* messages");
+
+// lock-logic.h duplicates the codes of the messages and events
+static_assert(MSG_DESTROY == WM_DESTROY && MSG_INPUTLANGCHANGEREQUEST == WM_INPUTLANGCHANGEREQUEST
+	&& MSG_INPUTLANGCHANGE == WM_INPUTLANGCHANGE, "Unexpected values of window messages in lock-logic.h");
+// WM_KEYLAST and WM_MOUSELAST depend on the target Windows version, the ranges in lock-logic.h are the widest ones
+static_assert(MSG_PAINT == WM_PAINT && MSG_TIMER == WM_TIMER && MSG_KEYFIRST == WM_KEYFIRST && MSG_KEYLAST >= WM_KEYLAST
+	&& MSG_MOUSEFIRST == WM_MOUSEFIRST && MSG_MOUSELAST >= WM_MOUSELAST, "Unexpected values of window messages in lock-logic.h");
+static_assert(SHELL_WINDOWACTIVATED == HSHELL_WINDOWACTIVATED && SHELL_LANGUAGE == HSHELL_LANGUAGE,
+	"Unexpected values of shell events in lock-logic.h");
+
+inline bool IsKeyDownMessage(UINT message) {
+	return message == WM_KEYDOWN || message == WM_SYSKEYDOWN;
 }
 
 LRESULT WINAPI HookGetMsgProc(int nCode, WPARAM wParam, LPARAM lParam)
 {
-	if (!mainThreadId) {
-		mainThreadId = GetCurrentThreadId();
-		Log("HookGetMsgProc sets mainThread=", GetCurrentThreadId());
+	LogHookMessage(nCode, (PMSG)lParam);
+
+	// Fast path, for the most of messages: while the language is locked and no revert is pending in any
+	// thread, only the input language messages are of interest, and the key presses if some windows
+	// have their own locked languages. Neither the thread is looked up, nor the message is counted
+	LockStateWord state = lockState.load(std::memory_order_relaxed);
+	UINT message = ((PMSG)lParam)->message;
+	if (IsLockedIdle(state) && nCode >= 0 &&
+			(UINT)(message - WM_INPUTLANGCHANGEREQUEST) > WM_INPUTLANGCHANGE - WM_INPUTLANGCHANGEREQUEST &&
+			!(HasWindowBindings(state) && IsKeyDownMessage(message))) {
+		return platform->callNextHook(nCode, wParam, lParam);
+	}
+
+	HookedThread* thread = FindOwnHookedThread(platform->getCurrentThreadId());
+	if (!thread) {
+		// the hooks are being unset
+		return platform->callNextHook(nCode, wParam, lParam);
+	}
+	CountStat(thread->stats, LOCK_STAT_GETMSG_CALLS);
+	state = ThreadLockState(state, thread);
+
+	DWORD noThreadId = 0;
+	if (!mainThreadId.load(std::memory_order_relaxed) && mainThreadId.compare_exchange_strong(noThreadId, platform->getCurrentThreadId())) {
+		Log("HookGetMsgProc sets mainThread=", platform->getCurrentThreadId());
 	}
 	
 	PMSG pmsg = (PMSG)lParam;
+	uint32_t windowLayout = 0;
+	if (HasWindowBindings(state) && IsLocked(state) && nCode >= 0) {
+		// the key messages are posted to the focused window
+		windowLayout = ResolveWindowLayout(thread, IsKeyDownMessage(message) ? pmsg->hwnd : platform->getFocus());
+		state = WithWindowLayout(state, windowLayout);
+	}
+	TraceEvent(TRACE_SOURCE_GETMSG, nCode, pmsg->message, 0, pmsg->wParam, pmsg->lParam, state);
 
-	// uncomment for more debug information, but only in DEBUG mode!
-	// logfile << "HookGetMsgProc(): " << findMessageName(pmsg->message) << std::endl;
+	if (nCode < 0) { // do not process message 
+		CountStat(thread->stats, LOCK_STAT_GETMSG_SKIPPED);
+		return platform->callNextHook(nCode, wParam, lParam);
+	}
+	if (message == WM_INPUTLANGCHANGEREQUEST || message == WM_INPUTLANGCHANGE) {
+		CountStat(thread->stats, LOCK_STAT_GETMSG_LANGUAGE);
+	}
+	else if (IsKeyDownMessage(message)) {
+		CountStat(thread->stats, LOCK_STAT_GETMSG_KEYDOWN);
+	}
 
-	if (nCode < 0)  // do not process message 
-		return CallNextHookEx(NULL, nCode, wParam, lParam);
+	RevertClass revertClass = IsRevertDeadlineMessage(thread, pmsg) ? REVERT_CLASS_DEADLINE : RevertClassOf(message);
+	if (HasWindowBindings(state) && IsKeyDownMessage(message) && IsLocked(state) && !IsRevertRequired(state)
+			&& HKLToLayout(platform->getKeyboardLayout(0)) != LockedLayoutOf(state)) {
+		// the focus is moved to a window with another locked language, switch before the key is translated
+		RequestLanguageRevert(thread);
+		state |= LOCK_STATE_REVERT_REQUIRED;
+		revertClass = REVERT_CLASS_DEADLINE;
+	}
 
-	switch (pmsg->message) {
-	// before Windows XP, this message was sent before language switch, so it could be 
-	// used for blocking switches. But, it does not work anymore, and left only as a 
-	// reference
-	case WM_INPUTLANGCHANGEREQUEST:
-		if (!revertLanguageRequired) {
-			Log("HookGetMsgProc: Input Language switch blocked in WM_INPUTLANGCHANGEREQUEST");
-			pmsg->message = WM_NULL;
+	if (message == WM_INPUTLANGCHANGE && IsPermittedSwitch(state, windowLayout, HKLToLayout((HKL)pmsg->lParam))) {
+		state = AdoptPermittedLayout(thread, HKLToLayout((HKL)pmsg->lParam));
+	}
+	int actions = DecideOnMessage(state, pmsg->message, HKLToLayout((HKL)pmsg->lParam));
+	if (actions & HOOK_ACTION_BLOCK_SWITCH) {
+		Log("HookGetMsgProc: Input Language switch blocked in WM_INPUTLANGCHANGEREQUEST");
+		pmsg->message = WM_NULL;
+		CountStat(thread->stats, LOCK_STAT_SWITCHES_BLOCKED);
+	}
+	if (actions & HOOK_ACTION_REQUEST_REVERT) {
+		CountStat(thread->stats, LOCK_STAT_SWITCHES_DETECTED);
+		RequestRevertInThread(thread);
+		Log("HookGetMsgProc(WM_INPUTLANGCHANGE): Detected a need to change the input language");
+	}
+	if (message == WM_INPUTLANGCHANGE) {
+		PublishLockStatus((HKL)pmsg->lParam);
+		NoteActiveLayout((HKL)pmsg->lParam);
+	}
+	if (actions & HOOK_ACTION_REVERT) {
+		if (IsRevertSafeAt(revertClass)) {
+			HKL revertLang = TakeLanguageRevert(thread, windowLayout);
+			if (revertLang) {
+				Log("HookGetMsgProc: revert the input language to ", revertLang);
+				RevertInputLanguage(thread, revertLang, revertClass);
+			}
 		}
-		break;
+		else {
+			CountStat(thread->stats, LOCK_STAT_REVERTS_DEFERRED);
+		}
+	}
 
-	// list of messages which shall not be used for reverting languages
-	case WM_DESTROY:
-		break;
+	return platform->callNextHook(nCode, wParam, lParam);
+}
 
-	case WM_INPUTLANGCHANGE:
-		// NOTE: In Windows 8, this message may be not sent to hooks in some cases. So, other detectors (like "sink" or "shell hook")
-		//       are required too
 
-		// failed to block language change, check if need to be reverted in future
-		if (!revertLanguageRequired && lockedLanguageHandle && (HKL)pmsg->lParam != lockedLanguageHandle) {
-			revertLanguageRequired = true;
-			Log("HookGetMsgProc(WM_INPUTLANGCHANGE): Detected a need to change the input language");
+static void SetThreadHooks(DWORD threadId) {
+	HookedThread* thread = AddHookedThread(threadId);
+	if (!thread) {
+		Log("Too many GUI threads, the hooks are not set for thread ", threadId);
+		return;
+	}
+
+	if (!thread->messagesHook) {
+		thread->messagesHook = platform->setWindowsHook(WH_GETMESSAGE, HookGetMsgProc, threadId);
+		if (thread->messagesHook == NULL) {
+			DWORD error = GetLastError();
+			Log("Failed to set message hook", error);
+			PublishLockError(error);
+			PostLockEvent(LOCK_EVENT_HOOK_FAILED, threadId, 0, error);
 		}
-		// NOTE: cannot change language here, as system will change it again (resulting in infintie loop)
-		break;
-
-	default:
-		// other messages seems fine for language changes
-		// if some message will be causing errors, they need to be added to list above
-		if (revertLanguageRequired) {
-			revertLanguageRequired = false;
-			Log("HookGetMsgProc: revert the input language to ", lockedLanguageHandle);
-			SetInputLanguage(lockedLanguageHandle);
+		Log("Message hook set for thread ", threadId);
+	}
+
+	if (!thread->shellHook) {
+		thread->shellHook = platform->setWindowsHook(WH_SHELL, HookShellProc, threadId);
+		if (thread->shellHook == NULL) {
+			DWORD error = GetLastError();
+			Log("Failed to set shell hook", error);
+			PublishLockError(error);
+			PostLockEvent(LOCK_EVENT_HOOK_FAILED, threadId, 0, error);
 		}
+		Log("Shell hook set for thread ", threadId);
 	}
 
-	return CallNextHookEx(NULL, nCode, wParam, lParam);
+	if (keyRemapEnabled && !thread->keyboardHook) {
+		thread->keyboardHook = platform->setWindowsHook(WH_KEYBOARD, HookKeyboardProc, threadId);
+		if (thread->keyboardHook == NULL) {
+			// the remapping is optional, so the failure is only logged
+			Log("Failed to set keyboard hook", GetLastError());
+		}
+	}
 }
 
-
 void SetWndHooksEnabled(bool enabled) {
-	if (!mainThreadId) {
-		DetectMainThread();
-	}
 	if (enabled) {
-		if (!messagesHook) {
-			messagesHook = SetWindowsHookEx(WH_GETMESSAGE, HookGetMsgProc, module, mainThreadId);
-			Log("Message hook set for thread ", mainThreadId);
+		if (hookedThreadsCount) {
+			return;
 		}
-
-		if (!shellHook) {
-			shellHook = SetWindowsHookEx(WH_SHELL, HookShellProc, module, mainThreadId);
-			if (shellHook == NULL) {
-				Log("Failed to set shell hook", GetLastError());
-			}
-			Log("Shell hook set for thread ", mainThreadId);
+		DetectMainThread();
+		PrepareKeyRemap();
+		CompileWindowRules();
+
+		// hook all threads with visible windows, like floating tool windows or detached editors, in one batch
+		DWORD threadIds[MAX_HOOKED_THREADS];
+		int count = FindWindowThreads(threadIds, MAX_HOOKED_THREADS);
+		DWORD mainId = mainThreadId;
+		bool mainFound = false;
+		for (int i = 0; i < count; i++) {
+			mainFound |= threadIds[i] == mainId;
+			SetThreadHooks(threadIds[i]);
+		}
+		if (!mainFound) {
+			// '0' means the current thread
+			SetThreadHooks(mainId ? mainId : platform->getCurrentThreadId());
 		}
 	}
 	else {
-		if (messagesHook) {
-			UnhookWindowsHookEx(messagesHook);
-			messagesHook = NULL;
-			Log("Message hook unset");
+		for (int slot = 0; slot < HOOKED_THREADS_SLOTS; slot++) {
+			if (!hookedThreadIds[slot].load(std::memory_order_relaxed)) {
+				continue;
+			}
+			HookedThread& thread = hookedThreads[slot];
+			if (thread.messagesHook) {
+				platform->unhookWindowsHook(thread.messagesHook);
+				thread.messagesHook = NULL;
+			}
+			if (thread.shellHook) {
+				platform->unhookWindowsHook(thread.shellHook);
+				thread.shellHook = NULL;
+			}
+			if (thread.keyboardHook) {
+				// the keys still buffered are dropped, like the pending revert
+				platform->unhookWindowsHook(thread.keyboardHook);
+				thread.keyboardHook = NULL;
+			}
 		}
-		if (shellHook) {
-			UnhookWindowsHookEx(shellHook);
-			shellHook = NULL;
-			Log("Shell hook unset");
+		if (hookedThreadsCount) {
+			Log("Hooks unset, threads: ", (DWORD)hookedThreadsCount);
 		}
+		ClearHookedThreads();
 	}
 }
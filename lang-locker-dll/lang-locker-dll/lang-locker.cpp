@@ -4,139 +4,251 @@
 
 #include "stdafx.h"
 #include "lang-locker.h"
+#include "platform.h"
+#include "lock-logic.h"
+#include "trace.h"
+#include "window-locks.h"
+#include "window-rules.h"
+#include "lock-status.h"
+#include "lock-commands.h"
+#include "shared-lock.h"
+#include "permitted-layouts.h"
+#include "lock-state-file.h"
 
 using namespace std;
 
-#ifdef _DEBUG
-
-std::ofstream logfile;
-
-void Log(const char* str) {
-	logfile << str << endl;
-}
-
-void Log(const wchar_t* str) {
-	logfile << str << endl;
-}
-
-void Log(const char* str, HANDLE param) {
-	logfile << str << "0x" << hex << uppercase << param << endl;
-}
-
-void Log(const char* str, DWORD param) {
-	logfile << str << "0x" << hex << uppercase << param << endl;
-}
-
-
-#else 
-void Log(const char* str) {}
-void Log(const wchar_t* str) {}
-void Log(const char* str, HANDLE param) {}
-void Log(const char* str, DWORD param) {}
-#endif
-
-LANGLOCKERDLL_API HKL LockInputLanguage(HKL langHandle) {
-	if (!uiThreadId) {
-		uiThreadId = GetCurrentThreadId();
+static HKL TryLockInputLanguage(HKL langHandle) {
+	DWORD callerThreadId = platform->getCurrentThreadId();
+	if (uiThreadId != callerThreadId) {
+		uiThreadId = callerThreadId;
 		Log("UI thread detected: ", uiThreadId);
 	}
-	if (!mainThreadId) {
-		DetectMainThread();
-	}
+	// the detection result is cached, so it is cheap to check whether the main thread is changed
+	DetectMainThread();
 
-	HKL curLang = GetKeyboardLayout(mainThreadId);
+	HKL curLang = platform->getKeyboardLayout(mainThreadId);
 
 	Log("LockInputLanguage(), curLang=", curLang);
-	bool success = false;
 
-	if (!lockedLanguageHandle) {
-		if (!langHandle) {
-			langHandle = curLang;
-		}
+	if (langHandle && langHandle != curLang && !IsLayoutInstalled(langHandle)) {
+		// fail fast, without a visible attempt to activate it
+		Log("The requested language is not installed ", langHandle);
+		PublishLockError(ERROR_INVALID_PARAMETER);
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return GetLockedLanguage();
+	}
 
-		if (langHandle != curLang) {
-			// try to switch to the specified language
-			if (!SetInputLanguage(langHandle)) {
-				Log("Failed to switch to the requested language ", langHandle);
-				return 0;
+	HKL lockedLang = GetLockedLanguage();
+	if (!lockedLang && !langHandle) {
+		langHandle = curLang;
+	}
+	LockTrigger trigger = lockedLang ? TRIGGER_CHANGE : mainThreadId != uiThreadId ? TRIGGER_LOCK_FROM_UI : TRIGGER_LOCK;
+	LockTransition transition = LockTransitionOf(LockPhaseOf(lockState.load()), trigger, langHandle && langHandle != curLang);
+
+	if (transition.actions & LOCK_ACTION_SET_LANGUAGE) {
+		if (lockedLang) {
+			// already locked, but for another language. Change the lock first, so that the hooks do not revert it
+			Log("Requested change of locked language to ", langHandle);
+			SetLockedLanguage(langHandle);
+		}
+		if (!SetInputLanguage(langHandle)) {
+			Log("Failed to switch to the requested language ", langHandle);
+			if (lockedLang) {
+				// revert
+				SetLockedLanguage(lockedLang);
+				SetInputLanguage(lockedLang);
 			}
+			return lockedLang;
 		}
+	}
 
-		lockedLanguageHandle = langHandle;
+	if (transition.actions & LOCK_ACTION_SET_HOOKS) {
+		SetLockedLanguage(langHandle);
 		SetWndHooksEnabled(true);
+	}
 
-		if (langHandle == curLang && mainThreadId != uiThreadId) {
-			// already was at the needed language. Unfortunately, in IDEA & Win10 it causes the problem - the next manual switch is reported 
-			//  to neither MsgProc nor ShellProc, so it is not detected, not prevented and not reverted. Thus it causes the following bug:
-			//  - get a system with two languages installed (e.g. English and Russian)
-			//  - unlock language (or start IDEA with no lock)
-			//  - switch language
-			//  - lock language
-			//  - then try to switch languages again several times. In most cases, the system allows one switch to "incorrect" language and 
-			//     one switch back to "correct" one, and only then the "correct" language is actually "locked".
-
-			//  There is no such problem for Eclipse, probably because its UI thread (EventQueue) is the same as main window thread, i.e. "mainThreadId == uiThreadId"
-			//  For IDEA, these threads are different, the manual switches changes language (as per GetKeyboardLayout(threadId)) for the UI thread but not 
-			//  for the main thread, so Windows (under some additional conditions that are not quite clear yet) "skips" these events to hooks (which are in main 
-			//  thread) as if its langauge is not changed .
-
-			// I have found two possible solutions:
-			// 1) (BAD!) Set hooks from the very start of the DLL and keep them until unloaded; that helps for all locks except the first one.
-			// 2) (GOOD! paradoxical but working!) During a lock from UI thread, set ANOTHER language and rely on hooks to change it to the requested one.
-			// The solution (2) is implemented below
-
-			HKL langs[2]; // we need only 2 different languages
-			int langsCount = GetKeyboardLayoutList(2, langs);
-
-			// pre-switch to another language to avoid missing HSHELL_LANGUAGE on further switches
-			HKL otherLang = 0;
-			for (int i = 0; i < langsCount; i++) {
-				if (langHandle != langs[i]) {
-					otherLang = langs[i];
-					break;
-				}
-			}
-			if (otherLang) { // may be missing if only 1 langauge is currently installed!
-				Log("Temporary switch to another language! ", otherLang);
-				ActivateKeyboardLayout(otherLang, KLF_ACTIVATE | KLF_SUBSTITUTE_OK | KLF_SETFORPROCESS);
-				revertLanguageRequired = true; // not actually required, but may be useful for faster switching to the correct language
-			}
-		}
-		else if (langHandle == curLang && mainThreadId == uiThreadId) {
-			// not sure why, but Eclipse require repeated setting of input language
-			SetInputLanguage(langHandle);
+	if (transition.actions & LOCK_ACTION_PRE_SWITCH) {
+		// already was at the needed language. Unfortunately, in IDEA & Win10 it causes the problem - the next manual switch is reported 
+		//  to neither MsgProc nor ShellProc, so it is not detected, not prevented and not reverted. Thus it causes the following bug:
+		//  - get a system with two languages installed (e.g. English and Russian)
+		//  - unlock language (or start IDEA with no lock)
+		//  - switch language
+		//  - lock language
+		//  - then try to switch languages again several times. In most cases, the system allows one switch to "incorrect" language and 
+		//     one switch back to "correct" one, and only then the "correct" language is actually "locked".
+
+		//  There is no such problem for Eclipse, probably because its UI thread (EventQueue) is the same as main window thread, i.e. "mainThreadId == uiThreadId"
+		//  For IDEA, these threads are different, the manual switches changes language (as per GetKeyboardLayout(threadId)) for the UI thread but not 
+		//  for the main thread, so Windows (under some additional conditions that are not quite clear yet) "skips" these events to hooks (which are in main 
+		//  thread) as if its langauge is not changed .
+
+		// I have found two possible solutions:
+		// 1) (BAD!) Set hooks from the very start of the DLL and keep them until unloaded; that helps for all locks except the first one.
+		// 2) (GOOD! paradoxical but working!) During a lock from UI thread, set ANOTHER language and rely on hooks to change it to the requested one.
+		// The solution (2) is implemented below
+
+		// pre-switch to another language to avoid missing HSHELL_LANGUAGE on further switches
+		HKL otherLang = FindOtherLayout(langHandle);
+		if (otherLang) { // may be missing if only 1 langauge is currently installed!
+			Log("Temporary switch to another language! ", otherLang);
+			platform->activateKeyboardLayout(otherLang, KLF_ACTIVATE | KLF_SUBSTITUTE_OK | KLF_SETFORPROCESS);
+			RequestLanguageRevert(FindHookedThread(mainThreadId)); // not actually required, but may be useful for faster switching to the correct language
 		}
+	}
 
-		Log("Input language locked to ", lockedLanguageHandle);
+	if (transition.actions & LOCK_ACTION_REPEAT_LANGUAGE) {
+		// not sure why, but Eclipse require repeated setting of input language
+		SetInputLanguage(langHandle);
+	}
+
+	if (transition.actions & LOCK_ACTION_SET_HOOKS) {
+		Log("Input language locked to ", langHandle);
 
 		// NOTE: if the windows is not active, SetInputLanguge() is actually ignored by Windows, with a fake "success" result.
 		// So, we cannot rely only on the code above, but also needs a way to catch WM_ACTIVATE and check the current language there
+	}
 
-	} else if (langHandle != 0 && langHandle != curLang) {
-		Log("Requested change of locked language to ", langHandle);
+	return langHandle;
+}
 
-		// already locked, but for another language. Try to change it
-		HKL prevLockedLang = lockedLanguageHandle;
-		lockedLanguageHandle = langHandle;
+HKL LockInputLanguageLocally(HKL langHandle) {
+	HKL lockedLang = TryLockInputLanguage(langHandle);
+	TraceEvent(TRACE_SOURCE_LOCK, 0, 0, HKLToLayout(lockedLang), mainThreadId, (LPARAM)langHandle, lockState.load(std::memory_order_relaxed));
+	PublishLockStatus(platform->getKeyboardLayout(mainThreadId));
+	return lockedLang;
+}
 
-		if (!SetInputLanguage(langHandle)) {
-			Log("Failed to switch to the requested language ", langHandle);
+void UnlockInputLanguageLocally() {
+	LockTransition transition = LockTransitionOf(LockPhaseOf(lockState.load()), TRIGGER_UNLOCK, false);
+	if (transition.actions & LOCK_ACTION_UNSET_HOOKS) {
+		SetWndHooksEnabled(false);
+		SetLockedLanguage(NULL);
+		SetPermittedLayouts(NULL, 0, 0);
+		Log("Input language unlocked");
+		TraceEvent(TRACE_SOURCE_UNLOCK, 0, 0, 0, 0, 0, lockState.load(std::memory_order_relaxed));
+		PublishLockStatus(0);
+	}
+}
 
-			// revert
-			lockedLanguageHandle = prevLockedLang;
-			SetInputLanguage(prevLockedLang);
+// Locks the language and publishes the lock to the other instances, if enabled
+static HKL LockAndShareInputLanguage(HKL langHandle) {
+	HKL lockedLang = LockInputLanguageLocally(langHandle);
+	if (IsSharedLockEnabled() && lockedLang) {
+		PublishSharedLock(lockedLang);
+		// watch the changes made by other instances
+		StartLockCommands();
+	}
+	return lockedLang;
+}
 
-			return prevLockedLang;
-		}
+LANGLOCKERDLL_API HKL LockInputLanguage(HKL langHandle) {
+	EnsureInitialized();
+	LockApiGuard guard;
+	CancelLockRestore();
+	SetPermittedLayouts(NULL, 0, 0);
+	HKL lockedLang = LockAndShareInputLanguage(langHandle);
+	PersistLockState();
+	return lockedLang;
+}
+
+LANGLOCKERDLL_API HKL LockInputLanguageSet(const HKL* languageHandles, int count, LANGID primaryLanguage) {
+	EnsureInitialized();
+	LockApiGuard guard;
+	CancelLockRestore();
+	if (count < 0 || (count && !languageHandles) || (!count && !primaryLanguage)) {
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return 0;
+	}
+	if (!SetPermittedLayouts(languageHandles, count, primaryLanguage)) {
+		Log("Too many permitted languages, some are ignored");
 	}
 
-	return langHandle;
+	// keep the current language if permitted
+	DetectMainThread();
+	HKL langHandle = FindPermittedLayout(platform->getKeyboardLayout(mainThreadId));
+	if (!langHandle) {
+		Log("None of the permitted languages is installed");
+		SetPermittedLayouts(NULL, 0, 0);
+		PublishLockError(ERROR_INVALID_PARAMETER);
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return GetLockedLanguage();
+	}
+	// NOTE: the other instances get the single locked language
+	HKL lockedLang = LockAndShareInputLanguage(langHandle);
+	PersistLockState();
+	return lockedLang;
 }
 
 LANGLOCKERDLL_API void UnlockInputLanguage() {
-	if (lockedLanguageHandle) {
-		SetWndHooksEnabled(false);
-		lockedLanguageHandle = NULL;
-		Log("Input language unlocked");
+	EnsureInitialized();
+	LockApiGuard guard;
+	CancelLockRestore();
+	UnlockInputLanguageLocally();
+	PersistLockState();
+	if (IsSharedLockEnabled()) {
+		PublishSharedLock(0);
+		StartLockCommands();
+	}
+}
+
+void ApplySharedLock(HKL languageHandle) {
+	LockApiGuard guard;
+	Log("Applying the shared lock state: ", languageHandle);
+	CancelLockRestore();
+	if (languageHandle) {
+		SetPermittedLayouts(NULL, 0, 0);
+		LockInputLanguageLocally(languageHandle);
+	}
+	else {
+		UnlockInputLanguageLocally();
+	}
+	PersistLockState();
+}
+
+LANGLOCKERDLL_API BOOL LockWindowInputLanguage(HWND hwnd, HKL languageHandle) {
+	EnsureInitialized();
+	LockApiGuard guard;
+	if (!hwnd || !languageHandle) {
+		return FALSE;
+	}
+	if (!SetWindowLockLayout(hwnd, HKLToLayout(languageHandle))) {
+		Log("Too many windows with locked languages, failed to lock for window ", hwnd);
+		return FALSE;
+	}
+	SetWindowBindingsFlag(true);
+	Log("Input language locked for window ", hwnd);
+	return TRUE;
+}
+
+LANGLOCKERDLL_API void UnlockWindowInputLanguage(HWND hwnd) {
+	EnsureInitialized();
+	LockApiGuard guard;
+	if (hwnd && SetWindowLockLayout(hwnd, 0)) {
+		SetWindowBindingsFlag(windowLocksCount != 0 || windowRulesCount != 0);
+		Log("Input language unlocked for window ", hwnd);
+	}
+}
+
+LANGLOCKERDLL_API BOOL SetWindowRules(const char* rules) {
+	EnsureInitialized();
+	LockApiGuard guard;
+	return SetWindowRulesText(rules ? rules : "") ? TRUE : FALSE;
+}
+
+LANGLOCKERDLL_API int GetInstalledLayouts(InstalledLayout* layouts, int maxCount) {
+	EnsureInitialized();
+	if (!layouts || maxCount <= 0) {
+		return 0;
+	}
+	return GetIndexedLayouts(layouts, maxCount);
+}
+
+LANGLOCKERDLL_API BOOL GetLockStatistics(LockStatistics* stats) {
+	EnsureInitialized();
+	LockApiGuard guard;
+	if (!stats || stats->size != sizeof(LockStatistics)) {
+		return FALSE;
 	}
+	CollectLockStatistics(*stats);
+	return TRUE;
 }
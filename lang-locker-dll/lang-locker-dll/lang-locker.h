@@ -2,15 +2,24 @@
  * lang-locker.h : declaration of exported lock/unlock functions and common internally used stuff.
  */
 
-#ifdef LANGLOCKERDLL_EXPORTS
+#pragma once
+
+#include "lock-state.h"
+#include "hooked-threads.h"
+#include "layout-index.h"
+
+#ifndef _WIN32
+// the portable build links the lock logic statically
+#define LANGLOCKERDLL_API extern "C"
+#elif defined(LANGLOCKERDLL_EXPORTS)
 #define LANGLOCKERDLL_API extern "C" __declspec(dllexport)
 #else
 #define LANGLOCKERDLL_API extern "C" __declspec(dllimport)
 #endif
 
 //
-// The pair of exported functions below is intended for non-Java programs.
-// Java programs shall use JNI versions declared in com_gilecode_langlocker_LockEngine.h
+// The exported functions below are intended for non-Java programs.
+// Java programs shall use JNI versions registered in JNILockEngine.cpp
 //
 
 /*
@@ -23,46 +32,185 @@
  */
 LANGLOCKERDLL_API HKL LockInputLanguage(HKL languageHandle);
 
+/*
+ * Like LockInputLanguage(), but permits the switches between the specified languages, and all languages with the
+ * specified primary language (if not 0), e.g. LANG_ENGLISH. The switches to other languages are reverted to the
+ * most recently used permitted one. The current language is kept if permitted, otherwise the first installed
+ * permitted language is activated.
+ *
+ * Returns the handle of the current locked input language, or 0 if failed to lock.
+ */
+LANGLOCKERDLL_API HKL LockInputLanguageSet(const HKL* languageHandles, int count, LANGID primaryLanguage);
+
 /*
  * Unblocks previously blocked input language switches.
  */
 LANGLOCKERDLL_API void UnlockInputLanguage();
 
+/*
+ * Locks the specified input language for the window (either top-level or child) and its child windows.
+ * While the input language is locked by LockInputLanguage(), this language is used instead of the
+ * process-wide locked one when the focus is in that window.
+ *
+ * Returns whether succeeded. Fails if too many windows have locked input languages.
+ */
+LANGLOCKERDLL_API BOOL LockWindowInputLanguage(HWND hwnd, HKL languageHandle);
+
+/*
+ * Removes the input language locked for the window, so that the process-wide locked one is used for it.
+ */
+LANGLOCKERDLL_API void UnlockWindowInputLanguage(HWND hwnd);
+
+/*
+ * Sets the rules which select the locking policies of the windows by their classes, roles and titles, see
+ * window-rules.h for the syntax. The rules are applied at the next LockInputLanguage() while unlocked.
+ * An empty text removes the rules.
+ *
+ * Returns whether all rules are valid. The invalid ones are skipped.
+ */
+LANGLOCKERDLL_API BOOL SetWindowRules(const char* rules);
+
+/*
+ * Fills the statistics of the hooks collected since the DLL is loaded, see lock-stats.h.
+ * The caller shall set stats->size to sizeof(LockStatistics).
+ *
+ * Returns whether succeeded. Fails if the size is not supported.
+ */
+LANGLOCKERDLL_API BOOL GetLockStatistics(LockStatistics* stats);
+
+/*
+ * Fills up to maxCount installed keyboard layouts, with their languages, see layout-index.h.
+ *
+ * Returns the number of the filled layouts.
+ */
+LANGLOCKERDLL_API int GetInstalledLayouts(InstalledLayout* layouts, int maxCount);
+
 //
-// Functions which shall be invoked at start and end of DLL lifecycle.
+// Functions which shall be invoked at start and end of DLL lifecycle. The DLL is initialized lazily, by
+// EnsureInitialized() called from each export, and cleaned up at the process detach.
 // 
 void Init();
+void EnsureInitialized();
+bool IsInitialized();
 void Cleanup();
 
+//
+// The lock functions may be called concurrently: from the UI thread, on the main thread by the command hook, and
+// by the restore of the persisted lock. So they are serialized by a (recursive) critical section, which is entered
+// by LockApiGuard. The hooks never enter it: they share the state with the lock functions by atomics only.
+//
+void EnterLockApi();
+void LeaveLockApi();
+
+class LockApiGuard {
+public:
+	LockApiGuard() {
+		EnterLockApi();
+	}
+	~LockApiGuard() {
+		LeaveLockApi();
+	}
+	LockApiGuard(const LockApiGuard&) = delete;
+	LockApiGuard& operator=(const LockApiGuard&) = delete;
+};
+
 //
 // Debug logging used throughout the lang-locker DLL code.
-// In 'Debug' configuration, the logs are written into langlocker.log file
-// created in the current application working directory. In 'Release' - does 
-// nothing.
-// 
+// The logs are written into lang-locker-<PID>.log file created in the current application working
+// directory. The records are formatted on the calling thread and written by a background thread, see
+// logger.cpp.
+//
+// LANGLOCKER_LOG_LEVEL defines which logging is compiled in. By default, it is LOG_LEVEL_INFO in 'Debug'
+// configuration, and LOG_LEVEL_NONE in 'Release', where the logging functions are empty and inlined.
+// LOG_LEVEL_TRACE additionally logs every message and event got by the hooks, with the decoded parameters.
+//
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_TRACE 2
+
+#ifndef LANGLOCKER_LOG_LEVEL
+#ifdef _DEBUG
+#define LANGLOCKER_LOG_LEVEL LOG_LEVEL_INFO
+#else
+#define LANGLOCKER_LOG_LEVEL LOG_LEVEL_NONE
+#endif
+#endif
+
+#if LANGLOCKER_LOG_LEVEL > LOG_LEVEL_NONE
+void InitLog();
+void CloseLog();
 void Log(const char* str);
 void Log(const char* str, HANDLE param);
 void Log(const char* str, DWORD param);
 void Log(const wchar_t* str);
-
-#ifdef _DEBUG
-extern std::ofstream logfile;
+#else
+inline void InitLog() {}
+inline void CloseLog() {}
+inline void Log(const char* str) {}
+inline void Log(const char* str, HANDLE param) {}
+inline void Log(const char* str, DWORD param) {}
+inline void Log(const wchar_t* str) {}
 #endif
 
-extern HKL lockedLanguageHandle;
+extern std::atomic<LockStateWord> lockState;
 extern HMODULE module;
-extern DWORD mainThreadId;
-extern DWORD uiThreadId;
-extern bool revertLanguageRequired;
+extern std::atomic<DWORD> mainThreadId;
+extern std::atomic<DWORD> uiThreadId;
+
+// Conversions between HKL and the layout value stored in the lock state word.
+// HKL values are 32-bit even in 64-bit Windows, where they are sign-extended.
+inline uint32_t HKLToLayout(HKL languageHandle) {
+	return (uint32_t)(ULONG_PTR)languageHandle;
+}
+
+inline HKL LayoutToHKL(uint32_t layout) {
+	return (HKL)(LONG_PTR)(LONG)layout;
+}
+
+// Returns the currently locked input language, or 0 if not locked
+inline HKL GetLockedLanguage() {
+	return LayoutToHKL(LockedLayoutOf(lockState.load(std::memory_order_relaxed)));
+}
+
+// LockInputLanguage() and UnlockInputLanguage() without publishing the shared lock state, see shared-lock.h
+HKL LockInputLanguageLocally(HKL languageHandle);
+void UnlockInputLanguageLocally();
+
+// Applies the lock state published by another IDE instance
+void ApplySharedLock(HKL languageHandle);
+
+// Changes the locked input language (0 means "not locked"), and resets the "revert required" flag
+void SetLockedLanguage(HKL languageHandle);
+
+// Sets "revert required" flag for the hooked thread, if locked. Returns whether the flag was changed by this call
+bool RequestLanguageRevert(HookedThread* thread);
+
+// Resets "revert required" flag for the hooked thread and returns the language to revert to, or 0 if the revert
+// is not required. The language is the one locked for the focused window (windowLayout), if any
+HKL TakeLanguageRevert(HookedThread* thread, uint32_t windowLayout);
+
+// Sets or resets "window bindings" flag of the lock state
+void SetWindowBindingsFlag(bool hasBindings);
+
+// The lock state as seen by the hooked thread, i.e. with its own "revert required" flag
+inline LockStateWord ThreadLockState(LockStateWord state, const HookedThread* thread) {
+	return (state & ~LOCK_STATE_REVERT_REQUIRED)
+		| (thread->revertPending.load(std::memory_order_relaxed) ? LOCK_STATE_REVERT_REQUIRED : 0);
+}
 
 // 
 // Implementation methods which enables or disables messages hooks 
-// which provide control over input languages switches
+// which provide control over input languages switches. The hooks are set for all GUI threads at once
 //
 void SetWndHooksEnabled(bool enabled);
 
 // Internal function used to switch current input language
 bool SetInputLanguage(HKL languageHandle);
 
-// Internal function used to detect the "main" thread, i.e. the thread with the window message loop
+// Internal function used to detect the "main" thread, i.e. the thread with the window message loop, see main-thread.h.
+// Does not change the main thread while the hooks are set
 void DetectMainThread();
+
+// Hook procedures, set for the main thread while the language is locked
+LRESULT WINAPI HookGetMsgProc(int nCode, WPARAM wParam, LPARAM lParam);
+LRESULT WINAPI HookShellProc(int nCode, WPARAM wParam, LPARAM lParam);
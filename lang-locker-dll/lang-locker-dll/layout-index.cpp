@@ -0,0 +1,135 @@
+/*
+ * layout-index.cpp : the index of the installed keyboard layouts, see layout-index.h
+ */
+
+#include "stdafx.h"
+#include "lang-locker.h"
+#include "platform.h"
+#include "layout-index.h"
+#include "lock-events.h"
+
+static std::atomic<uint32_t> indexSequence(0);
+static std::atomic<bool> indexValid(false);
+static uint32_t indexedLayouts[MAX_INSTALLED_LAYOUTS];
+static int indexedCount = 0;
+// the hash of the indexed layouts, 0 if not built yet
+static uint32_t indexHash = 0;
+
+void InvalidateLayoutIndex() {
+	indexValid.store(false, std::memory_order_release);
+}
+
+// Rebuilds the index from the system list. The writers may run in different threads, so the sequence also
+// works as a spin lock for them, like in lock-status.cpp
+static void RebuildLayoutIndex() {
+	HKL layouts[MAX_INSTALLED_LAYOUTS];
+	int count = platform->getKeyboardLayoutList(MAX_INSTALLED_LAYOUTS, layouts);
+
+	// FNV-1a of the layouts, never 0
+	uint32_t hash = 2166136261u;
+	for (int i = 0; i < count; i++) {
+		hash = (hash ^ HKLToLayout(layouts[i])) * 16777619u;
+	}
+	hash |= 1;
+
+	uint32_t seq = indexSequence.load(std::memory_order_relaxed);
+	for (;;) {
+		if (seq & 1) {
+			YieldProcessor();
+			seq = indexSequence.load(std::memory_order_relaxed);
+		}
+		else if (indexSequence.compare_exchange_weak(seq, seq + 1, std::memory_order_acquire)) {
+			break;
+		}
+	}
+	std::atomic_thread_fence(std::memory_order_release);
+	for (int i = 0; i < count; i++) {
+		indexedLayouts[i] = HKLToLayout(layouts[i]);
+	}
+	indexedCount = count;
+	uint32_t prevHash = indexHash;
+	indexHash = hash;
+	indexValid.store(true, std::memory_order_relaxed);
+	indexSequence.fetch_add(1, std::memory_order_release);
+
+	if (prevHash && prevHash != hash) {
+		Log("The list of the installed layouts is changed, count=", (DWORD)count);
+		PostLockEvent(LOCK_EVENT_LAYOUTS_CHANGED, platform->getCurrentThreadId(), 0, 0);
+	}
+}
+
+// Copies the consistent index, rebuilding it if outdated. Returns the number of the layouts
+static int ReadLayoutIndex(uint32_t* layouts) {
+	if (!indexValid.load(std::memory_order_acquire)) {
+		RebuildLayoutIndex();
+	}
+	for (;;) {
+		uint32_t seq = indexSequence.load(std::memory_order_acquire);
+		if (seq & 1) {
+			YieldProcessor();
+			continue;
+		}
+		int count = indexedCount;
+		for (int i = 0; i < count; i++) {
+			layouts[i] = indexedLayouts[i];
+		}
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (indexSequence.load(std::memory_order_relaxed) == seq) {
+			return count;
+		}
+	}
+}
+
+static bool FindLayout(const uint32_t* layouts, int count, uint32_t layout) {
+	for (int i = 0; i < count; i++) {
+		if (layouts[i] == layout) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void NoteActiveLayout(HKL languageHandle) {
+	uint32_t layouts[MAX_INSTALLED_LAYOUTS];
+	int count = ReadLayoutIndex(layouts);
+	if (languageHandle && !FindLayout(layouts, count, HKLToLayout(languageHandle))) {
+		RebuildLayoutIndex();
+	}
+}
+
+bool IsLayoutInstalled(HKL languageHandle) {
+	uint32_t layouts[MAX_INSTALLED_LAYOUTS];
+	int count = ReadLayoutIndex(layouts);
+	if (FindLayout(layouts, count, HKLToLayout(languageHandle))) {
+		return true;
+	}
+	// may be just installed
+	RebuildLayoutIndex();
+	count = ReadLayoutIndex(layouts);
+	return FindLayout(layouts, count, HKLToLayout(languageHandle));
+}
+
+HKL FindOtherLayout(HKL languageHandle) {
+	uint32_t layouts[MAX_INSTALLED_LAYOUTS];
+	int count = ReadLayoutIndex(layouts);
+	for (int i = 0; i < count; i++) {
+		if (layouts[i] != HKLToLayout(languageHandle)) {
+			return LayoutToHKL(layouts[i]);
+		}
+	}
+	return 0;
+}
+
+int GetIndexedLayouts(InstalledLayout* result, int maxCount) {
+	uint32_t layouts[MAX_INSTALLED_LAYOUTS];
+	int count = ReadLayoutIndex(layouts);
+	if (count > maxCount) {
+		count = maxCount;
+	}
+	for (int i = 0; i < count; i++) {
+		LANGID languageId = LOWORD(layouts[i]);
+		InstalledLayout layout = { (LONG_PTR)LayoutToHKL(layouts[i]), languageId, PRIMARYLANGID(languageId), 0 };
+		result[i] = layout;
+	}
+	return count;
+}
@@ -0,0 +1,36 @@
+/*
+ * layout-index.h : the index of the installed keyboard layouts.
+ *
+ * The index is built at the first use, and rebuilt only when the layouts are likely changed: a language change
+ * to a layout which is not in the index, a failed activation, or a lookup of an unknown layout. So, the lock
+ * functions validate the requested layouts and find the "other" layout without enumerating the layouts each time.
+ * The index is protected by a seqlock, as it may be rebuilt both by the UI thread and by the hooked threads.
+ */
+
+#pragma once
+
+const int MAX_INSTALLED_LAYOUTS = 64;
+
+// The installed layout, as returned by GetInstalledLayouts()
+struct InstalledLayout {
+	int64_t handle;              // HKL
+	uint16_t languageId;         // LANGID of the layout, i.e. the low word of HKL
+	uint16_t primaryLanguage;    // PRIMARYLANGID of the language, to group e.g. the English layouts of various countries
+	uint32_t reserved;
+};
+
+// Marks the index as outdated, so that it is rebuilt at the next use
+void InvalidateLayoutIndex();
+
+// Checks the layout reported by a language change. If it is not in the index, the index is rebuilt, and
+// LOCK_EVENT_LAYOUTS_CHANGED is posted if the list of the layouts is actually changed
+void NoteActiveLayout(HKL languageHandle);
+
+// Whether the layout is installed. An unknown layout is checked again after the index is rebuilt
+bool IsLayoutInstalled(HKL languageHandle);
+
+// Returns an installed layout other than the specified one, or 0 if there is only one layout
+HKL FindOtherLayout(HKL languageHandle);
+
+// Copies up to maxCount installed layouts, in the order of the system list. Returns the number of the layouts
+int GetIndexedLayouts(InstalledLayout* layouts, int maxCount);
@@ -0,0 +1,188 @@
+/*
+ * lock-commands.cpp : lock/unlock commands executed on the main thread, see lock-commands.h
+ */
+
+#include "stdafx.h"
+#include "lang-locker.h"
+#include "platform.h"
+#include "lock-commands.h"
+#include "lock-events.h"
+#include "shared-lock.h"
+#include "lock-state-file.h"
+#include "bounded-queue.h"
+
+static BoundedQueue<LockCommand, 16> lockCommands;
+
+// the thread message which wakes up the command hook
+static UINT lockCommandMessage = 0;
+
+// the hook of the thread which executes the commands, set at the first posted command
+static HHOOK commandHook = NULL;
+static DWORD commandThreadId = 0;
+static std::atomic<bool> commandHookReady(false);
+
+// whether the wakeup message is posted, but not yet received. Avoids flooding the thread queue with wakeups
+static std::atomic<bool> wakeupPosted(false);
+
+// the sequence number of the last executed command, stored before its completion event is posted
+static std::atomic<uint32_t> lastExecutedCommand(0);
+
+// the latest layout hint which is not yet applied, or 0
+static std::atomic<uint32_t> pendingHint(0);
+
+static void ExecuteLockCommand(const LockCommand& command) {
+	HKL lockedLang = 0;
+	if (command.type == LOCK_COMMAND_LOCK) {
+		lockedLang = LockInputLanguage(command.language);
+	}
+	else {
+		UnlockInputLanguage();
+	}
+	DWORD error = lockedLang || command.type == LOCK_COMMAND_UNLOCK ? 0 : GetLastError();
+	lastExecutedCommand.store(command.sequence, std::memory_order_relaxed);
+	PostLockEvent(LOCK_EVENT_COMMAND_COMPLETED, platform->getCurrentThreadId(), lockedLang, error, command.sequence);
+}
+
+uint32_t GetLastExecutedCommand() {
+	return lastExecutedCommand.load(std::memory_order_relaxed);
+}
+
+// Applies the latest layout hint, if it is still actual. The hints posted before the commands are outdated by them
+static void ApplyLayoutHint() {
+	uint32_t layout = pendingHint.exchange(0);
+	LockApiGuard guard;
+	HKL lockedLang = GetLockedLanguage();
+	if (layout && lockedLang && layout != HKLToLayout(lockedLang)) {
+		// the hints are local to this instance, so they are not shared
+		LockInputLanguageLocally(LayoutToHKL(layout));
+	}
+}
+
+static void DrainLockCommands() {
+	// the restore is cancelled by the commands posted after it, so it is applied first
+	ApplyLockRestore();
+	LockCommand command;
+	while (lockCommands.TryPop(command)) {
+		ExecuteLockCommand(command);
+	}
+	ApplyLayoutHint();
+}
+
+// The lock of another instance is applied only while this instance is active, as the layout of an inactive
+// process cannot be changed anyway
+static void CheckSharedLock() {
+	DWORD processId = 0;
+	platform->getWindowThreadProcessId(platform->getForegroundWindow(), &processId);
+	HKL language;
+	if (processId == GetCurrentProcessId() && TakeSharedLockChange(language)) {
+		ApplySharedLock(language);
+	}
+}
+
+static LRESULT WINAPI HookCommandProc(int nCode, WPARAM wParam, LPARAM lParam) {
+	PMSG pmsg = (PMSG)lParam;
+	if (nCode >= 0 && HasSharedLockChange()) {
+		CheckSharedLock();
+	}
+	if (nCode >= 0 && wParam == PM_REMOVE && pmsg->message == lockCommandMessage && pmsg->hwnd == NULL) {
+		// reset before draining, so that a command posted during the drain wakes the thread again
+		wakeupPosted.store(false);
+		DrainLockCommands();
+		pmsg->message = WM_NULL;
+	}
+	return platform->callNextHook(nCode, wParam, lParam);
+}
+
+// Sets the command hook for the main thread, once. Returns false if failed
+bool StartLockCommands() {
+	if (commandHookReady.load(std::memory_order_acquire)) {
+		return true;
+	}
+	// the main thread is detected by the lock functions, so the hook is set under their guard too
+	LockApiGuard guard;
+	if (commandHook) {
+		// set by another thread meanwhile
+		return true;
+	}
+
+	if (!lockCommandMessage) {
+		lockCommandMessage = platform->registerWindowMessage("lang-locker-command");
+	}
+	DetectMainThread();
+	DWORD mainId = mainThreadId;
+	if (lockCommandMessage && mainId) {
+		commandHook = platform->setWindowsHook(WH_GETMESSAGE, HookCommandProc, mainId);
+		if (commandHook) {
+			commandThreadId = mainId;
+			Log("Command hook set for thread ", commandThreadId);
+			commandHookReady.store(true, std::memory_order_release);
+		}
+		else {
+			Log("Failed to set command hook", GetLastError());
+		}
+	}
+	return commandHook != NULL;
+}
+
+// Posts the wakeup message, unless it is already posted
+static void WakeCommandThread() {
+	if (!wakeupPosted.exchange(true) && !platform->postThreadMessage(commandThreadId, lockCommandMessage, 0, 0)) {
+		// e.g. the thread has exited, so execute the queued commands here; they complete as usual
+		Log("Failed to wake up the command thread, error=", GetLastError());
+		wakeupPosted.store(false);
+		DrainLockCommands();
+	}
+}
+
+bool PostLockCommand(LockCommandType type, HKL language, uint32_t sequence) {
+	// the explicit command supersedes the persisted lock, even if not yet executed
+	CancelLockRestore();
+	if (!StartLockCommands()) {
+		return false;
+	}
+	LockCommand command = { (uint32_t)type, language, sequence };
+	if (!lockCommands.TryPush(command)) {
+		Log("Too many lock commands queued");
+		return false;
+	}
+	WakeCommandThread();
+	return true;
+}
+
+bool PostLayoutHint(HKL language) {
+	uint32_t layout = HKLToLayout(language);
+	LockStateWord state = lockState.load(std::memory_order_relaxed);
+	if (!layout || !IsLocked(state)) {
+		return false;
+	}
+	if (layout == LockedLayoutOf(state)) {
+		// the latest hint wins, so a pending one is not needed anymore
+		pendingHint.store(0, std::memory_order_relaxed);
+		return true;
+	}
+	if (pendingHint.exchange(layout) == layout) {
+		// coalesced with the same pending hint
+		return true;
+	}
+	if (!StartLockCommands()) {
+		pendingHint.store(0, std::memory_order_relaxed);
+		return false;
+	}
+	WakeCommandThread();
+	return true;
+}
+
+bool PostLockRestore() {
+	if (!StartLockCommands()) {
+		return false;
+	}
+	WakeCommandThread();
+	return true;
+}
+
+void StopLockCommands() {
+	if (commandHookReady.exchange(false)) {
+		platform->unhookWindowsHook(commandHook);
+		commandHook = NULL;
+	}
+}
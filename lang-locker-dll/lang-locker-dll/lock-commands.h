@@ -0,0 +1,56 @@
+/*
+ * lock-commands.h : lock/unlock commands executed on the main thread, see LockEngine.lockInputLanguageAsync().
+ *
+ * When the lock functions are called from another thread (like EventQueue of IDEA), they have to check and switch
+ * the layout of the main thread from outside, which is the source of the missed switches. Instead, the commands
+ * may be posted into a lock-free queue, which is drained on the main thread by a dedicated message hook; the hook
+ * is woken up by a registered thread message. So, all layout changes are serialized on the main thread, and the
+ * caller never blocks on the OS.
+ *
+ * The command hook also applies the lock state changed by other IDE instances, see shared-lock.h.
+ *
+ * The commands complete in the order of posting, each with LOCK_EVENT_COMMAND_COMPLETED, which carries the sequence
+ * number of the command given by the caller, and the locked language after the command (0 if unlocked or failed to
+ * lock). If the completion is dropped, the LOCK_EVENT_DROPPED which follows it carries the sequence number of the
+ * last executed command, so the commands up to it are completed, while the later ones still complete by their events.
+ *
+ * The layout hints, like the language wanted at the caret, are posted at a much higher rate, so they are not queued:
+ * only the latest hint is kept, and it is applied by the same hook at most once per turn of the message loop, by
+ * changing the locked language locally. The hints complete with no events.
+ *
+ * The hook also applies the lock persisted by the previous start (see lock-state-file.h), before any commands.
+ */
+
+#pragma once
+
+enum LockCommandType {
+	LOCK_COMMAND_LOCK = 1,     // LockInputLanguage() with the language, which also changes the locked language
+	LOCK_COMMAND_UNLOCK = 2,   // UnlockInputLanguage()
+};
+
+struct LockCommand {
+	uint32_t type;       // LockCommandType
+	HKL language;
+	uint32_t sequence;   // reported by the completion event
+};
+
+// Sets the command hook for the main thread, if not yet. Returns false if failed
+bool StartLockCommands();
+
+// Queues the command for the main thread and wakes it up. Returns false if the command cannot be queued, e.g.
+// if the main thread is not known, so the caller shall execute it synchronously
+bool PostLockCommand(LockCommandType type, HKL language, uint32_t sequence);
+
+// Returns the sequence number of the last executed command, or 0
+uint32_t GetLastExecutedCommand();
+
+// Sets the latest layout hint and wakes up the main thread, unless the hint is already locked or pending.
+// Returns false if the hint cannot be posted, e.g. if not locked, or the main thread is not known
+bool PostLayoutHint(HKL language);
+
+// Sets the command hook, if not yet, and wakes up the main thread to apply the pending restore of the persisted lock.
+// Returns false if the main thread is not known
+bool PostLockRestore();
+
+// Removes the command hook, if set
+void StopLockCommands();
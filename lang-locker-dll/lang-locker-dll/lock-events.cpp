@@ -0,0 +1,115 @@
+/*
+ * lock-events.cpp : lock events queued for the Java plugins, see lock-events.h
+ */
+
+#include "stdafx.h"
+#include "lang-locker.h"
+#include "lock-events.h"
+#include "lock-commands.h"
+#include "bounded-queue.h"
+
+static BoundedQueue<LockEvent, 256> lockEvents;
+static std::atomic<DWORD> droppedLockEvents(0);
+
+static std::atomic<bool> lockEventsStarted(false);
+static std::atomic<bool> lockEventsStopping(false);
+
+// set by the consumer before waiting for lockEventsReady, and checked by the producers, like in logger.cpp
+static std::atomic<bool> consumerSleeping(false);
+static HANDLE lockEventsReady = NULL;
+
+// the event popped from the queue, but not taken as the batch was full. Used only by the consumer
+static LockEvent pendingEvent;
+static bool hasPendingEvent = false;
+
+bool StartLockEvents() {
+	// the event is kept after the stop, so that the events may be restarted after a failed start of the consumer
+	if (!lockEventsReady) {
+		lockEventsReady = CreateEventA(NULL, FALSE, FALSE, NULL);
+		if (!lockEventsReady) {
+			return false;
+		}
+	}
+	lockEventsStopping = false;
+	lockEventsStarted.store(true, std::memory_order_release);
+	return true;
+}
+
+void StopLockEvents() {
+	lockEventsStarted.store(false, std::memory_order_release);
+	lockEventsStopping = true;
+	if (lockEventsReady) {
+		SetEvent(lockEventsReady);
+	}
+}
+
+void PostLockEvent(LockEventType type, DWORD threadId, HKL language, DWORD error, uint32_t sequence) {
+	if (!lockEventsStarted.load(std::memory_order_acquire)) {
+		return;
+	}
+	LockEvent event = { (uint32_t)type, 1, (uint32_t)threadId, (uint32_t)error, (int64_t)(LONG_PTR)language, sequence };
+	if (!lockEvents.TryPush(event)) {
+		droppedLockEvents.fetch_add(1, std::memory_order_release);
+		return;
+	}
+	// the fence orders the push above with the check below, see the paired fence in WaitLockEvents()
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (consumerSleeping.load(std::memory_order_relaxed) && consumerSleeping.exchange(false)) {
+		SetEvent(lockEventsReady);
+	}
+}
+
+static bool HasLockEvents() {
+	return hasPendingEvent || !lockEvents.IsEmpty() || droppedLockEvents.load(std::memory_order_relaxed);
+}
+
+bool WaitLockEvents() {
+	while (!lockEventsStopping.load()) {
+		if (HasLockEvents()) {
+			return true;
+		}
+		consumerSleeping.store(true);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (!HasLockEvents()) {
+			WaitForSingleObject(lockEventsReady, INFINITE);
+		}
+		consumerSleeping.store(false);
+	}
+	return false;
+}
+
+static bool IsSameEvent(const LockEvent& a, const LockEvent& b) {
+	return a.type == b.type && a.threadId == b.threadId && a.error == b.error && a.language == b.language &&
+		a.sequence == b.sequence;
+}
+
+int TakeLockEvents(LockEvent* events, int maxCount) {
+	int count = 0;
+	LockEvent event;
+	while (hasPendingEvent || lockEvents.TryPop(event)) {
+		if (hasPendingEvent) {
+			event = pendingEvent;
+			hasPendingEvent = false;
+		}
+		if (count && IsSameEvent(events[count - 1], event)) {
+			events[count - 1].count += event.count;
+			continue;
+		}
+		if (count == maxCount - 1) {
+			// the last entry is kept for the "dropped" event, so leave this one for the next batch
+			pendingEvent = event;
+			hasPendingEvent = true;
+			break;
+		}
+		events[count++] = event;
+	}
+
+	DWORD dropped = droppedLockEvents.exchange(0, std::memory_order_acquire);
+	if (dropped) {
+		// the commands which completions may be lost are executed before their events are dropped, see the
+		// release order in PostLockEvent()
+		LockEvent droppedEvent = { LOCK_EVENT_DROPPED, (uint32_t)dropped, 0, 0, 0, GetLastExecutedCommand() };
+		events[count++] = droppedEvent;
+	}
+	return count;
+}
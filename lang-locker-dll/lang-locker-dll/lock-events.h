@@ -0,0 +1,46 @@
+/*
+ * lock-events.h : lock events queued for the Java plugins, see the notifier thread in JNILockEngine.cpp
+ *
+ * The events are posted by the hooks and the lock functions into a bounded lock-free queue, so posting never
+ * blocks. The queue has a single consumer, the notifier thread, which takes the events in batches. The consecutive
+ * identical events, like the reverts during a storm of layout switches, are coalesced into one event with a count.
+ * The events are posted only after the consumer is started; if the queue is full, they are dropped and counted.
+ */
+
+#pragma once
+
+enum LockEventType {
+	LOCK_EVENT_REVERTED = 1,         // an unwanted language switch is reverted
+	LOCK_EVENT_REVERT_FAILED = 2,    // failed to revert a language switch, see the error
+	LOCK_EVENT_HOOK_FAILED = 3,      // failed to set a hook for the thread, see the error
+	LOCK_EVENT_LAYOUTS_CHANGED = 4,  // the list of the installed layouts is changed
+	LOCK_EVENT_DROPPED = 5,          // the events dropped because the queue was full, the count is their number
+	LOCK_EVENT_COMMAND_COMPLETED = 6,  // a lock command completed with the locked language, see lock-commands.h
+};
+
+struct LockEvent {
+	uint32_t type;          // LockEventType
+	uint32_t count;         // the number of the coalesced identical events
+	uint32_t threadId;      // the thread which caused the event, or 0
+	uint32_t error;         // Windows error code, for the failures
+	int64_t language;       // the HKL involved, or 0
+	// the sequence number of the completed command, or, for LOCK_EVENT_DROPPED, of the last command executed
+	// before the events are taken, so that the lost completions are known. See lock-commands.h
+	uint32_t sequence;
+};
+
+// Starts queuing of the events, before the consumer waits for the events. May be called again after StopLockEvents(),
+// if the consumer has failed to start
+bool StartLockEvents();
+
+// Wakes up the consumer and stops queuing of the events
+void StopLockEvents();
+
+// Queues the event for the consumer, if started
+void PostLockEvent(LockEventType type, DWORD threadId, HKL language, DWORD error, uint32_t sequence = 0);
+
+// Waits until there are events to take. Returns false if stopped
+bool WaitLockEvents();
+
+// Takes up to maxCount events, coalescing the consecutive identical ones. Returns the number of the taken events
+int TakeLockEvents(LockEvent* events, int maxCount);
@@ -0,0 +1,242 @@
+/*
+ * lock-logic.h : decisions made by the hook procedures, as pure functions of the lock state and the hooked event.
+ *
+ * The hooks only perform the actions decided here, so the same logic may be replayed offline (see lang-locker-replay).
+ * NOTE: this header does not depend on Windows headers, the required message codes are duplicated below.
+ */
+
+#pragma once
+
+#include "lock-state.h"
+
+// Codes of the window messages and shell hook events used in the decisions, the same as in WinUser.h
+const uint32_t MSG_DESTROY = 0x0002;
+const uint32_t MSG_PAINT = 0x000F;
+const uint32_t MSG_INPUTLANGCHANGEREQUEST = 0x0050;
+const uint32_t MSG_INPUTLANGCHANGE = 0x0051;
+const uint32_t MSG_KEYFIRST = 0x0100;
+const uint32_t MSG_KEYLAST = 0x0109;
+const uint32_t MSG_TIMER = 0x0113;
+const uint32_t MSG_MOUSEFIRST = 0x0200;
+const uint32_t MSG_MOUSELAST = 0x020E;
+
+const int SHELL_WINDOWACTIVATED = 4;
+const int SHELL_LANGUAGE = 8;
+
+// Actions to be performed by a hook, may be combined
+enum HookAction {
+	HOOK_ACTION_NONE = 0,
+	// replace the message with WM_NULL
+	HOOK_ACTION_BLOCK_SWITCH = 1,
+	// an unwanted language switch is detected, set "revert required" flag
+	HOOK_ACTION_REQUEST_REVERT = 2,
+	// revert the language now, if "revert required" flag is set
+	HOOK_ACTION_REVERT = 4
+};
+
+// Actions to be performed by the lock/unlock functions, may be combined
+enum LockAction {
+	LOCK_ACTION_NONE = 0,
+	// activate the requested language before locking it. If failed, the lock (or the previous lock) is kept
+	LOCK_ACTION_SET_LANGUAGE = 8,
+	// lock the language and set the hooks
+	LOCK_ACTION_SET_HOOKS = 16,
+	// unset the hooks and unlock
+	LOCK_ACTION_UNSET_HOOKS = 32,
+	// temporarily activate another language and let the hooks revert it, see TryLockInputLanguage()
+	LOCK_ACTION_PRE_SWITCH = 64,
+	// activate the current language once more after the hooks are set, as required by Eclipse
+	LOCK_ACTION_REPEAT_LANGUAGE = 128
+};
+
+//
+// The lock logic is a finite state machine. The phase is derived from the lock state word as seen by the
+// hooked thread, and each lock/unlock call or hooked event is a trigger. The transition depends also on whether
+// the language of the trigger (the requested one for the lock functions, and the new or the current one for the
+// hooks) differs from the locked one. The phases and triggers are small, so the whole machine is a constant
+// table, and each decision is a single indexed lookup.
+//
+enum LockPhase {
+	PHASE_UNLOCKED,
+	PHASE_LOCKED,
+	PHASE_REVERT_PENDING,
+
+	LOCK_PHASES
+};
+
+enum LockTrigger {
+	TRIGGER_LOCK,               // LockInputLanguage() called from the main thread
+	TRIGGER_LOCK_FROM_UI,       // LockInputLanguage() called from a UI thread other than the main one
+	TRIGGER_CHANGE,             // LockInputLanguage() called while already locked
+	TRIGGER_UNLOCK,             // UnlockInputLanguage()
+	TRIGGER_SHELL_LANGUAGE,     // HSHELL_LANGUAGE
+	TRIGGER_SHELL_ACTIVATED,    // HSHELL_WINDOWACTIVATED
+	TRIGGER_SHELL_OTHER,        // other shell events
+	TRIGGER_LANGCHANGEREQUEST,  // WM_INPUTLANGCHANGEREQUEST
+	TRIGGER_LANGCHANGE,         // WM_INPUTLANGCHANGE
+	TRIGGER_DESTROY,            // WM_DESTROY, which shall not be used for reverting languages
+	TRIGGER_MESSAGE,            // other messages
+
+	LOCK_TRIGGERS
+};
+
+// The actions and the phase after them. The reverts may be deferred by the scheduler (see revert-scheduler.h),
+// and the lock may fail, so the actual phase is always derived from the lock state word
+struct LockTransition {
+	uint8_t next;
+	uint8_t actions;
+};
+
+// Indexed by the phase, the trigger and whether the language of the trigger differs from the locked one
+constexpr LockTransition LOCK_TRANSITIONS[LOCK_PHASES][LOCK_TRIGGERS][2] = {
+	// PHASE_UNLOCKED; the hooks are just going to be unset, so the hooked events are ignored
+	{
+		/* LOCK */              { { PHASE_LOCKED, LOCK_ACTION_SET_HOOKS | LOCK_ACTION_REPEAT_LANGUAGE }, { PHASE_LOCKED, LOCK_ACTION_SET_LANGUAGE | LOCK_ACTION_SET_HOOKS } },
+		/* LOCK_FROM_UI */      { { PHASE_REVERT_PENDING, LOCK_ACTION_SET_HOOKS | LOCK_ACTION_PRE_SWITCH }, { PHASE_LOCKED, LOCK_ACTION_SET_LANGUAGE | LOCK_ACTION_SET_HOOKS } },
+		/* CHANGE */            { { PHASE_UNLOCKED, LOCK_ACTION_NONE }, { PHASE_UNLOCKED, LOCK_ACTION_NONE } },
+		/* UNLOCK */            { { PHASE_UNLOCKED, LOCK_ACTION_NONE }, { PHASE_UNLOCKED, LOCK_ACTION_NONE } },
+		/* SHELL_LANGUAGE */    { { PHASE_UNLOCKED, HOOK_ACTION_NONE }, { PHASE_UNLOCKED, HOOK_ACTION_NONE } },
+		/* SHELL_ACTIVATED */   { { PHASE_UNLOCKED, HOOK_ACTION_NONE }, { PHASE_UNLOCKED, HOOK_ACTION_NONE } },
+		/* SHELL_OTHER */       { { PHASE_UNLOCKED, HOOK_ACTION_NONE }, { PHASE_UNLOCKED, HOOK_ACTION_NONE } },
+		/* LANGCHANGEREQUEST */ { { PHASE_UNLOCKED, HOOK_ACTION_NONE }, { PHASE_UNLOCKED, HOOK_ACTION_NONE } },
+		/* LANGCHANGE */        { { PHASE_UNLOCKED, HOOK_ACTION_NONE }, { PHASE_UNLOCKED, HOOK_ACTION_NONE } },
+		/* DESTROY */           { { PHASE_UNLOCKED, HOOK_ACTION_NONE }, { PHASE_UNLOCKED, HOOK_ACTION_NONE } },
+		/* MESSAGE */           { { PHASE_UNLOCKED, HOOK_ACTION_NONE }, { PHASE_UNLOCKED, HOOK_ACTION_NONE } },
+	},
+	// PHASE_LOCKED
+	{
+		/* LOCK */              { { PHASE_LOCKED, LOCK_ACTION_NONE }, { PHASE_LOCKED, LOCK_ACTION_SET_LANGUAGE } },
+		/* LOCK_FROM_UI */      { { PHASE_LOCKED, LOCK_ACTION_NONE }, { PHASE_LOCKED, LOCK_ACTION_SET_LANGUAGE } },
+		/* CHANGE */            { { PHASE_LOCKED, LOCK_ACTION_NONE }, { PHASE_LOCKED, LOCK_ACTION_SET_LANGUAGE } },
+		/* UNLOCK */            { { PHASE_UNLOCKED, LOCK_ACTION_UNSET_HOOKS }, { PHASE_UNLOCKED, LOCK_ACTION_UNSET_HOOKS } },
+		/* SHELL_LANGUAGE */    { { PHASE_LOCKED, HOOK_ACTION_NONE }, { PHASE_REVERT_PENDING, HOOK_ACTION_REQUEST_REVERT } },
+		// seems safe to change the language at this event
+		/* SHELL_ACTIVATED */   { { PHASE_LOCKED, HOOK_ACTION_NONE }, { PHASE_LOCKED, HOOK_ACTION_REQUEST_REVERT | HOOK_ACTION_REVERT } },
+		/* SHELL_OTHER */       { { PHASE_LOCKED, HOOK_ACTION_NONE }, { PHASE_LOCKED, HOOK_ACTION_NONE } },
+		// before Windows XP, this message was sent before language switch, so it could be used for blocking
+		// switches. But, it does not work anymore, and left only as a reference
+		/* LANGCHANGEREQUEST */ { { PHASE_LOCKED, HOOK_ACTION_BLOCK_SWITCH }, { PHASE_LOCKED, HOOK_ACTION_BLOCK_SWITCH } },
+		// NOTE: In Windows 8, this message may be not sent to hooks in some cases. So, other detectors (like
+		//       "sink" or "shell hook") are required too.
+		// NOTE: cannot change language here, as system will change it again (resulting in infinite loop)
+		/* LANGCHANGE */        { { PHASE_LOCKED, HOOK_ACTION_NONE }, { PHASE_REVERT_PENDING, HOOK_ACTION_REQUEST_REVERT } },
+		/* DESTROY */           { { PHASE_LOCKED, HOOK_ACTION_NONE }, { PHASE_LOCKED, HOOK_ACTION_NONE } },
+		/* MESSAGE */           { { PHASE_LOCKED, HOOK_ACTION_NONE }, { PHASE_LOCKED, HOOK_ACTION_NONE } },
+	},
+	// PHASE_REVERT_PENDING
+	{
+		/* LOCK */              { { PHASE_REVERT_PENDING, LOCK_ACTION_NONE }, { PHASE_LOCKED, LOCK_ACTION_SET_LANGUAGE } },
+		/* LOCK_FROM_UI */      { { PHASE_REVERT_PENDING, LOCK_ACTION_NONE }, { PHASE_LOCKED, LOCK_ACTION_SET_LANGUAGE } },
+		/* CHANGE */            { { PHASE_REVERT_PENDING, LOCK_ACTION_NONE }, { PHASE_LOCKED, LOCK_ACTION_SET_LANGUAGE } },
+		/* UNLOCK */            { { PHASE_UNLOCKED, LOCK_ACTION_UNSET_HOOKS }, { PHASE_UNLOCKED, LOCK_ACTION_UNSET_HOOKS } },
+		/* SHELL_LANGUAGE */    { { PHASE_REVERT_PENDING, HOOK_ACTION_NONE }, { PHASE_REVERT_PENDING, HOOK_ACTION_NONE } },
+		/* SHELL_ACTIVATED */   { { PHASE_LOCKED, HOOK_ACTION_REVERT }, { PHASE_LOCKED, HOOK_ACTION_REVERT } },
+		/* SHELL_OTHER */       { { PHASE_REVERT_PENDING, HOOK_ACTION_NONE }, { PHASE_REVERT_PENDING, HOOK_ACTION_NONE } },
+		/* LANGCHANGEREQUEST */ { { PHASE_REVERT_PENDING, HOOK_ACTION_NONE }, { PHASE_REVERT_PENDING, HOOK_ACTION_NONE } },
+		/* LANGCHANGE */        { { PHASE_REVERT_PENDING, HOOK_ACTION_NONE }, { PHASE_REVERT_PENDING, HOOK_ACTION_NONE } },
+		/* DESTROY */           { { PHASE_REVERT_PENDING, HOOK_ACTION_NONE }, { PHASE_REVERT_PENDING, HOOK_ACTION_NONE } },
+		// other messages seems fine for language changes. If some message will be causing errors, it needs
+		// its own trigger like TRIGGER_DESTROY
+		/* MESSAGE */           { { PHASE_LOCKED, HOOK_ACTION_REVERT }, { PHASE_LOCKED, HOOK_ACTION_REVERT } },
+	},
+};
+
+inline LockPhase LockPhaseOf(LockStateWord state) {
+	return !IsLocked(state) ? PHASE_UNLOCKED : IsRevertRequired(state) ? PHASE_REVERT_PENDING : PHASE_LOCKED;
+}
+
+constexpr LockTransition LockTransitionOf(LockPhase phase, LockTrigger trigger, bool otherLayout) {
+	return LOCK_TRANSITIONS[phase][trigger][otherLayout];
+}
+
+inline LockTrigger MessageTriggerOf(uint32_t message) {
+	switch (message) {
+	case MSG_INPUTLANGCHANGEREQUEST: return TRIGGER_LANGCHANGEREQUEST;
+	case MSG_INPUTLANGCHANGE: return TRIGGER_LANGCHANGE;
+	case MSG_DESTROY: return TRIGGER_DESTROY;
+	default: return TRIGGER_MESSAGE;
+	}
+}
+
+inline LockTrigger ShellTriggerOf(int code) {
+	return code == SHELL_LANGUAGE ? TRIGGER_SHELL_LANGUAGE
+		: code == SHELL_WINDOWACTIVATED ? TRIGGER_SHELL_ACTIVATED : TRIGGER_SHELL_OTHER;
+}
+
+//
+// The invariants of the table, checked at compile time for every transition:
+//  - the lock functions perform only lock actions, and the hooks only hook ones
+//  - the hooks do nothing while unlocked, and the lock functions do not lock twice
+//  - a revert is performed only if pending or requested by the same event, and ends in PHASE_LOCKED
+//  - a requested revert which is not performed ends in PHASE_REVERT_PENDING
+//  - the hooks change the phase only by the actions
+//  - unlocking always unsets the hooks and ends in PHASE_UNLOCKED, and locking ends in a locked phase
+//
+constexpr bool IsLockTrigger(int trigger) {
+	return trigger <= TRIGGER_UNLOCK;
+}
+
+constexpr bool IsValidHookTransition(int phase, LockTransition t) {
+	return (t.actions & ~(HOOK_ACTION_BLOCK_SWITCH | HOOK_ACTION_REQUEST_REVERT | HOOK_ACTION_REVERT)) == 0
+		&& (phase != PHASE_UNLOCKED || t.actions == HOOK_ACTION_NONE)
+		&& (!(t.actions & HOOK_ACTION_REVERT)
+			|| ((phase == PHASE_REVERT_PENDING || (t.actions & HOOK_ACTION_REQUEST_REVERT)) && t.next == PHASE_LOCKED))
+		&& (!(t.actions & HOOK_ACTION_REQUEST_REVERT) || (t.actions & HOOK_ACTION_REVERT) || t.next == PHASE_REVERT_PENDING)
+		&& ((t.actions & (HOOK_ACTION_REQUEST_REVERT | HOOK_ACTION_REVERT)) || t.next == phase);
+}
+
+constexpr bool IsValidLockTransition(int phase, int trigger, LockTransition t) {
+	return (t.actions & (HOOK_ACTION_BLOCK_SWITCH | HOOK_ACTION_REQUEST_REVERT | HOOK_ACTION_REVERT)) == 0
+		&& (phase == PHASE_UNLOCKED || !(t.actions & LOCK_ACTION_SET_HOOKS))
+		&& ((trigger == TRIGGER_UNLOCK) == (t.next == PHASE_UNLOCKED) || (phase == PHASE_UNLOCKED && t.actions == LOCK_ACTION_NONE))
+		&& ((trigger == TRIGGER_UNLOCK && phase != PHASE_UNLOCKED) == ((t.actions & LOCK_ACTION_UNSET_HOOKS) != 0));
+}
+
+constexpr bool AreValidLockTransitions(int index) {
+	return index == LOCK_PHASES * LOCK_TRIGGERS * 2
+		|| ((IsLockTrigger(index / 2 % LOCK_TRIGGERS)
+				? IsValidLockTransition(index / 2 / LOCK_TRIGGERS, index / 2 % LOCK_TRIGGERS,
+					LOCK_TRANSITIONS[index / 2 / LOCK_TRIGGERS][index / 2 % LOCK_TRIGGERS][index % 2])
+				: IsValidHookTransition(index / 2 / LOCK_TRIGGERS,
+					LOCK_TRANSITIONS[index / 2 / LOCK_TRIGGERS][index / 2 % LOCK_TRIGGERS][index % 2]))
+			&& AreValidLockTransitions(index + 1));
+}
+
+static_assert(AreValidLockTransitions(0), "Invalid transition in LOCK_TRANSITIONS");
+
+//
+// Decides what shall be done by the messages hook for the message got by the main thread.
+// newLayout is the layout passed in WM_INPUTLANGCHANGE* messages, not used for other messages
+//
+inline int DecideOnMessage(LockStateWord state, uint32_t message, uint32_t newLayout) {
+	return LockTransitionOf(LockPhaseOf(state), MessageTriggerOf(message), newLayout != LockedLayoutOf(state)).actions;
+}
+
+//
+// Decides what shall be done by the shell hook for the specified event code.
+// currentLayout is the current layout of the main thread
+//
+inline int DecideOnShellEvent(LockStateWord state, int code, uint32_t currentLayout) {
+	return LockTransitionOf(LockPhaseOf(state), ShellTriggerOf(code), currentLayout != LockedLayoutOf(state)).actions;
+}
+
+// Classes of the events at which a pending revert may be performed, see revert-scheduler.h
+enum RevertClass {
+	REVERT_CLASS_INPUT,         // keyboard and mouse messages
+	REVERT_CLASS_PAINT,         // WM_PAINT and WM_TIMER, which are got when the queue is otherwise empty
+	REVERT_CLASS_POSTED,        // other messages, like WM_NULL or application-defined ones
+	REVERT_CLASS_ACTIVATION,    // activation of a window, reported to the shell hook
+	REVERT_CLASS_DEADLINE,      // the revert deadline is expired
+
+	REVERT_CLASSES
+};
+
+inline RevertClass RevertClassOf(uint32_t message) {
+	if ((message >= MSG_KEYFIRST && message <= MSG_KEYLAST) || (message >= MSG_MOUSEFIRST && message <= MSG_MOUSELAST)) {
+		return REVERT_CLASS_INPUT;
+	}
+	if (message == MSG_PAINT || message == MSG_TIMER) {
+		return REVERT_CLASS_PAINT;
+	}
+	return REVERT_CLASS_POSTED;
+}
@@ -0,0 +1,204 @@
+/*
+ * lock-state-file.cpp : the lock state persisted in a memory-mapped file, see lock-state-file.h
+ */
+
+#include "stdafx.h"
+#include <string.h>
+#include "lang-locker.h"
+#include "lock-state-file.h"
+#include "lock-commands.h"
+
+static LockStateFile* stateFile = NULL;
+
+// The restore read from the file. Written before restorePending is set, and read after it is reset
+static std::atomic<bool> restorePending(false);
+static LockStateFile restoreState;
+
+// The main thread is usually not known yet when the library is loaded, e.g. the IDE has no visible windows,
+// so its detection is retried until the restore is applied or superseded
+const DWORD RESTORE_POLL_INTERVAL_MS = 50;
+const DWORD RESTORE_TIMEOUT_MS = 120000;
+
+// An odd sequence after so many spins is left by a writer which has crashed
+const int STATE_WRITE_SPINS = 100000;
+const int STATE_READ_ATTEMPTS = 1000;
+
+static void BeginStateWrite(LockStateFile* state) {
+	uint32_t seq = state->sequence.load(std::memory_order_relaxed);
+	for (int spins = 0; ; spins++) {
+		if ((seq & 1) && spins < STATE_WRITE_SPINS) {
+			YieldProcessor();
+			seq = state->sequence.load(std::memory_order_relaxed);
+		}
+		else if (state->sequence.compare_exchange_weak(seq, (seq | 1) + (seq & 1 ? 2 : 0), std::memory_order_acquire)) {
+			break;
+		}
+	}
+	std::atomic_thread_fence(std::memory_order_release);
+}
+
+static void EndStateWrite(LockStateFile* state) {
+	state->sequence.fetch_add(1, std::memory_order_release);
+}
+
+// Reads the consistent copy of the state. Returns false if it is being written for too long
+static bool ReadLockStateFile(const LockStateFile* state, LockStateFile& copy) {
+	for (int i = 0; i < STATE_READ_ATTEMPTS; i++) {
+		uint32_t seq = state->sequence.load(std::memory_order_acquire);
+		if (seq & 1) {
+			YieldProcessor();
+			continue;
+		}
+		copy.version = state->version;
+		copy.lockedLanguage = state->lockedLanguage;
+		copy.policy = state->policy;
+		copy.primaryLanguage = state->primaryLanguage;
+		copy.permittedCount = state->permittedCount;
+		memcpy(copy.permittedLayouts, state->permittedLayouts, sizeof(copy.permittedLayouts));
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (state->sequence.load(std::memory_order_relaxed) == seq) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static DWORD WINAPI LockRestoreProc(LPVOID param) {
+	for (DWORD waited = 0; restorePending.load() && waited < RESTORE_TIMEOUT_MS; waited += RESTORE_POLL_INTERVAL_MS) {
+		if (PostLockRestore()) {
+			break;
+		}
+		Sleep(RESTORE_POLL_INTERVAL_MS);
+	}
+
+	// release the reference obtained in StartLockRestore()
+	FreeLibraryAndExitThread((HMODULE)param, 0);
+	return 0;
+}
+
+// Starts the thread which waits for the main thread, like the log writer thread
+static void StartLockRestore() {
+	HMODULE self = NULL;
+	if (!GetModuleHandleExA(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS, (LPCSTR)&LockRestoreProc, &self)) {
+		Log("Failed to start the lock restore, error=", GetLastError());
+		return;
+	}
+	restorePending.store(true);
+	HANDLE thread = CreateThread(NULL, 0, LockRestoreProc, self, 0, NULL);
+	if (thread) {
+		CloseHandle(thread);
+	}
+	else {
+		Log("Failed to start the lock restore, error=", GetLastError());
+		restorePending.store(false);
+		FreeLibrary(self);
+	}
+}
+
+// Gets the path of the state file, and creates its directory
+static bool GetLockStateFilePath(char* path, DWORD size) {
+	char exePath[MAX_PATH];
+	DWORD len = GetEnvironmentVariableA("LOCALAPPDATA", path, size);
+	if (len == 0 || len >= size || !GetModuleFileNameA(NULL, exePath, sizeof(exePath))) {
+		return false;
+	}
+	const char* exeName = strrchr(exePath, '\\');
+	exeName = exeName ? exeName + 1 : exePath;
+
+	if (_snprintf_s(path + len, size - len, _TRUNCATE, "\\lang-locker") < 0) {
+		return false;
+	}
+	CreateDirectoryA(path, NULL);
+	return _snprintf_s(path + len, size - len, _TRUNCATE, "\\lang-locker\\%s.lock", exeName) >= 0;
+}
+
+void OpenLockStateFile() {
+	char path[MAX_PATH];
+	if (stateFile || !GetLockStateFilePath(path, sizeof(path))) {
+		return;
+	}
+
+	// the new file is extended by the mapping and zero-filled, i.e. "never written"
+	HANDLE file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+		OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) {
+		Log("Failed to open the lock state file, error=", GetLastError());
+		return;
+	}
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READWRITE, 0, sizeof(LockStateFile), NULL);
+	void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, sizeof(LockStateFile)) : NULL;
+	if (!view) {
+		Log("Failed to map the lock state file, error=", GetLastError());
+	}
+	// the view keeps the mapping and the file open after the handles are closed
+	if (mapping) {
+		CloseHandle(mapping);
+	}
+	CloseHandle(file);
+	if (!view) {
+		return;
+	}
+	stateFile = (LockStateFile*)view;
+
+	if (!ReadLockStateFile(stateFile, restoreState) || restoreState.version != LOCK_STATE_FILE_VERSION) {
+		// either never written, or written by an unsupported version, which is overwritten at the next lock
+		return;
+	}
+	if (restoreState.policy != LOCK_POLICY_NONE && restoreState.lockedLanguage) {
+		Log("Restoring the persisted lock: ", (HKL)(LONG_PTR)restoreState.lockedLanguage);
+		StartLockRestore();
+	}
+}
+
+void CloseLockStateFile() {
+	LockStateFile* state = stateFile;
+	if (state) {
+		stateFile = NULL;
+		UnmapViewOfFile(state);
+	}
+}
+
+void PersistLockState() {
+	LockStateFile* state = stateFile;
+	if (!state) {
+		return;
+	}
+	uint32_t layouts[MAX_PERMITTED_LAYOUTS];
+	LANGID primaryLanguage;
+	int count = GetPermittedLayouts(layouts, primaryLanguage);
+	HKL lockedLang = GetLockedLanguage();
+
+	BeginStateWrite(state);
+	state->version = LOCK_STATE_FILE_VERSION;
+	state->lockedLanguage = (LONG_PTR)lockedLang;
+	state->policy = !lockedLang ? LOCK_POLICY_NONE : count || primaryLanguage ? LOCK_POLICY_SET : LOCK_POLICY_SINGLE;
+	state->primaryLanguage = primaryLanguage;
+	state->permittedCount = count;
+	memcpy(state->permittedLayouts, layouts, count * sizeof(uint32_t));
+	EndStateWrite(state);
+}
+
+void CancelLockRestore() {
+	if (restorePending.exchange(false)) {
+		Log("The persisted lock restore is superseded");
+	}
+}
+
+void ApplyLockRestore() {
+	if (!restorePending.exchange(false)) {
+		return;
+	}
+	HKL lockedLang;
+	if (restoreState.policy == LOCK_POLICY_SET) {
+		HKL layouts[MAX_PERMITTED_LAYOUTS];
+		int count = restoreState.permittedCount < MAX_PERMITTED_LAYOUTS ? restoreState.permittedCount : MAX_PERMITTED_LAYOUTS;
+		for (int i = 0; i < count; i++) {
+			layouts[i] = LayoutToHKL(restoreState.permittedLayouts[i]);
+		}
+		lockedLang = LockInputLanguageSet(layouts, count, (LANGID)restoreState.primaryLanguage);
+	}
+	else {
+		lockedLang = LockInputLanguage((HKL)(LONG_PTR)restoreState.lockedLanguage);
+	}
+	Log("Persisted lock restored: ", lockedLang);
+}
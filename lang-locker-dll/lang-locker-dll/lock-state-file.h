@@ -0,0 +1,53 @@
+/*
+ * lock-state-file.h : the lock state persisted in a small memory-mapped file, for the early restore at the next start.
+ *
+ * The plugins keep the lock in their preferences, but restore it only when the IDE is up, so the layout is unlocked
+ * during the startup. So, the library also writes the lock state at each lock or unlock to
+ * %LOCALAPPDATA%\lang-locker\<executable name>.lock. The file is mapped, so a write is just a few stores into the
+ * page cache, which the OS writes to the file later, even if the process is killed.
+ *
+ * At the next start, the state is read when the library is loaded by a plugin (see JNI_OnLoad), and re-applied on
+ * the main thread as soon as the main thread is detected. The preferences of the plugins remain the fallback, e.g.
+ * if the file is missing; any lock or unlock by the plugin supersedes the pending restore.
+ *
+ * The instances of the same IDE share the file, so it is protected by a seqlock like the status block
+ * (see lock-status.h).
+ */
+
+#pragma once
+
+#include "permitted-layouts.h"
+
+const uint32_t LOCK_STATE_FILE_VERSION = 1;
+
+enum LockPolicy {
+	LOCK_POLICY_NONE = 0,      // unlocked
+	LOCK_POLICY_SINGLE = 1,    // LockInputLanguage()
+	LOCK_POLICY_SET = 2,       // LockInputLanguageSet()
+};
+
+struct LockStateFile {
+	std::atomic<uint32_t> sequence;
+	uint32_t version;                   // LOCK_STATE_FILE_VERSION, or 0 if never written
+	int64_t lockedLanguage;             // the locked HKL, or 0 if unlocked
+	uint32_t policy;                    // LockPolicy
+	uint32_t primaryLanguage;           // the primary language permitted by LOCK_POLICY_SET, or 0
+	uint32_t permittedCount;
+	uint32_t permittedLayouts[MAX_PERMITTED_LAYOUTS];
+	uint32_t reserved[9];
+};
+
+static_assert(sizeof(LockStateFile) == 128, "Unexpected size of LockStateFile");
+
+// Maps the state file and, if it keeps a lock, starts the restore of it
+void OpenLockStateFile();
+void CloseLockStateFile();
+
+// Writes the current lock state into the file, if mapped
+void PersistLockState();
+
+// Cancels the pending restore, as superseded by an explicit lock or unlock
+void CancelLockRestore();
+
+// Applies the pending restore, if any. Called by the command hook on the main thread, see lock-commands.h
+void ApplyLockRestore();
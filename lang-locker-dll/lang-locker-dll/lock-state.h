@@ -0,0 +1,71 @@
+/*
+ * lock-state.h : the packed lock state word, shared by the lock/unlock functions and the hook procedures.
+ *
+ * NOTE: this header does not depend on Windows headers, so that it may be used by tools outside of the DLL.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+
+//
+// The whole state checked by the hooks on each message is packed into a single 64-bit word,
+// so that the hooks may read it with one relaxed load:
+//  - bits 0..31  - the locked keyboard layout, i.e. the low DWORD of the locked HKL, or 0 if not locked
+//  - bit  32     - "revert required" flag, set if an unwanted language switch was not blocked, and thus
+//                  shall be reverted at first possibility
+//  - bit  33     - "window bindings" flag, set if some windows have their own locked layouts, see window-locks.h
+//  - bits 34..63 - generation, incremented at every change of the word
+//
+typedef uint64_t LockStateWord;
+
+const LockStateWord LOCK_STATE_LAYOUT_MASK = 0xFFFFFFFFull;
+const LockStateWord LOCK_STATE_REVERT_REQUIRED = 1ull << 32;
+const LockStateWord LOCK_STATE_WINDOW_BINDINGS = 1ull << 33;
+const int LOCK_STATE_GENERATION_SHIFT = 34;
+const LockStateWord LOCK_STATE_GENERATION_ONE = 1ull << LOCK_STATE_GENERATION_SHIFT;
+
+inline uint32_t LockedLayoutOf(LockStateWord state) {
+	return (uint32_t)(state & LOCK_STATE_LAYOUT_MASK);
+}
+
+inline bool IsLocked(LockStateWord state) {
+	return (state & LOCK_STATE_LAYOUT_MASK) != 0;
+}
+
+inline bool IsRevertRequired(LockStateWord state) {
+	return (state & LOCK_STATE_REVERT_REQUIRED) != 0;
+}
+
+inline bool HasWindowBindings(LockStateWord state) {
+	return (state & LOCK_STATE_WINDOW_BINDINGS) != 0;
+}
+
+// Whether the language is locked and nothing is pending, which is the usual state during the work
+inline bool IsLockedIdle(LockStateWord state) {
+	return IsLocked(state) && !IsRevertRequired(state);
+}
+
+inline uint32_t GenerationOf(LockStateWord state) {
+	return (uint32_t)(state >> LOCK_STATE_GENERATION_SHIFT);
+}
+
+// Builds the next value of the state word, with the specified layout and flag, and the incremented generation.
+// "window bindings" flag is kept
+inline LockStateWord NextLockState(LockStateWord prev, uint32_t layout, bool revertRequired) {
+	return ((prev & ~(LOCK_STATE_LAYOUT_MASK | LOCK_STATE_REVERT_REQUIRED)) + LOCK_STATE_GENERATION_ONE)
+		| layout | (revertRequired ? LOCK_STATE_REVERT_REQUIRED : 0);
+}
+
+// The layout of the windows which are left free of the lock, see window-rules.h
+const uint32_t WINDOW_LAYOUT_FREE = 0xFFFFFFFF;
+
+// Replaces the locked layout with the one locked for the focused window, if any. In a free window, the state
+// is seen as unlocked, so that a pending revert waits until the focus leaves it
+inline LockStateWord WithWindowLayout(LockStateWord state, uint32_t windowLayout) {
+	if (windowLayout == WINDOW_LAYOUT_FREE) {
+		return state & ~(LOCK_STATE_LAYOUT_MASK | LOCK_STATE_REVERT_REQUIRED);
+	}
+	return windowLayout ? (state & ~LOCK_STATE_LAYOUT_MASK) | windowLayout : state;
+}
@@ -0,0 +1,57 @@
+/*
+ * lock-stats.cpp : statistics of the hooks, see lock-stats.h
+ */
+
+#include "stdafx.h"
+#include "lang-locker.h"
+
+// the counters of the threads which are not hooked anymore
+static std::atomic<uint64_t> retiredCounters[LOCK_STAT_COUNTERS];
+static std::atomic<uint64_t> retiredRevertLatency[LOCK_STAT_LATENCY_BUCKETS];
+
+int64_t StatTimestamp() {
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	return now.QuadPart;
+}
+
+void CountRevertLatency(ThreadStatistics& stats, int64_t detectedAt) {
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	int64_t ticks = StatTimestamp() - detectedAt;
+	uint64_t microseconds = ticks > 0 ? (uint64_t)(ticks * 1000000.0 / frequency.QuadPart) : 0;
+	CountStat(stats.revertLatency[LatencyBucket(microseconds)]);
+}
+
+void RetireThreadStatistics(ThreadStatistics& stats) {
+	for (int i = 0; i < LOCK_STAT_COUNTERS; i++) {
+		retiredCounters[i].fetch_add(stats.counters[i].exchange(0, std::memory_order_relaxed), std::memory_order_relaxed);
+	}
+	for (int i = 0; i < LOCK_STAT_LATENCY_BUCKETS; i++) {
+		retiredRevertLatency[i].fetch_add(stats.revertLatency[i].exchange(0, std::memory_order_relaxed), std::memory_order_relaxed);
+	}
+}
+
+void CollectLockStatistics(LockStatistics& stats) {
+	for (int i = 0; i < LOCK_STAT_COUNTERS; i++) {
+		stats.counters[i] = retiredCounters[i].load(std::memory_order_relaxed);
+	}
+	for (int i = 0; i < LOCK_STAT_LATENCY_BUCKETS; i++) {
+		stats.revertLatency[i] = retiredRevertLatency[i].load(std::memory_order_relaxed);
+	}
+
+	stats.hookedThreads = 0;
+	for (int slot = 0; slot < HOOKED_THREADS_SLOTS; slot++) {
+		if (!hookedThreadIds[slot].load(std::memory_order_acquire)) {
+			continue;
+		}
+		const ThreadStatistics& thread = hookedThreads[slot].stats;
+		for (int i = 0; i < LOCK_STAT_COUNTERS; i++) {
+			stats.counters[i] += thread.counters[i].load(std::memory_order_relaxed);
+		}
+		for (int i = 0; i < LOCK_STAT_LATENCY_BUCKETS; i++) {
+			stats.revertLatency[i] += thread.revertLatency[i].load(std::memory_order_relaxed);
+		}
+		stats.hookedThreads++;
+	}
+}
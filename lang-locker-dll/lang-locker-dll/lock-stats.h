@@ -0,0 +1,82 @@
+/*
+ * lock-stats.h : always-on statistics of the hooks, see GetLockStatistics() in lang-locker.h
+ *
+ * Each hooked thread counts its own events in its HookedThread entry, so the hooks never write shared cache lines.
+ * When the hooks are unset, the counters of the threads are added to the retired totals and reset, while the hooks
+ * may still run, so the counters are incremented by an atomic RMW, which is uncontended in the owner thread. The readers sum up all of
+ * them, so the values read while the hooks are being set or unset may be slightly inaccurate.
+ *
+ * NOTE: this header does not depend on Windows headers.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+
+enum LockStatCounter {
+	LOCK_STAT_GETMSG_CALLS,             // HookGetMsgProc() invocations past the fast path, see HookGetMsgProc()
+	LOCK_STAT_GETMSG_SKIPPED,           // ... with nCode < 0, passed without processing
+	LOCK_STAT_GETMSG_LANGUAGE,          // ... with WM_INPUTLANGCHANGEREQUEST or WM_INPUTLANGCHANGE
+	LOCK_STAT_GETMSG_KEYDOWN,           // ... with WM_KEYDOWN or WM_SYSKEYDOWN, checked only if windows have bindings
+	LOCK_STAT_SHELL_CALLS,              // HookShellProc() invocations
+	LOCK_STAT_SHELL_LANGUAGE,           // ... with HSHELL_LANGUAGE
+	LOCK_STAT_SHELL_LANGUAGE_SKIPPED,   // ... with HSHELL_LANGUAGE which required no actions
+	LOCK_STAT_SWITCHES_BLOCKED,         // language switch requests blocked
+	LOCK_STAT_SWITCHES_DETECTED,        // unwanted language switches which got through, and are to be reverted
+	LOCK_STAT_REVERTS,                  // successful reverts
+	LOCK_STAT_REVERTS_FAILED,           // failed reverts, i.e. failed activations of the locked language
+	LOCK_STAT_REVERTS_DEFERRED,         // revert opportunities skipped as unsafe, see revert-scheduler.h
+	LOCK_STAT_REVERTS_BY_DEADLINE,      // reverts performed at the expiration of the revert deadline
+	LOCK_STAT_KEYS_REMAPPED,            // keys typed while a revert was pending, and re-emitted, see key-remap.h
+
+	LOCK_STAT_COUNTERS
+};
+
+// The bucket i counts the reverts with latency in [2^i, 2^(i+1)) microseconds, and the bucket 0 counts
+// the latencies below 2 microseconds. The last bucket counts all longer latencies
+const int LOCK_STAT_LATENCY_BUCKETS = 32;
+
+// The statistics returned by GetLockStatistics(), the caller shall set the size
+struct LockStatistics {
+	uint32_t size;                  // sizeof(LockStatistics)
+	uint32_t hookedThreads;         // the number of the currently hooked threads
+	uint64_t counters[LOCK_STAT_COUNTERS];
+	// the time from the detection of an unwanted switch (LOCK_STAT_SWITCHES_DETECTED) to its revert
+	uint64_t revertLatency[LOCK_STAT_LATENCY_BUCKETS];
+};
+
+// The counters of a single thread
+struct ThreadStatistics {
+	std::atomic<uint32_t> counters[LOCK_STAT_COUNTERS];
+	std::atomic<uint32_t> revertLatency[LOCK_STAT_LATENCY_BUCKETS];
+};
+
+// Increments the counter; shall be called only by the owner thread
+inline void CountStat(std::atomic<uint32_t>& counter) {
+	counter.fetch_add(1, std::memory_order_relaxed);
+}
+
+inline void CountStat(ThreadStatistics& stats, LockStatCounter counter) {
+	CountStat(stats.counters[counter]);
+}
+
+inline int LatencyBucket(uint64_t microseconds) {
+	int bucket = 0;
+	while (microseconds >>= 1) {
+		bucket++;
+	}
+	return bucket < LOCK_STAT_LATENCY_BUCKETS ? bucket : LOCK_STAT_LATENCY_BUCKETS - 1;
+}
+
+// Returns the current time for the latency measurement, in the performance counter ticks
+int64_t StatTimestamp();
+
+// Counts the latency of the revert, from the timestamp of the detection
+void CountRevertLatency(ThreadStatistics& stats, int64_t detectedAt);
+
+// Adds the counters of the thread to the retired totals, and resets them
+void RetireThreadStatistics(ThreadStatistics& stats);
+
+// Fills the statistics with the retired totals plus the counters of the hooked threads
+void CollectLockStatistics(LockStatistics& stats);
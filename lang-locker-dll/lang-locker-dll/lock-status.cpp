@@ -0,0 +1,58 @@
+/*
+ * lock-status.cpp : the status block for the Java plugins, see lock-status.h
+ */
+
+#include "stdafx.h"
+#include "lang-locker.h"
+#include "lock-status.h"
+
+LockStatusBlock lockStatus;
+
+// The writers are rare, but may run in different threads (the UI thread and the hooked threads), so the sequence
+// also works as a spin lock for them
+static void BeginStatusWrite() {
+	uint32_t seq = lockStatus.sequence.load(std::memory_order_relaxed);
+	for (;;) {
+		if (seq & 1) {
+			YieldProcessor();
+			seq = lockStatus.sequence.load(std::memory_order_relaxed);
+		}
+		else if (lockStatus.sequence.compare_exchange_weak(seq, seq + 1, std::memory_order_acquire)) {
+			break;
+		}
+	}
+	// the odd sequence shall be visible before the changes of the fields
+	std::atomic_thread_fence(std::memory_order_release);
+}
+
+static void EndStatusWrite() {
+	lockStatus.sequence.fetch_add(1, std::memory_order_release);
+}
+
+void InitLockStatus() {
+	BeginStatusWrite();
+	lockStatus.version = LOCK_STATUS_VERSION;
+	EndStatusWrite();
+}
+
+void PublishLockStatus(HKL currentLanguage) {
+	BeginStatusWrite();
+	lockStatus.lockedLanguage = (LONG_PTR)GetLockedLanguage();
+	if (currentLanguage) {
+		lockStatus.currentLanguage = (LONG_PTR)currentLanguage;
+	}
+	EndStatusWrite();
+}
+
+void PublishRevert(HKL currentLanguage) {
+	BeginStatusWrite();
+	lockStatus.revertCount++;
+	lockStatus.currentLanguage = (LONG_PTR)currentLanguage;
+	EndStatusWrite();
+}
+
+void PublishLockError(DWORD error) {
+	BeginStatusWrite();
+	lockStatus.lastError = error;
+	EndStatusWrite();
+}
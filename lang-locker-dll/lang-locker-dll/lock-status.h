@@ -0,0 +1,37 @@
+/*
+ * lock-status.h : the status block, which publishes the actual lock state for the Java plugins.
+ *
+ * The block is exposed to Java as a direct ByteBuffer (see JNILockEngine.cpp), so that the plugins may poll it
+ * without native calls. It is protected by a seqlock: the writer makes the sequence odd before changing the fields,
+ * and even after that, so a reader retries if the sequence is odd or has changed while reading.
+ * The layout is mirrored by LockStatus.java in the plugins.
+ */
+
+#pragma once
+
+const uint32_t LOCK_STATUS_VERSION = 1;
+
+struct LockStatusBlock {
+	std::atomic<uint32_t> sequence;
+	uint32_t version;               // LOCK_STATUS_VERSION
+	int64_t lockedLanguage;         // the locked HKL, or 0 if not locked
+	int64_t currentLanguage;        // the HKL of the hooked thread at the last language change
+	int64_t revertCount;            // number of unwanted language switches reverted by the hooks
+	uint32_t lastError;             // the last Windows error code of failed language switches or hook settings
+	uint32_t reserved[7];
+};
+
+static_assert(sizeof(LockStatusBlock) == 64, "Unexpected size of LockStatusBlock");
+
+extern LockStatusBlock lockStatus;
+
+void InitLockStatus();
+
+// Publishes the locked language, and the current language if known (not 0)
+void PublishLockStatus(HKL currentLanguage);
+
+// Publishes a revert performed by the hooks
+void PublishRevert(HKL currentLanguage);
+
+// Publishes the error of a failed language switch or hook setting
+void PublishLockError(DWORD error);
@@ -0,0 +1,169 @@
+/*
+ * logger.cpp : asynchronous implementation of the debug logging, see Log() in lang-locker.h
+ *
+ * Log() formats the record on the calling thread and pushes it into a bounded lock-free queue, so it never
+ * blocks on I/O, which is important for the hooks. The records are written into the log file by a background
+ * writer thread. If the queue is full, the record is dropped, and the number of the dropped records is logged
+ * later by the writer.
+ */
+
+#include "stdafx.h"
+#include "lang-locker.h"
+#include "bounded-queue.h"
+
+#if LANGLOCKER_LOG_LEVEL > LOG_LEVEL_NONE
+
+// Pre-formatted log record, the longer messages are truncated
+struct LogRecord {
+	char text[248];
+};
+
+// the interval of flushing the records if the writer is not woken up by the producers
+const DWORD LOG_FLUSH_INTERVAL_MS = 100;
+
+static BoundedQueue<LogRecord, 1024> logQueue;
+static std::atomic<DWORD> droppedLogRecords(0);
+
+// set by the writer before waiting for logEvent, and checked by the producers
+static std::atomic<bool> writerSleeping(false);
+static std::atomic<bool> logStopping(false);
+
+// guards the log file against concurrent writing by the writer thread and CloseLog()
+static std::atomic<bool> logWriting(false);
+
+static HANDLE logEvent = NULL;
+static std::ofstream logfile;
+
+static void PushLogRecord(const LogRecord& record) {
+	if (!logQueue.TryPush(record)) {
+		droppedLogRecords.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	// the fence orders the push above with the check below, see the paired fence in LogWriterProc()
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (writerSleeping.load(std::memory_order_relaxed) && writerSleeping.exchange(false)) {
+		SetEvent(logEvent);
+	}
+}
+
+// Writes all queued records into the file. Shall be called only with logWriting set
+static void WriteLogRecords() {
+	LogRecord record;
+	bool written = false;
+	while (logQueue.TryPop(record)) {
+		logfile << record.text << '\n';
+		written = true;
+	}
+	DWORD dropped = droppedLogRecords.exchange(0);
+	if (dropped) {
+		logfile << "[lang-locker] " << std::dec << dropped << " log record(s) dropped as the queue was full\n";
+		written = true;
+	}
+	if (written) {
+		logfile.flush();
+	}
+}
+
+static DWORD WINAPI LogWriterProc(LPVOID param) {
+	while (!logStopping.load()) {
+		if (!logWriting.exchange(true, std::memory_order_acquire)) {
+			WriteLogRecords();
+			logWriting.store(false, std::memory_order_release);
+		}
+
+		writerSleeping.store(true);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (logQueue.IsEmpty()) {
+			WaitForSingleObject(logEvent, LOG_FLUSH_INTERVAL_MS);
+		}
+		writerSleeping.store(false);
+	}
+
+	// release the reference obtained in InitLog()
+	FreeLibraryAndExitThread((HMODULE)param, 0);
+	return 0;
+}
+
+void InitLog() {
+	// a separate file for each process, so that several IDE instances do not overwrite the log of each other
+	char path[64];
+	sprintf_s(path, "lang-locker-%lu.log", GetCurrentProcessId());
+	logfile.open(path);
+
+	logEvent = CreateEventA(NULL, FALSE, FALSE, NULL);
+
+	// the writer thread holds a reference to the DLL, so that the DLL is never unloaded while the thread is running
+	HMODULE self = NULL;
+	if (!logEvent || !GetModuleHandleExA(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS, (LPCSTR)&LogWriterProc, &self)) {
+		logfile << "[lang-locker] failed to start the log writer thread, error=" << GetLastError() << std::endl;
+		return;
+	}
+	HANDLE thread = CreateThread(NULL, 0, LogWriterProc, self, 0, NULL);
+	if (thread) {
+		CloseHandle(thread);
+	} else {
+		FreeLibrary(self);
+	}
+}
+
+void CloseLog() {
+	logStopping = true;
+	if (logEvent) {
+		SetEvent(logEvent);
+	}
+
+	// Usually, this is called at the process exit, when the writer thread is already terminated. Anyway, the writer
+	// thread cannot be waited for under the loader lock, so just give it a chance to finish the current writing,
+	// and then write the rest of the records from this thread. Once acquired here, logWriting is never reset, so
+	// the writer cannot write anything more. If still busy, the file is left to the writer, and the records queued
+	// after its current writing may be lost
+	bool acquired = !logWriting.exchange(true, std::memory_order_acquire);
+	for (int i = 0; i < 100 && !acquired; i++) {
+		Sleep(1);
+		acquired = !logWriting.exchange(true, std::memory_order_acquire);
+	}
+	if (acquired) {
+		WriteLogRecords();
+		logfile.close();
+	}
+}
+
+// Formats the record prefix, which is the ID of the current thread
+static size_t FormatLogPrefix(LogRecord& record) {
+	int len = _snprintf_s(record.text, sizeof(record.text), _TRUNCATE, "[%5lu] ", GetCurrentThreadId());
+	return len > 0 ? len : 0;
+}
+
+void Log(const char* str) {
+	LogRecord record;
+	size_t len = FormatLogPrefix(record);
+	_snprintf_s(record.text + len, sizeof(record.text) - len, _TRUNCATE, "%s", str);
+	PushLogRecord(record);
+}
+
+void Log(const wchar_t* str) {
+	LogRecord record;
+	size_t len = FormatLogPrefix(record);
+	int converted = WideCharToMultiByte(CP_UTF8, 0, str, -1, record.text + len, (int)(sizeof(record.text) - len), NULL, NULL);
+	if (converted == 0) {
+		// too long, or not convertible
+		record.text[len] = 0;
+	}
+	PushLogRecord(record);
+}
+
+void Log(const char* str, HANDLE param) {
+	LogRecord record;
+	size_t len = FormatLogPrefix(record);
+	_snprintf_s(record.text + len, sizeof(record.text) - len, _TRUNCATE, "%s0x%p", str, param);
+	PushLogRecord(record);
+}
+
+void Log(const char* str, DWORD param) {
+	LogRecord record;
+	size_t len = FormatLogPrefix(record);
+	_snprintf_s(record.text + len, sizeof(record.text) - len, _TRUNCATE, "%s0x%lX", str, param);
+	PushLogRecord(record);
+}
+
+#endif
@@ -0,0 +1,155 @@
+/*
+ * main-thread.cpp : detection of the "main" thread, see main-thread.h
+ */
+
+#include "stdafx.h"
+#include "lang-locker.h"
+#include "platform.h"
+#include "main-thread.h"
+
+static const WindowSource* windowSource = &defaultWindowSource;
+
+// Incremented at each invalidation. The cached main thread is valid only if detected in the current generation
+static std::atomic<DWORD> windowsGeneration(0);
+
+// The cache is used only by the thread which locks the language, i.e. the UI thread
+static DWORD cachedThreadId = 0;
+static HWND cachedWindow = NULL;
+static DWORD cachedGeneration = 0;
+
+void SetWindowSource(const WindowSource* source) {
+	windowSource = source ? source : &defaultWindowSource;
+	InvalidateMainThread();
+}
+
+void InvalidateMainThread() {
+	windowsGeneration.fetch_add(1, std::memory_order_release);
+}
+
+// The owners of the windows found so far
+struct Candidates {
+	DWORD currentThreadId;
+
+	// the thread which owns visible windows, and whether other threads own visible windows too
+	DWORD visibleThreadId;
+	HWND visibleWindow;
+	bool multipleVisible;
+
+	// the same for any (including hidden) windows
+	DWORD anyThreadId;
+	HWND anyWindow;
+	bool multipleAny;
+
+	// a window of the current thread, and whether it is visible
+	HWND currentWindow;
+	bool currentVisible;
+};
+
+static bool AddCandidateWindow(const WindowInfo& window, void* context) {
+	Candidates* c = (Candidates*)context;
+	if (window.threadId == c->currentThreadId && (!c->currentWindow || window.visible)) {
+		c->currentWindow = window.hwnd;
+		c->currentVisible = window.visible;
+	}
+	if (window.visible) {
+		if (!c->visibleThreadId) {
+			c->visibleThreadId = window.threadId;
+			c->visibleWindow = window.hwnd;
+		}
+		else if (c->visibleThreadId != window.threadId) {
+			c->multipleVisible = true;
+		}
+	}
+	if (!c->anyThreadId) {
+		c->anyThreadId = window.threadId;
+		c->anyWindow = window.hwnd;
+	}
+	else if (c->anyThreadId != window.threadId) {
+		c->multipleAny = true;
+	}
+
+	// the current thread with a visible window is the best choice, no need to look further
+	return !c->currentVisible;
+}
+
+//
+// Detects the main thread by the windows of the process. Usually, many threads (like COM or IME ones) own
+// hidden windows, but only one thread owns the visible ones. So, the preferred thread is:
+//  - the current thread, if it owns visible windows
+//  - the single thread which owns visible windows
+//  - the current thread, if it owns any windows while there are no visible ones
+//  - the single thread which owns windows
+// Otherwise, the main thread is not detected.
+//
+static DWORD DetectMainThreadByWindows(HWND& window) {
+	Candidates c = {};
+	c.currentThreadId = platform->getCurrentThreadId();
+	windowSource->enumWindows(&AddCandidateWindow, &c);
+
+	if (c.currentVisible) {
+		window = c.currentWindow;
+		return c.currentThreadId;
+	}
+	if (c.visibleThreadId) {
+		if (c.multipleVisible) {
+			Log("Multiple threads with visible windows found, give up...");
+			return 0;
+		}
+		window = c.visibleWindow;
+		return c.visibleThreadId;
+	}
+	if (c.currentWindow) {
+		window = c.currentWindow;
+		return c.currentThreadId;
+	}
+	if (c.multipleAny) {
+		Log("Multiple threads with hidden windows found, give up...");
+		return 0;
+	}
+	window = c.anyWindow;
+	return c.anyThreadId;
+}
+
+DWORD FindMainThread() {
+	DWORD generation = windowsGeneration.load(std::memory_order_acquire);
+	if (cachedThreadId && cachedGeneration == generation && windowSource->getWindowThread(cachedWindow) == cachedThreadId) {
+		return cachedThreadId;
+	}
+
+	HWND window = NULL;
+	DWORD threadId = DetectMainThreadByWindows(window);
+
+	// if invalidated during the detection, the result is used, but not cached
+	cachedThreadId = threadId;
+	cachedWindow = window;
+	cachedGeneration = generation;
+	return threadId;
+}
+
+struct WindowThreads {
+	DWORD* threadIds;
+	int count;
+	int maxCount;
+};
+
+static bool AddWindowThread(const WindowInfo& window, void* context) {
+	WindowThreads* threads = (WindowThreads*)context;
+	if (!window.visible) {
+		return true;
+	}
+	for (int i = 0; i < threads->count; i++) {
+		if (threads->threadIds[i] == window.threadId) {
+			return true;
+		}
+	}
+	if (threads->count < threads->maxCount) {
+		threads->threadIds[threads->count++] = window.threadId;
+	}
+	return true;
+}
+
+int FindWindowThreads(DWORD* threadIds, int maxCount) {
+	WindowThreads threads = { threadIds, 0, maxCount };
+	windowSource->enumWindows(&AddWindowThread, &threads);
+	return threads.count;
+}
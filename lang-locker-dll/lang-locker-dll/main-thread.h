@@ -0,0 +1,45 @@
+/*
+ * main-thread.h : detection of the "main" thread, i.e. the thread which owns the windows of the process
+ * and runs the message loop.
+ *
+ * Only the top-level windows of the current process are enumerated. The detected thread is cached together
+ * with one of its windows, and the cache is invalidated when that window is destroyed, or when the shell
+ * hook reports creation or destruction of windows.
+ */
+
+#pragma once
+
+#include "os-types.h"
+
+// Top-level window passed to WindowCallback
+struct WindowInfo {
+	OsWindow hwnd;
+	OsDword threadId;
+	bool visible;
+};
+
+// Called for each enumerated window. Returns false to stop the enumeration
+typedef bool (*WindowCallback)(const WindowInfo& window, void* context);
+
+// The source of the windows used by the detection. May be replaced, e.g. by a synthetic one in benchmarks
+struct WindowSource {
+	// enumerates the top-level windows of the current process
+	void (*enumWindows)(WindowCallback callback, void* context);
+	// returns the thread which owns the window of the current process, or 0 if there is no such window anymore
+	OsDword (*getWindowThread)(OsWindow hwnd);
+};
+
+// The default source, based on EnumWindows(), see platform.cpp. It has no windows in the portable build
+extern const WindowSource defaultWindowSource;
+
+// Sets the source of the windows, NULL means the default one
+void SetWindowSource(const WindowSource* source);
+
+// Returns the main thread, either cached or detected anew, or 0 if failed to detect it
+DWORD FindMainThread();
+
+// Finds the threads which own visible windows of the process. Returns the number of the threads stored into the array
+int FindWindowThreads(DWORD* threadIds, int maxCount);
+
+// Makes the next FindMainThread() detect the main thread anew
+void InvalidateMainThread();
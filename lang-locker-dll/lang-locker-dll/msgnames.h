@@ -1,11 +1,20 @@
-#ifdef _DEBUG
+/*
+ * msgnames.h : names of the window messages and the shell hook codes, used for the debug logging.
+ *
+ * The names are looked up in the tables built at compile time from the lists below, so decoding of a message
+ * is a single array access, and the per-message tracing (LOG_LEVEL_TRACE) is cheap enough to leave it on.
+ */
 
-#define X(x) { x, #x },
-static struct WindowsMessage
+#if LANGLOCKER_LOG_LEVEL > LOG_LEVEL_NONE
+
+struct WindowsMessage
 {
-    int msgid;
-    char* pname;
-} WindowsMessages[] =
+	UINT msgid;
+	const char* pname;
+};
+
+#define X(x) { x, #x },
+static constexpr WindowsMessage WindowsMessages[] =
 {
 	X(WM_NULL)
 	X(WM_CREATE)
@@ -266,4 +275,120 @@ static struct WindowsMessage
 };
 #undef X
 
-#endif
\ No newline at end of file
+// The names of the system messages, i.e. ones below WM_USER, indexed by the message code
+struct MessageNamesTable {
+	const char* names[WM_USER];
+};
+
+constexpr bool EndsWith(const char* str, const char* suffix) {
+	size_t strLen = 0, suffixLen = 0;
+	while (str[strLen]) strLen++;
+	while (suffix[suffixLen]) suffixLen++;
+	if (strLen < suffixLen) {
+		return false;
+	}
+	for (size_t i = 0; i < suffixLen; i++) {
+		if (str[strLen - suffixLen + i] != suffix[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Names like WM_KEYFIRST or WM_MOUSELAST are aliases of the real messages, so they are used only if there are no others
+constexpr bool IsRangeAlias(const char* name) {
+	return EndsWith(name, "FIRST") || EndsWith(name, "LAST");
+}
+
+constexpr MessageNamesTable BuildMessageNamesTable() {
+	MessageNamesTable table = {};
+	for (size_t i = 0; i < sizeof(WindowsMessages) / sizeof(WindowsMessage); i++) {
+		const WindowsMessage& msg = WindowsMessages[i];
+		if (msg.msgid < WM_USER) {
+			const char* prev = table.names[msg.msgid];
+			if (!prev || (IsRangeAlias(prev) && !IsRangeAlias(msg.pname))) {
+				table.names[msg.msgid] = msg.pname;
+			}
+		}
+	}
+	return table;
+}
+
+static constexpr MessageNamesTable MessageNames = BuildMessageNamesTable();
+
+static_assert(MessageNames.names[WM_INPUTLANGCHANGE] != nullptr && MessageNames.names[WM_INPUTLANGCHANGEREQUEST] != nullptr,
+	"Input language messages shall be named");
+static_assert(MessageNames.names[WM_KEYDOWN][6] == 'D' && MessageNames.names[WM_MOUSEMOVE][8] == 'M',
+	"Range aliases shall not hide the names of the messages");
+
+// The names of the shell hook codes, indexed by the code without HSHELL_HIGHBIT
+static constexpr const char* ShellEventNames[] =
+{
+	nullptr,
+	"HSHELL_WINDOWCREATED",
+	"HSHELL_WINDOWDESTROYED",
+	"HSHELL_ACTIVATESHELLWINDOW",
+	"HSHELL_WINDOWACTIVATED",
+	"HSHELL_GETMINRECT",
+	"HSHELL_REDRAW",
+	"HSHELL_TASKMAN",
+	"HSHELL_LANGUAGE",
+	"HSHELL_SYSMENU",
+	"HSHELL_ENDTASK",
+	"HSHELL_ACCESSIBILITYSTATE",
+	"HSHELL_APPCOMMAND",
+	"HSHELL_WINDOWREPLACED",
+	"HSHELL_WINDOWREPLACING",
+	nullptr,
+	"HSHELL_MONITORCHANGED"
+};
+
+static_assert(HSHELL_WINDOWACTIVATED == 4 && HSHELL_LANGUAGE == 8 && HSHELL_APPCOMMAND == 12,
+	"Unexpected values of the shell hook codes");
+
+// Returns the name of the system message, or NULL if unknown
+inline const char* GetMessageName(UINT message) {
+	return message < WM_USER ? MessageNames.names[message] : NULL;
+}
+
+// Writes the message name and the decoded parameters into the buffer
+inline void FormatWindowMessage(char* buf, size_t size, UINT message, WPARAM wParam, LPARAM lParam) {
+	const char* name = GetMessageName(message);
+	if (message == WM_INPUTLANGCHANGEREQUEST) {
+		_snprintf_s(buf, size, _TRUNCATE, "%s(hkl=0x%p%s%s%s)", name, (HKL)lParam,
+			(wParam & INPUTLANGCHANGE_SYSCHARSET) ? ", SYSCHARSET" : "",
+			(wParam & INPUTLANGCHANGE_FORWARD) ? ", FORWARD" : "",
+			(wParam & INPUTLANGCHANGE_BACKWARD) ? ", BACKWARD" : "");
+	} else if (message == WM_INPUTLANGCHANGE) {
+		_snprintf_s(buf, size, _TRUNCATE, "%s(hkl=0x%p, charset=%u)", name, (HKL)lParam, (UINT)wParam);
+	} else if (name) {
+		_snprintf_s(buf, size, _TRUNCATE, "%s(0x%p, 0x%p)", name, (void*)wParam, (void*)lParam);
+	} else if (message < WM_USER) {
+		_snprintf_s(buf, size, _TRUNCATE, "WM_0x%04X(0x%p, 0x%p)", message, (void*)wParam, (void*)lParam);
+	} else if (message < WM_APP) {
+		_snprintf_s(buf, size, _TRUNCATE, "WM_USER+%u(0x%p, 0x%p)", message - WM_USER, (void*)wParam, (void*)lParam);
+	} else if (message < 0xC000) {
+		_snprintf_s(buf, size, _TRUNCATE, "WM_APP+%u(0x%p, 0x%p)", message - WM_APP, (void*)wParam, (void*)lParam);
+	} else {
+		// registered by RegisterWindowMessage()
+		_snprintf_s(buf, size, _TRUNCATE, "WM_REGISTERED_0x%04X(0x%p, 0x%p)", message, (void*)wParam, (void*)lParam);
+	}
+}
+
+// Writes the shell hook code name and the decoded parameters into the buffer
+inline void FormatShellEvent(char* buf, size_t size, int code, WPARAM wParam, LPARAM lParam) {
+	UINT index = (UINT)code & ~HSHELL_HIGHBIT;
+	const char* name = index < sizeof(ShellEventNames) / sizeof(ShellEventNames[0]) ? ShellEventNames[index] : NULL;
+	const char* highBit = (code & HSHELL_HIGHBIT) ? "|HSHELL_HIGHBIT" : "";
+	if (!name) {
+		_snprintf_s(buf, size, _TRUNCATE, "HSHELL_%d(0x%p, 0x%p)", code, (void*)wParam, (void*)lParam);
+	} else if (index == HSHELL_LANGUAGE) {
+		_snprintf_s(buf, size, _TRUNCATE, "%s%s(hwnd=0x%p, hkl=0x%p)", name, highBit, (HWND)wParam, (HKL)lParam);
+	} else if (index == HSHELL_WINDOWACTIVATED) {
+		_snprintf_s(buf, size, _TRUNCATE, "%s%s(hwnd=0x%p, fullscreen=%d)", name, highBit, (HWND)wParam, lParam != 0);
+	} else {
+		_snprintf_s(buf, size, _TRUNCATE, "%s%s(0x%p, 0x%p)", name, highBit, (void*)wParam, (void*)lParam);
+	}
+}
+
+#endif
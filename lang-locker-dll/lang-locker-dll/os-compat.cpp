@@ -0,0 +1,131 @@
+/*
+ * os-compat.cpp : the process-level functions of the portable build, see os-compat.h
+ */
+
+#include "stdafx.h"
+#include <stdlib.h>
+#include <unistd.h>
+#include <chrono>
+#include <condition_variable>
+#include <thread>
+
+static thread_local DWORD lastError = 0;
+
+// the ids are assigned at the first call in each thread, and are never reused
+static std::atomic<DWORD> lastThreadId(0);
+static thread_local DWORD currentThreadId = 0;
+
+DWORD GetLastError() {
+	return lastError;
+}
+
+void SetLastError(DWORD error) {
+	lastError = error;
+}
+
+DWORD GetCurrentThreadId() {
+	if (!currentThreadId) {
+		currentThreadId = lastThreadId.fetch_add(1, std::memory_order_relaxed) + 1;
+	}
+	return currentThreadId;
+}
+
+DWORD GetCurrentProcessId() {
+	return (DWORD)getpid();
+}
+
+void Sleep(DWORD ms) {
+	std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+DWORD GetTickCount() {
+	return (DWORD)std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+BOOL QueryPerformanceCounter(LARGE_INTEGER* counter) {
+	counter->QuadPart = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+	return TRUE;
+}
+
+BOOL QueryPerformanceFrequency(LARGE_INTEGER* frequency) {
+	frequency->QuadPart = 1000000000LL;
+	return TRUE;
+}
+
+DWORD GetEnvironmentVariableA(const char* name, char* buf, DWORD size) {
+	const char* value = getenv(name);
+	if (!value) {
+		return 0;
+	}
+	// like Windows, returns the required size including the terminating zero, if the buffer is too small
+	DWORD len = (DWORD)strlen(value);
+	if (len >= size) {
+		return len + 1;
+	}
+	memcpy(buf, value, len + 1);
+	return len;
+}
+
+void YieldProcessor() {
+	std::this_thread::yield();
+}
+
+BOOL InitOnceExecuteOnce(PINIT_ONCE initOnce, PINIT_ONCE_FN initFn, PVOID param, PVOID* context) {
+	BOOL result = TRUE;
+	std::call_once(initOnce->flag, [&]() { result = initFn(initOnce, param, context); });
+	return result;
+}
+
+struct CompatEvent {
+	std::mutex mutex;
+	std::condition_variable signaled;
+	bool set;
+};
+
+HANDLE CreateEventA(void* attributes, BOOL manualReset, BOOL initialState, const char* name) {
+	if (manualReset || name) {
+		SetLastError(ERROR_NOT_SUPPORTED);
+		return NULL;
+	}
+	CompatEvent* event = new CompatEvent();
+	event->set = initialState != FALSE;
+	return event;
+}
+
+BOOL SetEvent(HANDLE handle) {
+	CompatEvent* event = (CompatEvent*)handle;
+	std::lock_guard<std::mutex> guard(event->mutex);
+	event->set = true;
+	event->signaled.notify_one();
+	return TRUE;
+}
+
+DWORD WaitForSingleObject(HANDLE handle, DWORD timeoutMs) {
+	CompatEvent* event = (CompatEvent*)handle;
+	std::unique_lock<std::mutex> guard(event->mutex);
+	if (timeoutMs == INFINITE) {
+		event->signaled.wait(guard, [event]() { return event->set; });
+	}
+	else if (!event->signaled.wait_for(guard, std::chrono::milliseconds(timeoutMs), [event]() { return event->set; })) {
+		return WAIT_TIMEOUT;
+	}
+	// auto-reset
+	event->set = false;
+	return WAIT_OBJECT_0;
+}
+
+BOOL CloseHandle(HANDLE handle) {
+	delete (CompatEvent*)handle;
+	return TRUE;
+}
+
+int _snprintf_s(char* buf, size_t size, size_t count, const char* format, ...) {
+	va_list args;
+	va_start(args, format);
+	int len = vsnprintf(buf, size, format, args);
+	va_end(args);
+	// like _TRUNCATE, the truncated text is kept, but reported by -1
+	return len < 0 || (size_t)len >= size ? -1 : len;
+}
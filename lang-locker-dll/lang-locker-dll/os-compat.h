@@ -0,0 +1,199 @@
+/*
+ * os-compat.h : the subset of Windows API used by the lock logic, for the portable build (see CMakeLists.txt).
+ *
+ * The lock logic gets the layouts, the hooks, the timers and the windows only through the tables of platform.h
+ * and main-thread.h, so here are just the Windows types and constants it uses, and the process-level functions
+ * (the thread ids, the time, the critical sections and the events), implemented in os-compat.cpp.
+ *
+ * NOTE: this header is used only off Windows, instead of windows.h
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mutex>
+#include "os-types.h"
+
+#define WINAPI OS_API
+#define CALLBACK OS_API
+
+typedef void VOID;
+typedef int BOOL;
+typedef unsigned char BYTE;
+typedef uint16_t WORD;
+typedef short SHORT;
+typedef int32_t LONG;
+typedef unsigned UINT;
+typedef OsDword DWORD;
+typedef unsigned long long ULONGLONG;
+typedef WORD LANGID;
+typedef OsUintPtr UINT_PTR;
+typedef OsUintPtr ULONG_PTR;
+typedef OsIntPtr LONG_PTR;
+typedef OsUintPtr WPARAM;
+typedef OsIntPtr LPARAM;
+typedef OsIntPtr LRESULT;
+typedef void* HANDLE;
+typedef void* HMODULE;
+typedef void* PVOID;
+typedef void* LPVOID;
+typedef const char* LPCSTR;
+typedef OsLayout HKL;
+typedef OsWindow HWND;
+typedef OsHook HHOOK;
+typedef OsHookProc HOOKPROC;
+typedef OsTimerProc TIMERPROC;
+
+#define TRUE 1
+#define FALSE 0
+#define MAX_PATH 260
+#define INFINITE 0xFFFFFFFF
+
+#define LOWORD(l) ((WORD)((ULONG_PTR)(l) & 0xffff))
+#define HIWORD(l) ((WORD)(((ULONG_PTR)(l) >> 16) & 0xffff))
+#define PRIMARYLANGID(lgid) ((WORD)((WORD)(lgid) & 0x3ff))
+#define LANG_ENGLISH 0x09
+
+struct POINT {
+	LONG x;
+	LONG y;
+};
+
+struct MSG {
+	HWND hwnd;
+	UINT message;
+	WPARAM wParam;
+	LPARAM lParam;
+	DWORD time;
+	POINT pt;
+};
+typedef MSG* PMSG;
+
+union LARGE_INTEGER {
+	struct {
+		DWORD LowPart;
+		LONG HighPart;
+	};
+	long long QuadPart;
+};
+
+//
+// The messages, the hooks and the window queries
+//
+#define WM_NULL                     0x0000
+#define WM_DESTROY                  0x0002
+#define WM_ACTIVATE                 0x0006
+#define WM_PAINT                    0x000F
+#define WM_INPUTLANGCHANGEREQUEST   0x0050
+#define WM_INPUTLANGCHANGE          0x0051
+#define WM_KEYFIRST                 0x0100
+#define WM_KEYDOWN                  0x0100
+#define WM_KEYUP                    0x0101
+#define WM_CHAR                     0x0102
+#define WM_SYSKEYDOWN               0x0104
+#define WM_KEYLAST                  0x0109
+#define WM_TIMER                    0x0113
+#define WM_MOUSEFIRST               0x0200
+#define WM_MOUSEMOVE                0x0200
+#define WM_MOUSELAST                0x020E
+#define WM_USER                     0x0400
+#define WM_APP                      0x8000
+
+#define HSHELL_WINDOWCREATED        1
+#define HSHELL_WINDOWDESTROYED      2
+#define HSHELL_WINDOWACTIVATED      4
+#define HSHELL_LANGUAGE             8
+#define HSHELL_APPCOMMAND           12
+#define HSHELL_HIGHBIT              0x8000
+
+#define WH_KEYBOARD                 2
+#define WH_GETMESSAGE               3
+#define WH_SHELL                    10
+#define HC_ACTION                   0
+#define PM_REMOVE                   0x0001
+
+#define KLF_ACTIVATE                0x00000001
+#define KLF_SUBSTITUTE_OK           0x00000002
+#define KLF_SETFORPROCESS           0x00000100
+
+#define GA_PARENT                   1
+#define GA_ROOT                     2
+#define GW_OWNER                    4
+#define GWL_STYLE                   (-16)
+#define WS_CHILD                    0x40000000L
+
+#define VK_SHIFT                    0x10
+#define VK_CONTROL                  0x11
+#define VK_MENU                     0x12
+#define VK_CAPITAL                  0x14
+#define MAPVK_VSC_TO_VK             1
+
+#define ERROR_SUCCESS               0
+#define ERROR_NOT_SUPPORTED         50
+#define ERROR_INVALID_PARAMETER     87
+#define ERROR_CALL_NOT_IMPLEMENTED  120
+
+//
+// The process-level functions, see os-compat.cpp
+//
+DWORD GetLastError();
+void SetLastError(DWORD error);
+DWORD GetCurrentThreadId();
+DWORD GetCurrentProcessId();
+void Sleep(DWORD ms);
+DWORD GetTickCount();
+BOOL QueryPerformanceCounter(LARGE_INTEGER* counter);
+BOOL QueryPerformanceFrequency(LARGE_INTEGER* frequency);
+DWORD GetEnvironmentVariableA(const char* name, char* buf, DWORD size);
+
+void YieldProcessor();
+
+// The recursive lock of the calling thread, like the Windows one
+struct CRITICAL_SECTION {
+	std::recursive_mutex mutex;
+};
+
+inline void InitializeCriticalSection(CRITICAL_SECTION* section) {}
+inline void EnterCriticalSection(CRITICAL_SECTION* section) { section->mutex.lock(); }
+inline void LeaveCriticalSection(CRITICAL_SECTION* section) { section->mutex.unlock(); }
+
+struct INIT_ONCE {
+	std::once_flag flag;
+};
+typedef INIT_ONCE* PINIT_ONCE;
+typedef BOOL (*PINIT_ONCE_FN)(PINIT_ONCE initOnce, PVOID param, PVOID* context);
+
+#define INIT_ONCE_STATIC_INIT {}
+
+BOOL InitOnceExecuteOnce(PINIT_ONCE initOnce, PINIT_ONCE_FN initFn, PVOID param, PVOID* context);
+
+// The auto-reset events only, which are enough for the wakeups of the consumer threads
+HANDLE CreateEventA(void* attributes, BOOL manualReset, BOOL initialState, const char* name);
+BOOL SetEvent(HANDLE event);
+DWORD WaitForSingleObject(HANDLE event, DWORD timeoutMs);
+BOOL CloseHandle(HANDLE event);
+
+#define WAIT_OBJECT_0 0
+#define WAIT_TIMEOUT 258
+#define WAIT_FAILED 0xFFFFFFFF
+
+//
+// The secure CRT functions
+//
+#define _TRUNCATE ((size_t)-1)
+
+int _snprintf_s(char* buf, size_t size, size_t count, const char* format, ...);
+
+inline unsigned long long _strtoui64(const char* str, char** end, int base) {
+	return strtoull(str, end, base);
+}
+
+template <size_t size>
+inline int strcpy_s(char (&dest)[size], const char* src) {
+	snprintf(dest, size, "%s", src);
+	return 0;
+}
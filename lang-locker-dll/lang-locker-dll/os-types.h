@@ -0,0 +1,41 @@
+/*
+ * os-types.h : the OS types used by the interfaces to the OS, see platform.h and main-thread.h.
+ *
+ * On Windows, these are the Windows types, so that the default tables refer to the Windows functions directly.
+ * Elsewhere, these are portable types of the same size.
+ *
+ * NOTE: this header does not depend on Windows headers, except on Windows.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#ifdef _WIN32
+
+typedef DWORD OsDword;
+typedef UINT_PTR OsUintPtr;
+typedef LONG_PTR OsIntPtr;
+typedef HKL OsLayout;
+typedef HWND OsWindow;
+typedef HHOOK OsHook;
+typedef HOOKPROC OsHookProc;
+typedef TIMERPROC OsTimerProc;
+
+// the calling convention of Windows API
+#define OS_API WINAPI
+
+#else
+
+typedef uint32_t OsDword;
+typedef uintptr_t OsUintPtr;
+typedef intptr_t OsIntPtr;
+typedef struct OsLayout__* OsLayout;
+typedef struct OsWindow__* OsWindow;
+typedef struct OsHook__* OsHook;
+typedef OsIntPtr (*OsHookProc)(int nCode, OsUintPtr wParam, OsIntPtr lParam);
+typedef void (*OsTimerProc)(OsWindow hwnd, unsigned message, OsUintPtr timerId, OsDword time);
+
+#define OS_API
+
+#endif
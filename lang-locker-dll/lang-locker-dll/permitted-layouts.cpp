@@ -0,0 +1,105 @@
+/*
+ * permitted-layouts.cpp : the set of the layouts permitted by the lock, see permitted-layouts.h
+ */
+
+#include "stdafx.h"
+#include "lang-locker.h"
+#include "permitted-layouts.h"
+
+// The count is published last, and reset first when the set is changed
+static std::atomic<uint32_t> permittedLayouts[MAX_PERMITTED_LAYOUTS];
+static std::atomic<int> permittedCount(0);
+static std::atomic<uint16_t> permittedPrimaryLanguage(0);
+
+bool SetPermittedLayouts(const HKL* layouts, int count, LANGID primaryLanguage) {
+	permittedCount.store(0, std::memory_order_release);
+	permittedPrimaryLanguage.store(0, std::memory_order_release);
+
+	// the insertion sort of the unique layouts
+	uint32_t sorted[MAX_PERMITTED_LAYOUTS];
+	int n = 0;
+	bool fits = true;
+	for (int i = 0; i < count; i++) {
+		uint32_t layout = HKLToLayout(layouts[i]);
+		int pos = n;
+		while (pos > 0 && sorted[pos - 1] > layout) {
+			pos--;
+		}
+		if (!layout || (pos > 0 && sorted[pos - 1] == layout)) {
+			continue;
+		}
+		if (n == MAX_PERMITTED_LAYOUTS) {
+			fits = false;
+			break;
+		}
+		for (int j = n; j > pos; j--) {
+			sorted[j] = sorted[j - 1];
+		}
+		sorted[pos] = layout;
+		n++;
+	}
+
+	for (int i = 0; i < n; i++) {
+		permittedLayouts[i].store(sorted[i], std::memory_order_relaxed);
+	}
+	permittedPrimaryLanguage.store(PRIMARYLANGID(primaryLanguage), std::memory_order_release);
+	permittedCount.store(n, std::memory_order_release);
+	if (n || primaryLanguage) {
+		Log("Permitted layouts set: ", (DWORD)n);
+	}
+	return fits;
+}
+
+int GetPermittedLayouts(uint32_t* layouts, LANGID& primaryLanguage) {
+	primaryLanguage = permittedPrimaryLanguage.load(std::memory_order_acquire);
+	int count = permittedCount.load(std::memory_order_acquire);
+	for (int i = 0; i < count; i++) {
+		layouts[i] = permittedLayouts[i].load(std::memory_order_relaxed);
+	}
+	return count;
+}
+
+bool HasPermittedLayouts() {
+	return permittedCount.load(std::memory_order_acquire) || permittedPrimaryLanguage.load(std::memory_order_acquire);
+}
+
+bool IsPermittedLayout(uint32_t layout) {
+	uint16_t primaryLanguage = permittedPrimaryLanguage.load(std::memory_order_acquire);
+	if (primaryLanguage && PRIMARYLANGID(LOWORD(layout)) == primaryLanguage) {
+		return true;
+	}
+
+	// binary search in the sorted layouts
+	int low = 0;
+	int high = permittedCount.load(std::memory_order_acquire) - 1;
+	while (low <= high) {
+		int mid = (low + high) / 2;
+		uint32_t midLayout = permittedLayouts[mid].load(std::memory_order_relaxed);
+		if (midLayout == layout) {
+			return true;
+		}
+		if (midLayout < layout) {
+			low = mid + 1;
+		}
+		else {
+			high = mid - 1;
+		}
+	}
+	return false;
+}
+
+HKL FindPermittedLayout(HKL languageHandle) {
+	if (languageHandle && IsPermittedLayout(HKLToLayout(languageHandle))) {
+		return languageHandle;
+	}
+	// the first permitted one in the order of the system list
+	InstalledLayout layouts[MAX_INSTALLED_LAYOUTS];
+	int count = GetIndexedLayouts(layouts, MAX_INSTALLED_LAYOUTS);
+	for (int i = 0; i < count; i++) {
+		HKL layout = (HKL)(LONG_PTR)layouts[i].handle;
+		if (IsPermittedLayout(HKLToLayout(layout))) {
+			return layout;
+		}
+	}
+	return 0;
+}
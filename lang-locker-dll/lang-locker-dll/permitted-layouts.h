@@ -0,0 +1,31 @@
+/*
+ * permitted-layouts.h : the set of the layouts permitted by the lock, see LockInputLanguageSet().
+ *
+ * The layouts of the set are interchangeable, like English-US, English-UK and Dvorak: a switch between them is
+ * not reverted, and the one switched to becomes the locked layout, so a switch out of the set is reverted to
+ * the most recently used permitted layout. The set is a sorted array of the layouts, and optionally a primary
+ * language which permits all its layouts, including those installed later. The set is changed only by the lock
+ * functions, and read by the hooks without locks; while it is changed, the hooks see an empty set, i.e. the
+ * strict lock of the single layout.
+ */
+
+#pragma once
+
+const int MAX_PERMITTED_LAYOUTS = 16;
+
+// Sets the permitted layouts and the primary language (if not 0), or clears the set if both are empty.
+// Returns false if there are too many layouts; the first MAX_PERMITTED_LAYOUTS ones are permitted then
+bool SetPermittedLayouts(const HKL* layouts, int count, LANGID primaryLanguage);
+
+// Copies the permitted layouts into the array of MAX_PERMITTED_LAYOUTS, and returns their number. Also returns
+// the primary language (primary language ID only), or 0 if none
+int GetPermittedLayouts(uint32_t* layouts, LANGID& primaryLanguage);
+
+// Whether the set of the permitted layouts is not empty
+bool HasPermittedLayouts();
+
+// Whether the layout is in the set of the permitted ones
+bool IsPermittedLayout(uint32_t layout);
+
+// Returns the specified layout if it is permitted, or the first installed permitted layout, or 0 if none
+HKL FindPermittedLayout(HKL languageHandle);
@@ -0,0 +1,235 @@
+/*
+ * platform.cpp : the default implementation of the OS functions and of the window source, see platform.h
+ * and main-thread.h
+ */
+
+#include "stdafx.h"
+#include "lang-locker.h"
+#include "platform.h"
+#include "main-thread.h"
+
+#ifdef _WIN32
+
+static HHOOK WINAPI SetModuleWindowsHook(int hookType, HOOKPROC proc, DWORD threadId) {
+	return SetWindowsHookEx(hookType, proc, module, threadId);
+}
+
+static LRESULT WINAPI CallNextWindowsHook(int nCode, WPARAM wParam, LPARAM lParam) {
+	return CallNextHookEx(NULL, nCode, wParam, lParam);
+}
+
+static UINT_PTR WINAPI SetWindowsThreadTimer(UINT elapseMs, TIMERPROC proc) {
+	return SetTimer(NULL, 0, elapseMs, proc);
+}
+
+static BOOL WINAPI KillWindowsThreadTimer(UINT_PTR timerId) {
+	return KillTimer(NULL, timerId);
+}
+
+static LONG_PTR WINAPI GetWindowLongPtrValue(HWND hwnd, int index) {
+	// a macro for GetWindowLongA() in 32-bit Windows
+	return GetWindowLongPtrA(hwnd, index);
+}
+
+static const Platform defaultPlatform = {
+	ActivateKeyboardLayout,
+	GetKeyboardLayout,
+	GetKeyboardLayoutList,
+	SetModuleWindowsHook,
+	UnhookWindowsHookEx,
+	CallNextWindowsHook,
+	SetWindowsThreadTimer,
+	KillWindowsThreadTimer,
+	GetCurrentThreadId,
+	GetFocus,
+	GetTickCount,
+	RegisterWindowMessageA,
+	PostThreadMessageA,
+	PostMessageW,
+	GetForegroundWindow,
+	GetWindowThreadProcessId,
+	IsWindow,
+	GetAncestor,
+	GetWindow,
+	GetWindowLongPtrValue,
+	GetClassNameA,
+	GetWindowTextA,
+	GetKeyState,
+	MapVirtualKeyExW,
+	ToUnicodeEx,
+};
+
+struct EnumWindowsContext {
+	DWORD processId;
+	WindowCallback callback;
+	void* context;
+};
+
+static BOOL CALLBACK EnumProcessWindowsProc(HWND hwnd, LPARAM lParam) {
+	EnumWindowsContext* ctx = (EnumWindowsContext*)lParam;
+	DWORD processId = 0;
+	DWORD threadId = GetWindowThreadProcessId(hwnd, &processId);
+	if (processId != ctx->processId) {
+		return TRUE;
+	}
+	WindowInfo window = { hwnd, threadId, IsWindowVisible(hwnd) != FALSE };
+	return ctx->callback(window, ctx->context);
+}
+
+static void EnumProcessWindows(WindowCallback callback, void* context) {
+	EnumWindowsContext ctx = { GetCurrentProcessId(), callback, context };
+	EnumWindows(&EnumProcessWindowsProc, (LPARAM)&ctx);
+}
+
+static DWORD GetProcessWindowThread(HWND hwnd) {
+	DWORD processId = 0;
+	DWORD threadId = GetWindowThreadProcessId(hwnd, &processId);
+	return processId == GetCurrentProcessId() ? threadId : 0;
+}
+
+const WindowSource defaultWindowSource = { EnumProcessWindows, GetProcessWindowThread };
+
+#else
+
+//
+// The portable build has no layouts, hooks or windows of its own, so the lock functions fail until the table
+// is replaced, e.g. by the simulated OS of lang-locker-bench
+//
+
+static HKL NoActivateKeyboardLayout(HKL languageHandle, UINT flags) {
+	SetLastError(ERROR_NOT_SUPPORTED);
+	return NULL;
+}
+
+static HKL NoGetKeyboardLayout(DWORD threadId) {
+	return NULL;
+}
+
+static int NoGetKeyboardLayoutList(int maxCount, HKL* languageHandles) {
+	return 0;
+}
+
+static HHOOK NoSetWindowsHook(int hookType, HOOKPROC proc, DWORD threadId) {
+	SetLastError(ERROR_NOT_SUPPORTED);
+	return NULL;
+}
+
+static BOOL NoUnhookWindowsHook(HHOOK hook) {
+	SetLastError(ERROR_INVALID_PARAMETER);
+	return FALSE;
+}
+
+static LRESULT NoCallNextHook(int nCode, WPARAM wParam, LPARAM lParam) {
+	return 0;
+}
+
+static UINT_PTR NoSetThreadTimer(UINT elapseMs, TIMERPROC proc) {
+	SetLastError(ERROR_NOT_SUPPORTED);
+	return 0;
+}
+
+static BOOL NoKillThreadTimer(UINT_PTR timerId) {
+	SetLastError(ERROR_INVALID_PARAMETER);
+	return FALSE;
+}
+
+static HWND NoWindow() {
+	return NULL;
+}
+
+static UINT NoRegisterWindowMessage(const char* name) {
+	SetLastError(ERROR_NOT_SUPPORTED);
+	return 0;
+}
+
+static BOOL NoPostThreadMessage(DWORD threadId, UINT message, WPARAM wParam, LPARAM lParam) {
+	SetLastError(ERROR_NOT_SUPPORTED);
+	return FALSE;
+}
+
+static BOOL NoPostMessage(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam) {
+	SetLastError(ERROR_NOT_SUPPORTED);
+	return FALSE;
+}
+
+static DWORD NoGetWindowThreadProcessId(HWND hwnd, DWORD* processId) {
+	return 0;
+}
+
+static BOOL NoIsWindow(HWND hwnd) {
+	return FALSE;
+}
+
+static HWND NoGetRelatedWindow(HWND hwnd, UINT flags) {
+	return NULL;
+}
+
+static LONG_PTR NoGetWindowLongPtr(HWND hwnd, int index) {
+	return 0;
+}
+
+static int NoGetWindowString(HWND hwnd, char* text, int maxCount) {
+	if (maxCount > 0) {
+		text[0] = 0;
+	}
+	return 0;
+}
+
+static SHORT NoGetKeyState(int virtualKey) {
+	return 0;
+}
+
+static UINT NoMapVirtualKey(UINT code, UINT mapType, HKL languageHandle) {
+	return 0;
+}
+
+static int NoToUnicode(UINT virtualKey, UINT scanCode, const BYTE* keyState, wchar_t* buf, int bufSize,
+		UINT flags, HKL languageHandle) {
+	return 0;
+}
+
+static const Platform defaultPlatform = {
+	NoActivateKeyboardLayout,
+	NoGetKeyboardLayout,
+	NoGetKeyboardLayoutList,
+	NoSetWindowsHook,
+	NoUnhookWindowsHook,
+	NoCallNextHook,
+	NoSetThreadTimer,
+	NoKillThreadTimer,
+	GetCurrentThreadId,
+	NoWindow,
+	GetTickCount,
+	NoRegisterWindowMessage,
+	NoPostThreadMessage,
+	NoPostMessage,
+	NoWindow,
+	NoGetWindowThreadProcessId,
+	NoIsWindow,
+	NoGetRelatedWindow,
+	NoGetRelatedWindow,
+	NoGetWindowLongPtr,
+	NoGetWindowString,
+	NoGetWindowString,
+	NoGetKeyState,
+	NoMapVirtualKey,
+	NoToUnicode,
+};
+
+static void NoEnumWindows(WindowCallback callback, void* context) {
+}
+
+static DWORD NoGetWindowThread(HWND hwnd) {
+	return 0;
+}
+
+const WindowSource defaultWindowSource = { NoEnumWindows, NoGetWindowThread };
+
+#endif
+
+const Platform* platform = &defaultPlatform;
+
+void SetPlatform(const Platform* newPlatform) {
+	platform = newPlatform ? newPlatform : &defaultPlatform;
+	InvalidateLayoutIndex();
+}
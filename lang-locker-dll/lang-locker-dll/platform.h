@@ -0,0 +1,63 @@
+/*
+ * platform.h : the OS functions used by the locking logic, called through a replaceable table.
+ *
+ * By default, the table calls the corresponding Windows functions. It may be replaced by a simulated OS, e.g. by
+ * the one in lang-locker-bench, which runs the lock functions and the hooks deterministically in a single thread.
+ * The window enumeration used by the detection of the main thread is replaced separately, see main-thread.h.
+ *
+ * In the portable build (see os-compat.h), the default table has no layouts, hooks or windows, so it is always
+ * replaced, e.g. by the simulated OS.
+ */
+
+#pragma once
+
+#include "os-types.h"
+
+// The functions use the calling convention of Windows API, so that the default table refers to it directly
+struct Platform {
+	// keyboard layouts, like ActivateKeyboardLayout(), GetKeyboardLayout() and GetKeyboardLayoutList()
+	OsLayout (OS_API *activateKeyboardLayout)(OsLayout languageHandle, unsigned flags);
+	OsLayout (OS_API *getKeyboardLayout)(OsDword threadId);
+	int (OS_API *getKeyboardLayoutList)(int maxCount, OsLayout* languageHandles);
+
+	// local hooks, like SetWindowsHookEx() for the DLL module, UnhookWindowsHookEx() and CallNextHookEx()
+	OsHook (OS_API *setWindowsHook)(int hookType, OsHookProc proc, OsDword threadId);
+	int (OS_API *unhookWindowsHook)(OsHook hook);
+	OsIntPtr (OS_API *callNextHook)(int nCode, OsUintPtr wParam, OsIntPtr lParam);
+
+	// thread timers, like SetTimer() and KillTimer() with no window
+	OsUintPtr (OS_API *setThreadTimer)(unsigned elapseMs, OsTimerProc proc);
+	int (OS_API *killThreadTimer)(OsUintPtr timerId);
+
+	OsDword (OS_API *getCurrentThreadId)();
+	OsWindow (OS_API *getFocus)();
+	OsDword (OS_API *getTickCount)();
+
+	// messages, like RegisterWindowMessageA(), PostThreadMessageA() and PostMessageW()
+	unsigned (OS_API *registerWindowMessage)(const char* name);
+	int (OS_API *postThreadMessage)(OsDword threadId, unsigned message, OsUintPtr wParam, OsIntPtr lParam);
+	int (OS_API *postMessage)(OsWindow hwnd, unsigned message, OsUintPtr wParam, OsIntPtr lParam);
+
+	// windows, like GetForegroundWindow(), GetWindowThreadProcessId(), IsWindow(), GetAncestor(), GetWindow(),
+	// GetWindowLongPtrA(), GetClassNameA() and GetWindowTextA()
+	OsWindow (OS_API *getForegroundWindow)();
+	OsDword (OS_API *getWindowThreadProcessId)(OsWindow hwnd, OsDword* processId);
+	int (OS_API *isWindow)(OsWindow hwnd);
+	OsWindow (OS_API *getAncestor)(OsWindow hwnd, unsigned flags);
+	OsWindow (OS_API *getWindow)(OsWindow hwnd, unsigned command);
+	OsIntPtr (OS_API *getWindowLongPtr)(OsWindow hwnd, int index);
+	int (OS_API *getClassName)(OsWindow hwnd, char* className, int maxCount);
+	int (OS_API *getWindowText)(OsWindow hwnd, char* text, int maxCount);
+
+	// keyboard, like GetKeyState(), MapVirtualKeyExW() and ToUnicodeEx()
+	short (OS_API *getKeyState)(int virtualKey);
+	unsigned (OS_API *mapVirtualKey)(unsigned code, unsigned mapType, OsLayout languageHandle);
+	int (OS_API *toUnicode)(unsigned virtualKey, unsigned scanCode, const unsigned char* keyState, wchar_t* buf,
+		int bufSize, unsigned flags, OsLayout languageHandle);
+};
+
+// The current OS functions, never NULL
+extern const Platform* platform;
+
+// Sets the OS functions, NULL means the default ones
+void SetPlatform(const Platform* newPlatform);
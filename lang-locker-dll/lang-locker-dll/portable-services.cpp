@@ -0,0 +1,55 @@
+/*
+ * portable-services.cpp : the services of the portable build which are based on the Windows file mappings, i.e.
+ * the trace (see trace.h), the shared lock (see shared-lock.h) and the lock state file (see lock-state-file.h).
+ *
+ * They are never enabled, like on Windows when their environment variables are not set.
+ */
+
+#include "stdafx.h"
+#include "lang-locker.h"
+#include "trace.h"
+#include "shared-lock.h"
+#include "lock-state-file.h"
+
+TraceFileHeader* traceHeader = NULL;
+
+void InitTrace() {
+}
+
+void CloseTrace() {
+}
+
+void WriteTraceRecord(TraceSource source, int hookCode, uint32_t message, uint32_t result,
+	WPARAM wParam, LPARAM lParam, LockStateWord state) {
+}
+
+SharedLockState* sharedLock = NULL;
+std::atomic<uint32_t> appliedSharedGeneration(0);
+
+void OpenSharedLock() {
+}
+
+void CloseSharedLock() {
+}
+
+void PublishSharedLock(HKL language) {
+}
+
+bool TakeSharedLockChange(HKL& language) {
+	return false;
+}
+
+void OpenLockStateFile() {
+}
+
+void CloseLockStateFile() {
+}
+
+void PersistLockState() {
+}
+
+void CancelLockRestore() {
+}
+
+void ApplyLockRestore() {
+}
@@ -0,0 +1,71 @@
+/*
+ * revert-scheduler.cpp : chooses the events at which the unwanted language switches are reverted,
+ * see revert-scheduler.h
+ */
+
+#include "stdafx.h"
+#include "lang-locker.h"
+#include "platform.h"
+#include "revert-scheduler.h"
+
+// a class is considered unsafe if it has at least this number of failures, and more failures than successes
+const uint32_t REVERT_UNSAFE_FAILURES = 2;
+
+// an unsafe class is still used for one of this number of the revert opportunities
+const uint32_t REVERT_RETRY_INTERVAL = 16;
+
+// when the number of the results of a class reaches this value, they are halved, so that the old results decay
+const uint32_t REVERT_RESULTS_LIMIT = 64;
+
+// The results of the reverts, per class. Changed by all hooked threads, but only at the reverts
+static std::atomic<uint32_t> revertSuccesses[REVERT_CLASSES];
+static std::atomic<uint32_t> revertFailures[REVERT_CLASSES];
+static std::atomic<uint32_t> revertSkips[REVERT_CLASSES];
+
+bool IsRevertSafeAt(RevertClass revertClass) {
+	if (revertClass == REVERT_CLASS_DEADLINE) {
+		return true;
+	}
+	uint32_t failures = revertFailures[revertClass].load(std::memory_order_relaxed);
+	if (failures < REVERT_UNSAFE_FAILURES || failures <= revertSuccesses[revertClass].load(std::memory_order_relaxed)) {
+		return true;
+	}
+	return revertSkips[revertClass].fetch_add(1, std::memory_order_relaxed) % REVERT_RETRY_INTERVAL == REVERT_RETRY_INTERVAL - 1;
+}
+
+static void DecayRevertResults(RevertClass revertClass) {
+	uint32_t successes = revertSuccesses[revertClass].load(std::memory_order_relaxed);
+	uint32_t failures = revertFailures[revertClass].load(std::memory_order_relaxed);
+	if (successes + failures >= REVERT_RESULTS_LIMIT) {
+		revertSuccesses[revertClass].store(successes / 2, std::memory_order_relaxed);
+		revertFailures[revertClass].store(failures / 2, std::memory_order_relaxed);
+	}
+}
+
+void NoteRevert(HookedThread* thread, RevertClass revertClass) {
+	// the revert is counted as successful until a failure is detected
+	revertSuccesses[revertClass].fetch_add(1, std::memory_order_relaxed);
+	DecayRevertResults(revertClass);
+	thread->lastRevertClass = revertClass;
+	thread->lastRevertTime = platform->getTickCount();
+	thread->lastRevertUnconfirmed = true;
+}
+
+void NoteSwitchDetected(HookedThread* thread) {
+	if (!thread->lastRevertUnconfirmed) {
+		return;
+	}
+	thread->lastRevertUnconfirmed = false;
+	if (platform->getTickCount() - thread->lastRevertTime >= REVERT_CONFIRM_MS) {
+		return;
+	}
+
+	RevertClass revertClass = (RevertClass)thread->lastRevertClass;
+	Log("The last revert is overridden, at revert class ", (DWORD)revertClass);
+	uint32_t successes = revertSuccesses[revertClass].load(std::memory_order_relaxed);
+	if (successes) {
+		revertSuccesses[revertClass].store(successes - 1, std::memory_order_relaxed);
+	}
+	revertFailures[revertClass].fetch_add(1, std::memory_order_relaxed);
+	DecayRevertResults(revertClass);
+}
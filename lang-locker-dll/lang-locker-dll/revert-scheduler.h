@@ -0,0 +1,32 @@
+/*
+ * revert-scheduler.h : chooses the events at which the unwanted language switches are reverted.
+ *
+ * A revert performed too early is overridden by the system, which results in a second switch, and a revert
+ * performed too late leaves the wrong layout active for a noticeable time. The scheduler learns which classes
+ * of the events (see RevertClass in lock-logic.h) are safe for reverting on this system: a revert "sticks" if no
+ * further unwanted switch is detected in the thread within REVERT_CONFIRM_MS. The classes with mostly failed
+ * reverts are skipped, so the pending revert is performed at the earliest event of a safe class. The skipped
+ * classes are re-tried from time to time, and the old results decay, so the scheduler adapts to the changes.
+ *
+ * The worst-case time in the wrong layout is bounded by a thread timer, set by the hooks when an unwanted switch
+ * is detected; its expiration is an event of REVERT_CLASS_DEADLINE, which is always safe.
+ */
+
+#pragma once
+
+#include "lock-logic.h"
+
+// the maximal time from the detection of an unwanted switch to its revert
+const DWORD REVERT_DEADLINE_MS = 200;
+
+// a revert is considered failed if another unwanted switch is detected within this time
+const DWORD REVERT_CONFIRM_MS = 500;
+
+// Whether a pending revert may be performed at the event of the specified class
+bool IsRevertSafeAt(RevertClass revertClass);
+
+// Records the revert performed by the thread at the event of the specified class
+void NoteRevert(HookedThread* thread, RevertClass revertClass);
+
+// Records the unwanted switch detected in the thread. If it closely follows a revert, the revert is considered failed
+void NoteSwitchDetected(HookedThread* thread);
@@ -0,0 +1,82 @@
+/*
+ * shared-lock-format.h : the lock state shared by all IDE instances of the user session, see shared-lock.h.
+ *
+ * The state is kept in a named shared memory segment and protected by a seqlock, like the status block
+ * (see lock-status.h). The generation is also readable without the seqlock, so the hooks check for the
+ * changes with a single load.
+ *
+ * NOTE: this header does not depend on Windows headers, and is used by the X11 library too.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+#include <thread>
+
+const uint32_t SHARED_LOCK_VERSION = 1;
+
+struct SharedLockState {
+	std::atomic<uint32_t> sequence;
+	uint32_t version;                   // SHARED_LOCK_VERSION, or 0 if not initialized yet
+	std::atomic<uint32_t> generation;   // incremented at each change
+	uint32_t ownerProcessId;            // the process which made the last change
+	int64_t lockedLanguage;             // the language to lock in all instances, or 0 if unlocked
+	uint32_t reserved[10];
+};
+
+static_assert(sizeof(SharedLockState) == 64, "Unexpected size of SharedLockState");
+
+// A writer killed in the middle of a write leaves an odd sequence, so it is taken over after so many spins.
+// A reader gives up after so many attempts, and the change is read at the next check
+const int SHARED_LOCK_WRITE_SPINS = 100000;
+const int SHARED_LOCK_READ_ATTEMPTS = 1000;
+
+// Changes the shared state and returns the new generation. The writers may run in different processes,
+// so the sequence also works as a spin lock for them
+inline uint32_t WriteSharedLock(SharedLockState* state, int64_t language, uint32_t processId) {
+	uint32_t seq = state->sequence.load(std::memory_order_relaxed);
+	for (int spins = 0; ; spins++) {
+		if ((seq & 1) && spins < SHARED_LOCK_WRITE_SPINS) {
+			std::this_thread::yield();
+			uint32_t nextSeq = state->sequence.load(std::memory_order_relaxed);
+			if (nextSeq != seq) {
+				// the writer is alive
+				seq = nextSeq;
+				spins = 0;
+			}
+		}
+		else if (state->sequence.compare_exchange_weak(seq, (seq | 1) + (seq & 1 ? 2 : 0), std::memory_order_acquire)) {
+			break;
+		}
+	}
+	std::atomic_thread_fence(std::memory_order_release);
+
+	state->version = SHARED_LOCK_VERSION;
+	state->lockedLanguage = language;
+	state->ownerProcessId = processId;
+	uint32_t generation = state->generation.load(std::memory_order_relaxed) + 1;
+	state->generation.store(generation, std::memory_order_relaxed);
+
+	state->sequence.fetch_add(1, std::memory_order_release);
+	return generation;
+}
+
+// Reads the consistent locked language and the generation of the shared state. Returns false if the state
+// is being written for too long, i.e. the language is unknown
+inline bool ReadSharedLock(const SharedLockState* state, int64_t& language, uint32_t& generation) {
+	for (int i = 0; i < SHARED_LOCK_READ_ATTEMPTS; i++) {
+		uint32_t seq = state->sequence.load(std::memory_order_acquire);
+		if (seq & 1) {
+			std::this_thread::yield();
+			continue;
+		}
+		language = state->lockedLanguage;
+		generation = state->generation.load(std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (state->sequence.load(std::memory_order_relaxed) == seq) {
+			return true;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,72 @@
+/*
+ * shared-lock.cpp : the lock state shared by all IDE instances, see shared-lock.h
+ */
+
+#include "stdafx.h"
+#include "lang-locker.h"
+#include "shared-lock.h"
+
+SharedLockState* sharedLock = NULL;
+std::atomic<uint32_t> appliedSharedGeneration(0);
+
+void OpenSharedLock() {
+	char buf[16];
+	DWORD len = GetEnvironmentVariableA("LANGLOCKER_SHARED_LOCK", buf, sizeof(buf));
+	if (len == 0 || len >= sizeof(buf) || (len == 1 && buf[0] == '0')) {
+		return;
+	}
+
+	// the new mapping is zero-filled, i.e. "unlocked" at the generation 0
+	HANDLE mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(SharedLockState),
+		"Local\\lang-locker-shared-lock");
+	void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, sizeof(SharedLockState)) : NULL;
+	if (!view) {
+		Log("Failed to map the shared lock state, error=", GetLastError());
+	}
+	// the view keeps the mapping alive after the handle is closed
+	if (mapping) {
+		CloseHandle(mapping);
+	}
+	if (!view) {
+		return;
+	}
+
+	SharedLockState* state = (SharedLockState*)view;
+	if (state->version && state->version != SHARED_LOCK_VERSION) {
+		Log("Unsupported version of the shared lock state: ", (DWORD)state->version);
+		UnmapViewOfFile(view);
+		return;
+	}
+	sharedLock = state;
+	Log("Shared lock state enabled, generation: ", (DWORD)state->generation.load());
+}
+
+void CloseSharedLock() {
+	SharedLockState* state = sharedLock;
+	if (state) {
+		sharedLock = NULL;
+		UnmapViewOfFile(state);
+	}
+}
+
+void PublishSharedLock(HKL language) {
+	SharedLockState* state = sharedLock;
+	if (state) {
+		appliedSharedGeneration = WriteSharedLock(state, (LONG_PTR)language, GetCurrentProcessId());
+	}
+}
+
+bool TakeSharedLockChange(HKL& language) {
+	SharedLockState* state = sharedLock;
+	if (!state) {
+		return false;
+	}
+	int64_t sharedLanguage;
+	uint32_t generation;
+	if (!ReadSharedLock(state, sharedLanguage, generation)) {
+		Log("The shared lock state is being written for too long");
+		return false;
+	}
+	language = (HKL)(LONG_PTR)sharedLanguage;
+	return appliedSharedGeneration.exchange(generation) != generation;
+}
@@ -0,0 +1,36 @@
+/*
+ * shared-lock.h : the optional lock state shared by all IDE instances of the user session.
+ *
+ * Enabled by LANGLOCKER_SHARED_LOCK environment variable (any value but "0"). Then each lock or unlock by the
+ * plugin is also published into the named shared mapping (see shared-lock-format.h), and the other instances
+ * apply it on the main thread, at the first message after their window is activated, without any IPC.
+ * The main thread is watched by the command hook (see lock-commands.h), which is set at the first lock or unlock.
+ */
+
+#pragma once
+
+#include "shared-lock-format.h"
+
+extern SharedLockState* sharedLock;
+
+// the generation of the shared state which is already applied or published by this process
+extern std::atomic<uint32_t> appliedSharedGeneration;
+
+void OpenSharedLock();
+void CloseSharedLock();
+
+inline bool IsSharedLockEnabled() {
+	return sharedLock != NULL;
+}
+
+// Publishes the language locked by this process, or 0 if unlocked
+void PublishSharedLock(HKL language);
+
+// Quick check whether the shared state is changed by another process since the last applied one
+inline bool HasSharedLockChange() {
+	SharedLockState* state = sharedLock;
+	return state && state->generation.load(std::memory_order_relaxed) != appliedSharedGeneration.load(std::memory_order_relaxed);
+}
+
+// Takes the changed shared state to apply. Returns false if not changed
+bool TakeSharedLockChange(HKL& language);
@@ -5,21 +5,29 @@
 
 #pragma once
 
+#ifdef _WIN32
 #include "targetver.h"
 
 #define WIN32_LEAN_AND_MEAN             // Exclude rarely-used stuff from Windows headers
 // Windows Header Files:
 #include <windows.h>
-#include <tlhelp32.h>
+#else
+// the portable build of the lock logic, see os-compat.h
+#include "os-compat.h"
+#endif
 
 // TODO: reference additional headers your program requires here
+#include <stdlib.h>
 #include <iostream>
 #include <fstream>
 #include <string>
 #include <iomanip>
+#include <atomic>
 
+#ifdef _WIN32
 #include <msctf.h>
 #include <jni.h>
+#endif
 
 
 
@@ -0,0 +1,56 @@
+/*
+ * trace-format.h : binary format of the hook events trace, written by the DLL (see trace.h) and
+ * read by lang-locker-replay tool.
+ *
+ * The trace file consists of TraceFileHeader followed by a ring of 'capacity' fixed-size TraceRecords.
+ * The record with index N is stored in the slot (N % capacity), so only the last 'capacity' records
+ * are kept.
+ *
+ * NOTE: this header does not depend on Windows headers. All values are little-endian.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+const uint64_t TRACE_MAGIC = 0x3145434152544C4Cull; // "LLTRACE1"
+const uint32_t TRACE_VERSION = 2;
+
+// Sources of the trace records
+enum TraceSource {
+	TRACE_SOURCE_GETMSG = 1,        // HookGetMsgProc, except of the fast path
+	TRACE_SOURCE_SHELL = 2,         // HookShellProc
+	TRACE_SOURCE_SET_LANGUAGE = 3,  // SetInputLanguage(), lParam is the requested HKL
+	TRACE_SOURCE_LOCK = 4,          // LockInputLanguage(), wParam is the main thread, lParam is the requested HKL
+	TRACE_SOURCE_UNLOCK = 5         // UnlockInputLanguage()
+};
+
+struct TraceFileHeader {
+	uint64_t magic;
+	uint32_t version;
+	uint32_t recordSize;
+	uint32_t capacity;              // number of record slots, a power of 2
+	uint32_t processId;
+	uint64_t frequency;             // performance counter ticks per second
+	uint64_t writeIndex;            // index of the next record to write, incremented atomically
+	uint8_t reserved[24];
+};
+
+struct TraceRecord {
+	uint64_t timestamp;             // performance counter ticks
+	uint32_t threadId;
+	uint16_t source;                // see TraceSource
+	int16_t hookCode;               // nCode passed to the hook procedure
+	uint32_t message;               // the message for TRACE_SOURCE_GETMSG, nCode for TRACE_SOURCE_SHELL
+	uint32_t result;                // result of SetInputLanguage() (0 or 1) or the layout locked by LockInputLanguage()
+	uint64_t wParam;
+	uint64_t lParam;
+	uint32_t currentLayout;         // the current layout of the recording thread
+	uint32_t lockedLayout;          // the locked layout
+	uint64_t lockState;             // the lock state word, before processing for hooks and after it for lock/unlock.
+	                                // For hooks, the "revert required" flag is the one of the recording thread
+	uint64_t sequence;              // record index + 1, written last. Mismatch means the record was torn by overwriting
+};
+
+static_assert(sizeof(TraceFileHeader) == 64, "Unexpected size of TraceFileHeader");
+static_assert(sizeof(TraceRecord) == 64, "Unexpected size of TraceRecord");
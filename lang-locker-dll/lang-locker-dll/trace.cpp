@@ -0,0 +1,106 @@
+/*
+ * trace.cpp : implementation of the opt-in binary trace of the hook events.
+ */
+
+#include "stdafx.h"
+#include "lang-locker.h"
+#include "platform.h"
+#include "trace.h"
+
+TraceFileHeader* traceHeader = NULL;
+
+const uint32_t DEFAULT_TRACE_RECORDS = 65536;
+const uint32_t MAX_TRACE_RECORDS = 1 << 24;
+
+void InitTrace() {
+	char path[MAX_PATH];
+	DWORD len = GetEnvironmentVariableA("LANGLOCKER_TRACE", path, MAX_PATH);
+	if (len == 0 || len >= MAX_PATH) {
+		return;
+	}
+
+	uint32_t capacity = DEFAULT_TRACE_RECORDS;
+	char buf[16];
+	len = GetEnvironmentVariableA("LANGLOCKER_TRACE_RECORDS", buf, sizeof(buf));
+	if (len > 0 && len < sizeof(buf)) {
+		unsigned long requested = strtoul(buf, NULL, 10);
+		// round up to the power of 2, so that the slot is found by a mask
+		for (capacity = 1; capacity < requested && capacity < MAX_TRACE_RECORDS; capacity <<= 1) {
+		}
+	}
+
+	HANDLE file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) {
+		Log("Failed to create the trace file, error=", GetLastError());
+		return;
+	}
+
+	// the mapping extends the file to the full size
+	ULONGLONG size = sizeof(TraceFileHeader) + (ULONGLONG)capacity * sizeof(TraceRecord);
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READWRITE, (DWORD)(size >> 32), (DWORD)size, NULL);
+	void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, 0) : NULL;
+	if (!view) {
+		Log("Failed to map the trace file, error=", GetLastError());
+	}
+	// the view is kept valid after the handles are closed
+	if (mapping) {
+		CloseHandle(mapping);
+	}
+	CloseHandle(file);
+	if (!view) {
+		return;
+	}
+
+	TraceFileHeader* header = (TraceFileHeader*)view;
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	header->magic = TRACE_MAGIC;
+	header->version = TRACE_VERSION;
+	header->recordSize = sizeof(TraceRecord);
+	header->capacity = capacity;
+	header->processId = GetCurrentProcessId();
+	header->frequency = frequency.QuadPart;
+	header->writeIndex = 0;
+
+	traceHeader = header;
+	Log("Trace enabled, records: ", (DWORD)capacity);
+}
+
+void CloseTrace() {
+	TraceFileHeader* header = traceHeader;
+	if (header) {
+		traceHeader = NULL;
+		FlushViewOfFile(header, 0);
+		UnmapViewOfFile(header);
+	}
+}
+
+void WriteTraceRecord(TraceSource source, int hookCode, uint32_t message, uint32_t result,
+	WPARAM wParam, LPARAM lParam, LockStateWord state) {
+	TraceFileHeader* header = traceHeader;
+	if (!header) {
+		return;
+	}
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+
+	// reserve the slot; concurrent writers (hooks and lock/unlock calls) get different slots.
+	// The ring of records follows the header
+	uint64_t index = (uint64_t)InterlockedIncrement64((LONGLONG volatile*)&header->writeIndex) - 1;
+	TraceRecord* record = (TraceRecord*)(header + 1) + (index & (header->capacity - 1));
+
+	record->timestamp = now.QuadPart;
+	record->threadId = platform->getCurrentThreadId();
+	record->source = (uint16_t)source;
+	record->hookCode = (int16_t)hookCode;
+	record->message = message;
+	record->result = result;
+	record->wParam = (uint64_t)wParam;
+	record->lParam = (uint64_t)lParam;
+	record->currentLayout = HKLToLayout(platform->getKeyboardLayout(0));
+	record->lockedLayout = LockedLayoutOf(state);
+	record->lockState = state;
+	// the sequence is written last, and allows to detect the records torn by concurrent overwriting
+	std::atomic_thread_fence(std::memory_order_release);
+	record->sequence = index + 1;
+}
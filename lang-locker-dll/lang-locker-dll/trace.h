@@ -0,0 +1,29 @@
+/*
+ * trace.h : opt-in binary trace of the hook events, for offline analysis of the language switch races.
+ *
+ * The trace is enabled by LANGLOCKER_TRACE environment variable, which specifies the path of the trace file.
+ * The optional LANGLOCKER_TRACE_RECORDS variable specifies the number of the kept records (65536 by default).
+ * The file is preallocated and memory-mapped at initialization, so recording an event does no allocations,
+ * formatting or I/O calls. See trace-format.h for the format of the file.
+ */
+
+#pragma once
+
+#include "trace-format.h"
+
+// The header of the mapped trace file, or NULL if the trace is disabled
+extern TraceFileHeader* traceHeader;
+
+void InitTrace();
+void CloseTrace();
+
+void WriteTraceRecord(TraceSource source, int hookCode, uint32_t message, uint32_t result,
+	WPARAM wParam, LPARAM lParam, LockStateWord state);
+
+// Records the event, if the trace is enabled
+inline void TraceEvent(TraceSource source, int hookCode, uint32_t message, uint32_t result,
+	WPARAM wParam, LPARAM lParam, LockStateWord state) {
+	if (traceHeader) {
+		WriteTraceRecord(source, hookCode, message, result, wParam, lParam, state);
+	}
+}
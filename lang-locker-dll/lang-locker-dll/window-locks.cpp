@@ -0,0 +1,95 @@
+/*
+ * window-locks.cpp : input languages locked for specific windows, see window-locks.h
+ */
+
+#include "stdafx.h"
+#include "lang-locker.h"
+#include "platform.h"
+#include "window-locks.h"
+
+std::atomic<HWND> windowLockKeys[WINDOW_LOCKS_SLOTS];
+std::atomic<uint32_t> windowLockLayouts[WINDOW_LOCKS_SLOTS];
+std::atomic<DWORD> windowLocksVersion(1);
+int windowLocksCount = 0;
+
+// the number of the used slots, including the removed bindings
+static int windowLockSlotsUsed = 0;
+
+// the windows are usually nested just a few levels deep, but protect from loops anyway
+const int MAX_WINDOW_DEPTH = 64;
+
+uint32_t FindWindowLockLayout(HWND hwnd) {
+	for (int depth = 0; hwnd && depth < MAX_WINDOW_DEPTH; depth++) {
+		uint32_t layout = GetWindowLockLayout(hwnd);
+		if (layout) {
+			return layout;
+		}
+		hwnd = platform->getAncestor(hwnd, GA_PARENT);
+	}
+	return 0;
+}
+
+static void InsertWindowLock(HWND hwnd, uint32_t layout) {
+	int slot = WindowLockSlot(hwnd);
+	while (windowLockKeys[slot].load(std::memory_order_relaxed)) {
+		slot = (slot + 1) & (WINDOW_LOCKS_SLOTS - 1);
+	}
+	windowLockLayouts[slot].store(layout, std::memory_order_relaxed);
+	windowLockKeys[slot].store(hwnd, std::memory_order_release);
+	windowLockSlotsUsed++;
+}
+
+// Drops the removed bindings and the bindings of the destroyed windows. The hooks may miss some bindings
+// during the rebuild, but then re-resolve the layouts after the version is changed
+static void RebuildWindowLocks() {
+	HWND keys[MAX_WINDOW_LOCKS];
+	uint32_t layouts[MAX_WINDOW_LOCKS];
+	int count = 0;
+	for (int slot = 0; slot < WINDOW_LOCKS_SLOTS; slot++) {
+		HWND key = windowLockKeys[slot].load(std::memory_order_relaxed);
+		uint32_t layout = windowLockLayouts[slot].load(std::memory_order_relaxed);
+		if (key && layout && platform->isWindow(key) && count < MAX_WINDOW_LOCKS) {
+			keys[count] = key;
+			layouts[count] = layout;
+			count++;
+		}
+		windowLockKeys[slot].store(NULL, std::memory_order_relaxed);
+	}
+
+	windowLockSlotsUsed = 0;
+	for (int i = 0; i < count; i++) {
+		InsertWindowLock(keys[i], layouts[i]);
+	}
+	windowLocksCount = count;
+}
+
+bool SetWindowLockLayout(HWND hwnd, uint32_t layout) {
+	int slot = WindowLockSlot(hwnd);
+	for (;; slot = (slot + 1) & (WINDOW_LOCKS_SLOTS - 1)) {
+		HWND key = windowLockKeys[slot].load(std::memory_order_relaxed);
+		if (key == hwnd) {
+			uint32_t prev = windowLockLayouts[slot].exchange(layout, std::memory_order_relaxed);
+			windowLocksCount += (layout != 0) - (prev != 0);
+			windowLocksVersion.fetch_add(1, std::memory_order_release);
+			return true;
+		}
+		if (key == NULL) {
+			break;
+		}
+	}
+
+	if (!layout) {
+		return true;
+	}
+	if (windowLockSlotsUsed >= MAX_WINDOW_LOCKS) {
+		RebuildWindowLocks();
+		if (windowLockSlotsUsed >= MAX_WINDOW_LOCKS) {
+			windowLocksVersion.fetch_add(1, std::memory_order_release);
+			return false;
+		}
+	}
+	InsertWindowLock(hwnd, layout);
+	windowLocksCount++;
+	windowLocksVersion.fetch_add(1, std::memory_order_release);
+	return true;
+}
@@ -0,0 +1,50 @@
+/*
+ * window-locks.h : input languages locked for specific windows, see LockWindowInputLanguage().
+ *
+ * The layouts are kept in a fixed open-addressing hash map keyed by HWND, which is read by the hooks without locks.
+ * A binding applies to the window and all its child windows. The map is changed only by the lock/unlock functions;
+ * each change increments windowLocksVersion, so that the hooks may cache the layout resolved for the focused window.
+ */
+
+#pragma once
+
+// The number of the slots is a power of 2. Only a half of them may be used, including the removed bindings
+const int WINDOW_LOCKS_SLOTS_BITS = 7;
+const int WINDOW_LOCKS_SLOTS = 1 << WINDOW_LOCKS_SLOTS_BITS;
+const int MAX_WINDOW_LOCKS = WINDOW_LOCKS_SLOTS / 2;
+
+// The windows, NULL for free slots. The keys are kept when the bindings are removed, until the map is rebuilt
+extern std::atomic<HWND> windowLockKeys[WINDOW_LOCKS_SLOTS];
+// The locked layouts of the windows, 0 for removed bindings
+extern std::atomic<uint32_t> windowLockLayouts[WINDOW_LOCKS_SLOTS];
+
+// Incremented at each change of the map, starting from 1
+extern std::atomic<DWORD> windowLocksVersion;
+
+// The number of the windows with locked layouts
+extern int windowLocksCount;
+
+inline int WindowLockSlot(HWND hwnd) {
+	// Fibonacci hashing; the significant bits of the window handles are the low 32 ones
+	return (int)(((uint32_t)(ULONG_PTR)hwnd * 0x9E3779B1u) >> (32 - WINDOW_LOCKS_SLOTS_BITS));
+}
+
+// Returns the layout locked for the window itself, or 0 if none
+inline uint32_t GetWindowLockLayout(HWND hwnd) {
+	for (int slot = WindowLockSlot(hwnd); ; slot = (slot + 1) & (WINDOW_LOCKS_SLOTS - 1)) {
+		HWND key = windowLockKeys[slot].load(std::memory_order_acquire);
+		if (key == NULL) {
+			return 0;
+		}
+		if (key == hwnd) {
+			return windowLockLayouts[slot].load(std::memory_order_relaxed);
+		}
+	}
+}
+
+// Returns the layout locked for the window or its nearest ancestor, or 0 if none
+uint32_t FindWindowLockLayout(HWND hwnd);
+
+// Locks the layout for the window, or removes the binding if the layout is 0. Returns false if there are too many
+// windows with locked layouts
+bool SetWindowLockLayout(HWND hwnd, uint32_t layout);
@@ -0,0 +1,328 @@
+/*
+ * window-rules.cpp : locking policies of the windows, selected by declarative rules, see window-rules.h
+ */
+
+#include "stdafx.h"
+#include <string.h>
+#include <ctype.h>
+#include "lang-locker.h"
+#include "platform.h"
+#include "window-locks.h"
+#include "window-rules.h"
+
+enum WindowRole {
+	WINDOW_ROLE_ANY,
+	WINDOW_ROLE_MAIN,       // a top-level window with no owner
+	WINDOW_ROLE_POPUP,      // an owned top-level window, like dialogs and popups
+	WINDOW_ROLE_CHILD       // a child window
+};
+
+const int MAX_RULE_PATTERN = 64;
+
+struct WindowRule {
+	char classPattern[MAX_RULE_PATTERN];    // empty matches any class
+	char titlePattern[MAX_RULE_PATTERN];    // empty matches any title
+	uint8_t role;
+	uint32_t layout;
+};
+
+int windowRulesCount = 0;
+
+// The rules set by SetWindowRulesText(), to be compiled at the next lock
+static char rulesText[MAX_WINDOW_RULES_TEXT];
+static bool rulesTextSet = false;
+
+// The compiled rules, and the decision table indexed by the classification of a window, i.e. the index of the
+// matched rule. The last used entry (windowRulesCount) is for the windows with no matching rules
+static WindowRule windowRules[MAX_WINDOW_RULES];
+static uint32_t windowRuleLayouts[MAX_WINDOW_RULES + 1];
+
+// The cached classifications of the windows, written by the hooks of any thread. An entry packs the significant
+// low 32 bits of HWND and the classification plus 1, so it is published by a single CAS; 0 is a free slot
+const int CLASSIFIED_WINDOWS_SLOTS_BITS = 8;
+const int CLASSIFIED_WINDOWS_SLOTS = 1 << CLASSIFIED_WINDOWS_SLOTS_BITS;
+static std::atomic<uint64_t> classifiedWindows[CLASSIFIED_WINDOWS_SLOTS];
+static std::atomic<int> classifiedWindowsCount(0);
+
+static bool ParseRuleToken(const char* token, int len, WindowRule& rule, bool first) {
+	if (first) {
+		if (len == 4 && !strncmp(token, "lock", 4)) {
+			rule.layout = 0;
+			return true;
+		}
+		if (len == 4 && !strncmp(token, "free", 4)) {
+			rule.layout = WINDOW_LAYOUT_FREE;
+			return true;
+		}
+		if (len > 7 && len < 7 + 17 && !strncmp(token, "layout=", 7)) {
+			char hex[17];
+			memcpy(hex, token + 7, len - 7);
+			hex[len - 7] = 0;
+			char* end;
+			rule.layout = HKLToLayout((HKL)(ULONG_PTR)_strtoui64(hex, &end, 16));
+			return *end == 0 && rule.layout && rule.layout != WINDOW_LAYOUT_FREE;
+		}
+		return false;
+	}
+
+	char* pattern = NULL;
+	if (len > 6 && !strncmp(token, "class=", 6)) {
+		pattern = rule.classPattern;
+		token += 6;
+		len -= 6;
+	}
+	else if (len > 6 && !strncmp(token, "title=", 6)) {
+		pattern = rule.titlePattern;
+		token += 6;
+		len -= 6;
+	}
+	else if (len > 5 && !strncmp(token, "role=", 5)) {
+		token += 5;
+		len -= 5;
+		rule.role = len == 4 && !strncmp(token, "main", 4) ? WINDOW_ROLE_MAIN
+			: len == 5 && !strncmp(token, "popup", 5) ? WINDOW_ROLE_POPUP
+			: len == 5 && !strncmp(token, "child", 5) ? WINDOW_ROLE_CHILD : WINDOW_ROLE_ANY;
+		return rule.role != WINDOW_ROLE_ANY;
+	}
+	if (!pattern || len >= MAX_RULE_PATTERN) {
+		return false;
+	}
+	memcpy(pattern, token, len);
+	pattern[len] = 0;
+	return true;
+}
+
+// Parses the rules into windowRules, or only checks them if compile is false. Returns false if some rules are skipped
+static bool ParseWindowRules(const char* text, bool compile) {
+	bool valid = true;
+	int count = 0;
+	const char* p = text;
+	while (*p) {
+		const char* lineEnd = p + strcspn(p, "\r\n;");
+		WindowRule rule = {};
+		// the comments may be indented
+		p += strspn(p, " \t");
+		bool comment = *p == '#';
+		bool empty = true, ok = !comment;
+		while (ok && p < lineEnd) {
+			p += strspn(p, " \t");
+			int len = (int)(strcspn(p, " \t\r\n;"));
+			if (len) {
+				ok = ParseRuleToken(p, len, rule, empty);
+				empty = false;
+				p += len;
+			}
+		}
+		if (!ok || (!empty && count == MAX_WINDOW_RULES)) {
+			if (!comment) {
+				Log("Skipped the malformed or excessive window rule");
+				valid = false;
+			}
+		}
+		else if (!empty) {
+			if (compile) {
+				windowRules[count] = rule;
+			}
+			count++;
+		}
+		p = *lineEnd ? lineEnd + 1 : lineEnd;
+	}
+	if (compile) {
+		windowRulesCount = count;
+	}
+	return valid;
+}
+
+bool SetWindowRulesText(const char* rules) {
+	if (strlen(rules) >= MAX_WINDOW_RULES_TEXT) {
+		Log("The window rules are too long");
+		return false;
+	}
+	strcpy_s(rulesText, rules);
+	rulesTextSet = true;
+	return ParseWindowRules(rules, false);
+}
+
+// Reads the rules from the file specified by LANGLOCKER_WINDOW_RULES environment variable, if any
+static bool ReadWindowRulesFile(char* text) {
+	char path[MAX_PATH];
+	DWORD len = GetEnvironmentVariableA("LANGLOCKER_WINDOW_RULES", path, MAX_PATH);
+	if (len == 0 || len >= MAX_PATH) {
+		return false;
+	}
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) {
+		Log("Failed to open the window rules file, error=", GetLastError());
+		return false;
+	}
+	DWORD read = 0;
+	BOOL success = ReadFile(file, text, MAX_WINDOW_RULES_TEXT - 1, &read, NULL);
+	CloseHandle(file);
+	text[success ? read : 0] = 0;
+	return success != FALSE;
+#else
+	FILE* file = fopen(path, "rb");
+	if (!file) {
+		return false;
+	}
+	size_t read = fread(text, 1, MAX_WINDOW_RULES_TEXT - 1, file);
+	bool success = !ferror(file);
+	fclose(file);
+	text[success ? read : 0] = 0;
+	return success;
+#endif
+}
+
+void CompileWindowRules() {
+	char text[MAX_WINDOW_RULES_TEXT];
+	if (rulesTextSet) {
+		strcpy_s(text, rulesText);
+	}
+	else if (!ReadWindowRulesFile(text)) {
+		text[0] = 0;
+	}
+	ParseWindowRules(text, true);
+
+	for (int i = 0; i < windowRulesCount; i++) {
+		windowRuleLayouts[i] = windowRules[i].layout;
+	}
+	windowRuleLayouts[windowRulesCount] = 0;
+	for (int slot = 0; slot < CLASSIFIED_WINDOWS_SLOTS; slot++) {
+		classifiedWindows[slot].store(0, std::memory_order_relaxed);
+	}
+	classifiedWindowsCount.store(0, std::memory_order_relaxed);
+
+	if (windowRulesCount) {
+		Log("Window rules compiled: ", (DWORD)windowRulesCount);
+	}
+	SetWindowBindingsFlag(windowLocksCount != 0 || windowRulesCount != 0);
+	// the hooked threads re-resolve the layouts of the focused windows
+	windowLocksVersion.fetch_add(1, std::memory_order_release);
+}
+
+static bool WildcardMatch(const char* pattern, const char* text) {
+	// the last '*' and the text position it was tried at, for backtracking
+	const char* star = NULL;
+	const char* starText = NULL;
+	while (*text) {
+		if (*pattern == '*') {
+			star = pattern++;
+			starText = text;
+		}
+		else if (*pattern == '?' || (*pattern && tolower((unsigned char)*pattern) == tolower((unsigned char)*text))) {
+			pattern++;
+			text++;
+		}
+		else if (star) {
+			pattern = star + 1;
+			text = ++starText;
+		}
+		else {
+			return false;
+		}
+	}
+	while (*pattern == '*') {
+		pattern++;
+	}
+	return *pattern == 0;
+}
+
+static WindowRole WindowRoleOf(HWND hwnd) {
+	if (platform->getWindowLongPtr(hwnd, GWL_STYLE) & WS_CHILD) {
+		return WINDOW_ROLE_CHILD;
+	}
+	return platform->getWindow(hwnd, GW_OWNER) ? WINDOW_ROLE_POPUP : WINDOW_ROLE_MAIN;
+}
+
+// Returns the index of the first rule matching the window, or windowRulesCount if none
+static int MatchWindowRules(HWND hwnd) {
+	char className[256];
+	if (!platform->getClassName(hwnd, className, sizeof(className))) {
+		className[0] = 0;
+	}
+	WindowRole role = WindowRoleOf(hwnd);
+	// the title is got only if needed, as it is the slowest part
+	char title[256];
+	bool titleKnown = false;
+
+	for (int i = 0; i < windowRulesCount; i++) {
+		const WindowRule& rule = windowRules[i];
+		if ((rule.role != WINDOW_ROLE_ANY && rule.role != role)
+				|| (rule.classPattern[0] && !WildcardMatch(rule.classPattern, className))) {
+			continue;
+		}
+		if (rule.titlePattern[0]) {
+			if (!titleKnown) {
+				if (!platform->getWindowText(hwnd, title, sizeof(title))) {
+					title[0] = 0;
+				}
+				titleKnown = true;
+			}
+			if (!WildcardMatch(rule.titlePattern, title)) {
+				continue;
+			}
+		}
+		return i;
+	}
+	return windowRulesCount;
+}
+
+static int ClassifyWindow(HWND hwnd) {
+	int index = MatchWindowRules(hwnd);
+	if (index == windowRulesCount) {
+		HWND root = platform->getAncestor(hwnd, GA_ROOT);
+		if (root && root != hwnd) {
+			index = MatchWindowRules(root);
+		}
+	}
+	return index;
+}
+
+inline int ClassifiedWindowSlot(uint32_t key) {
+	// Fibonacci hashing, like for the window locks
+	return (int)((key * 0x9E3779B1u) >> (32 - CLASSIFIED_WINDOWS_SLOTS_BITS));
+}
+
+// Returns the cached classification of the window, or -1 if not cached
+static int LookupClassification(uint32_t key) {
+	for (int slot = ClassifiedWindowSlot(key); ; slot = (slot + 1) & (CLASSIFIED_WINDOWS_SLOTS - 1)) {
+		uint64_t entry = classifiedWindows[slot].load(std::memory_order_relaxed);
+		if (!entry) {
+			return -1;
+		}
+		if ((uint32_t)(entry >> 32) == key) {
+			return (int)(entry & 0xFF) - 1;
+		}
+	}
+}
+
+static void CacheClassification(uint32_t key, int index) {
+	if (classifiedWindowsCount.fetch_add(1, std::memory_order_relaxed) >= CLASSIFIED_WINDOWS_SLOTS / 2) {
+		// mostly destroyed windows, start over. A concurrent insertion may survive, but it is valid anyway
+		for (int slot = 0; slot < CLASSIFIED_WINDOWS_SLOTS; slot++) {
+			classifiedWindows[slot].store(0, std::memory_order_relaxed);
+		}
+		classifiedWindowsCount.store(1, std::memory_order_relaxed);
+	}
+	uint64_t entry = ((uint64_t)key << 32) | (uint64_t)(index + 1);
+	for (int slot = ClassifiedWindowSlot(key); ; slot = (slot + 1) & (CLASSIFIED_WINDOWS_SLOTS - 1)) {
+		uint64_t expected = 0;
+		if (classifiedWindows[slot].compare_exchange_strong(expected, entry) || (uint32_t)(expected >> 32) == key) {
+			return;
+		}
+	}
+}
+
+uint32_t FindWindowRuleLayout(HWND hwnd) {
+	if (!windowRulesCount || !hwnd) {
+		return 0;
+	}
+	uint32_t key = (uint32_t)(ULONG_PTR)hwnd;
+	int index = LookupClassification(key);
+	if (index < 0) {
+		index = ClassifyWindow(hwnd);
+		CacheClassification(key, index);
+	}
+	return windowRuleLayouts[index];
+}
@@ -0,0 +1,37 @@
+/*
+ * window-rules.h : locking policies of the windows, selected by declarative rules.
+ *
+ * A rule matches the windows by the class name, the role in the process and, optionally, the title, and applies
+ * a policy: lock the locked language, leave the language free, or lock a specific layout. One rule per line:
+ *
+ *     <policy> [class=<pattern>] [role=main|popup|child] [title=<pattern>]
+ *
+ * where the policy is 'lock', 'free' or 'layout=<hex HKL>', and the patterns may contain '*' and '?' (e.g. for
+ * spaces) and are compared ignoring case. The first matching rule wins; if no rule matches a child window, the
+ * rules are matched against its top-level window. The lines starting with '#', possibly after spaces, are ignored.
+ *
+ * The rules are set by SetWindowRules(), or read from the file specified by LANGLOCKER_WINDOW_RULES environment
+ * variable, and are compiled when the language is locked. A window is classified once, at its first focus, and
+ * the index of the matched rule is cached per HWND, so that the hooks resolve the policy by an indexed lookup
+ * in the compiled table, without string comparisons. The locks of specific windows (see window-locks.h) take
+ * precedence over the rules.
+ */
+
+#pragma once
+
+const int MAX_WINDOW_RULES = 32;
+const int MAX_WINDOW_RULES_TEXT = 4096;
+
+// The number of the compiled rules
+extern int windowRulesCount;
+
+// Keeps the rules to be compiled at the next lock. Returns false if the text is too long, or some rules are
+// malformed; such rules are skipped
+bool SetWindowRulesText(const char* rules);
+
+// Compiles the rules set by SetWindowRulesText() or from the file, and drops the cached classifications.
+// Called while the hooks are not set
+void CompileWindowRules();
+
+// Returns the layout of the window by the rules: 0 for the locked one, WINDOW_LAYOUT_FREE, or a specific layout
+uint32_t FindWindowRuleLayout(HWND hwnd);
@@ -0,0 +1,246 @@
+/*
+ * replay.cpp : offline replay of the hook events trace written by lang-locker.dll (see trace.h).
+ *
+ * Feeds the recorded hook events through the same decision logic as used by the hooks (lock-logic.h),
+ * and reports the revert decisions, their latency, and the differences between the replayed and
+ * the recorded lock states. The "revert required" flags are replayed separately for each hooked thread.
+ *
+ * Usage: lang-locker-replay [-v] <trace file>
+ *
+ * The tool is portable and does not depend on Windows headers, e.g. on Linux it may be built by
+ *   g++ -std=c++11 -O2 -I../lang-locker-dll replay.cpp -o lang-locker-replay
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <map>
+#include <algorithm>
+
+#include "lock-logic.h"
+#include "trace-format.h"
+
+struct ReplayStats {
+	uint64_t records = 0;
+	uint64_t tornRecords = 0;
+	uint64_t bySource[6] = { 0 };
+	uint64_t blockedSwitches = 0;
+	uint64_t revertRequests = 0;
+	uint64_t reverts = 0;
+	uint64_t recordedActivations = 0;
+	uint64_t failedActivations = 0;
+	uint64_t stateMismatches = 0;
+	uint64_t silentSwitches = 0;
+	std::vector<double> revertLatencies;  // microseconds
+};
+
+static const char* SourceName(uint16_t source) {
+	switch (source) {
+	case TRACE_SOURCE_GETMSG: return "GETMSG";
+	case TRACE_SOURCE_SHELL: return "SHELL";
+	case TRACE_SOURCE_SET_LANGUAGE: return "SET_LANGUAGE";
+	case TRACE_SOURCE_LOCK: return "LOCK";
+	case TRACE_SOURCE_UNLOCK: return "UNLOCK";
+	default: return "?";
+	}
+}
+
+static bool ReadTrace(const char* path, TraceFileHeader& header, std::vector<TraceRecord>& records, ReplayStats& stats) {
+	FILE* f = fopen(path, "rb");
+	if (!f) {
+		fprintf(stderr, "Cannot open %s\n", path);
+		return false;
+	}
+	bool ok = fread(&header, sizeof(header), 1, f) == 1
+		&& header.magic == TRACE_MAGIC && header.version == TRACE_VERSION
+		&& header.recordSize == sizeof(TraceRecord) && header.capacity > 0
+		&& (header.capacity & (header.capacity - 1)) == 0;
+	if (!ok) {
+		fprintf(stderr, "%s is not a lang-locker trace file, or has unsupported version\n", path);
+		fclose(f);
+		return false;
+	}
+
+	std::vector<TraceRecord> ring(header.capacity);
+	size_t nread = fread(&ring[0], sizeof(TraceRecord), header.capacity, f);
+	fclose(f);
+	if (nread != header.capacity) {
+		fprintf(stderr, "%s is truncated\n", path);
+		return false;
+	}
+
+	// restore the order of records, starting from the oldest kept one
+	uint64_t end = header.writeIndex;
+	uint64_t begin = end > header.capacity ? end - header.capacity : 0;
+	for (uint64_t i = begin; i < end; i++) {
+		const TraceRecord& r = ring[i & (header.capacity - 1)];
+		if (r.sequence != i + 1) {
+			stats.tornRecords++;
+		} else {
+			records.push_back(r);
+		}
+	}
+	return true;
+}
+
+// The replayed state of a hooked thread
+struct ThreadReplay {
+	bool initialized = false;
+	bool revertRequired = false;
+	uint64_t revertRequestedAt = 0;
+	bool languageEventSeen = true;
+	uint32_t lastLayout = 0;
+};
+
+static void Replay(const TraceFileHeader& header, const std::vector<TraceRecord>& records, bool verbose, ReplayStats& stats) {
+	double ticksPerUs = header.frequency / 1e6;
+	// only the locked layout is used, the "revert required" flags are kept per thread
+	LockStateWord state = records.empty() ? 0 : records[0].lockState;
+	std::map<uint32_t, ThreadReplay> threads;
+
+	for (size_t i = 0; i < records.size(); i++) {
+		const TraceRecord& r = records[i];
+		stats.records++;
+		if (r.source < 6) {
+			stats.bySource[r.source]++;
+		}
+		double timeUs = (r.timestamp - records[0].timestamp) / ticksPerUs;
+
+		if (r.source == TRACE_SOURCE_LOCK || r.source == TRACE_SOURCE_UNLOCK) {
+			// the lock state is recorded after the lock/unlock, so just adopt it. The revert may be requested
+			// only for the main thread
+			if (verbose) {
+				printf("%12.1f us  %-12s requested=0x%08X locked=0x%08X\n", timeUs, SourceName(r.source),
+					(uint32_t)r.lParam, LockedLayoutOf(r.lockState));
+			}
+			state = r.lockState;
+			threads.clear();
+			if (IsRevertRequired(state) && r.wParam) {
+				ThreadReplay& main = threads[(uint32_t)r.wParam];
+				main.revertRequired = true;
+				main.revertRequestedAt = r.timestamp;
+			}
+			continue;
+		}
+
+		if (r.source == TRACE_SOURCE_SET_LANGUAGE) {
+			stats.recordedActivations++;
+			if (!r.result) {
+				stats.failedActivations++;
+			}
+			for (auto& entry : threads) {
+				entry.second.languageEventSeen = true;
+			}
+			continue;
+		}
+
+		ThreadReplay& t = threads[r.threadId];
+		if (!t.initialized) {
+			t.initialized = true;
+			t.lastLayout = r.currentLayout;
+		}
+		LockStateWord threadState = (state & LOCK_STATE_LAYOUT_MASK) | (t.revertRequired ? LOCK_STATE_REVERT_REQUIRED : 0);
+
+		// hook events: the recorded state is the one seen by the hook before processing
+		if ((r.lockState & (LOCK_STATE_LAYOUT_MASK | LOCK_STATE_REVERT_REQUIRED)) != threadState) {
+			stats.stateMismatches++;
+			if (verbose) {
+				printf("%12.1f us  thread %u state mismatch: replayed locked=0x%08X revert=%d, recorded locked=0x%08X revert=%d\n",
+					timeUs, r.threadId, LockedLayoutOf(threadState), IsRevertRequired(threadState),
+					LockedLayoutOf(r.lockState), IsRevertRequired(r.lockState));
+			}
+		}
+
+		bool isLanguageEvent = r.source == TRACE_SOURCE_GETMSG
+			? (r.message == MSG_INPUTLANGCHANGE || r.message == MSG_INPUTLANGCHANGEREQUEST)
+			: r.hookCode == SHELL_LANGUAGE;
+		if (r.currentLayout != t.lastLayout && !t.languageEventSeen && !isLanguageEvent && IsLocked(state)) {
+			// the layout was changed, but neither a language event nor our activation was seen
+			stats.silentSwitches++;
+			if (verbose) {
+				printf("%12.1f us  thread %u silent switch 0x%08X -> 0x%08X\n", timeUs, r.threadId, t.lastLayout, r.currentLayout);
+			}
+		}
+		t.languageEventSeen = isLanguageEvent;
+		t.lastLayout = r.currentLayout;
+
+		int actions = r.source == TRACE_SOURCE_GETMSG
+			? DecideOnMessage(threadState, r.message, (uint32_t)r.lParam)
+			: DecideOnShellEvent(threadState, r.hookCode, r.currentLayout);
+
+		if (actions & HOOK_ACTION_BLOCK_SWITCH) {
+			stats.blockedSwitches++;
+		}
+		if ((actions & HOOK_ACTION_REQUEST_REVERT) && !t.revertRequired) {
+			stats.revertRequests++;
+			t.revertRequired = true;
+			t.revertRequestedAt = r.timestamp;
+			if (verbose) {
+				printf("%12.1f us  %-12s thread %u code=0x%04X revert requested\n", timeUs, SourceName(r.source), r.threadId, r.message);
+			}
+		}
+		if ((actions & HOOK_ACTION_REVERT) && t.revertRequired) {
+			stats.reverts++;
+			t.revertRequired = false;
+			double latency = (r.timestamp - t.revertRequestedAt) / ticksPerUs;
+			stats.revertLatencies.push_back(latency);
+			if (verbose) {
+				printf("%12.1f us  %-12s thread %u code=0x%04X revert to 0x%08X after %.1f us\n", timeUs, SourceName(r.source),
+					r.threadId, r.message, LockedLayoutOf(state), latency);
+			}
+		}
+	}
+}
+
+static double Percentile(const std::vector<double>& sorted, double p) {
+	size_t idx = (size_t)(p * (sorted.size() - 1) + 0.5);
+	return sorted[idx];
+}
+
+static void PrintStats(ReplayStats& stats) {
+	printf("records:              %llu (torn or overwritten: %llu)\n", (unsigned long long)stats.records, (unsigned long long)stats.tornRecords);
+	for (uint16_t s = TRACE_SOURCE_GETMSG; s <= TRACE_SOURCE_UNLOCK; s++) {
+		printf("  %-18s  %llu\n", SourceName(s), (unsigned long long)stats.bySource[s]);
+	}
+	printf("blocked switches:     %llu\n", (unsigned long long)stats.blockedSwitches);
+	printf("revert requests:      %llu\n", (unsigned long long)stats.revertRequests);
+	printf("replayed reverts:     %llu\n", (unsigned long long)stats.reverts);
+	printf("recorded activations: %llu (failed: %llu)\n", (unsigned long long)stats.recordedActivations, (unsigned long long)stats.failedActivations);
+	printf("state mismatches:     %llu\n", (unsigned long long)stats.stateMismatches);
+	printf("silent switches:      %llu\n", (unsigned long long)stats.silentSwitches);
+
+	std::vector<double>& lat = stats.revertLatencies;
+	if (!lat.empty()) {
+		std::sort(lat.begin(), lat.end());
+		printf("revert latency, us:   min %.1f, median %.1f, p90 %.1f, p99 %.1f, max %.1f\n",
+			lat.front(), Percentile(lat, 0.5), Percentile(lat, 0.9), Percentile(lat, 0.99), lat.back());
+	}
+}
+
+int main(int argc, char* argv[]) {
+	bool verbose = false;
+	const char* path = NULL;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-v") == 0) {
+			verbose = true;
+		} else {
+			path = argv[i];
+		}
+	}
+	if (!path) {
+		fprintf(stderr, "Usage: lang-locker-replay [-v] <trace file>\n");
+		return 2;
+	}
+
+	TraceFileHeader header;
+	std::vector<TraceRecord> records;
+	ReplayStats stats;
+	if (!ReadTrace(path, header, records, stats)) {
+		return 1;
+	}
+
+	printf("trace of process %u, %u record slots\n", header.processId, header.capacity);
+	Replay(header, records, verbose, stats);
+	PrintStats(stats);
+	return 0;
+}
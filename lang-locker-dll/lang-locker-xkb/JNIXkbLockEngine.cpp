@@ -0,0 +1,73 @@
+/*
+ * JNIXkbLockEngine.cpp : native methods of com.gilecode.langlocker.LockEngine for X11, see JNILockEngine.cpp
+ * for the Windows counterpart.
+ *
+ * The statistics and the events are not supported, so the plugins fall back as for an older native library.
+ */
+
+#include <jni.h>
+#include <stdio.h>
+
+#include "xkb-locker.h"
+
+static const char* LOCK_ENGINE_CLASS = "com/gilecode/langlocker/LockEngine";
+
+static jlong JNICALL LockEngine_lockInputLanguage(JNIEnv * env, jclass clazz, jlong language) {
+	return XkbLockInputLanguage(language);
+}
+
+static void JNICALL LockEngine_unlockInputLanguage(JNIEnv * env, jclass clazz) {
+	XkbUnlockInputLanguage();
+}
+
+// the XKB group is global for the keyboard, so the languages cannot be locked per window
+static jboolean JNICALL LockEngine_lockWindowInputLanguage(JNIEnv * env, jclass clazz, jlong hwnd, jlong language) {
+	return JNI_FALSE;
+}
+
+static void JNICALL LockEngine_unlockWindowInputLanguage(JNIEnv * env, jclass clazz, jlong hwnd) {
+}
+
+static jobject JNICALL LockEngine_getStatusBuffer(JNIEnv * env, jclass clazz) {
+	return env->NewDirectByteBuffer(&lockStatus, sizeof(lockStatus));
+}
+
+static jboolean JNICALL LockEngine_startEventNotifier(JNIEnv * env, jclass clazz) {
+	return JNI_FALSE;
+}
+
+static JNINativeMethod LockEngineMethods[] =
+{
+	{ (char*)"lockInputLanguage", (char*)"(J)J", (void*)LockEngine_lockInputLanguage },
+	{ (char*)"unlockInputLanguage", (char*)"()V", (void*)LockEngine_unlockInputLanguage },
+	{ (char*)"lockWindowInputLanguage", (char*)"(JJ)Z", (void*)LockEngine_lockWindowInputLanguage },
+	{ (char*)"unlockWindowInputLanguage", (char*)"(J)V", (void*)LockEngine_unlockWindowInputLanguage },
+	{ (char*)"getStatusBuffer", (char*)"()Ljava/nio/ByteBuffer;", (void*)LockEngine_getStatusBuffer },
+	{ (char*)"startEventNotifier", (char*)"()Z", (void*)LockEngine_startEventNotifier },
+};
+
+extern "C" JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM* vm, void* reserved) {
+	JNIEnv* env;
+	if (vm->GetEnv((void**)&env, JNI_VERSION_1_6) != JNI_OK) {
+		return JNI_ERR;
+	}
+
+	jclass clazz = env->FindClass(LOCK_ENGINE_CLASS);
+	if (!clazz) {
+		env->ExceptionClear();
+		fprintf(stderr, "lang-locker: JNI_OnLoad: LockEngine class is not found\n");
+		return JNI_VERSION_1_6;
+	}
+	for (size_t i = 0; i < sizeof(LockEngineMethods) / sizeof(JNINativeMethod); i++) {
+		if (env->RegisterNatives(clazz, &LockEngineMethods[i], 1) != JNI_OK) {
+			env->ExceptionClear();
+			fprintf(stderr, "lang-locker: JNI_OnLoad: native method %s is not registered\n", LockEngineMethods[i].name);
+		}
+	}
+	env->DeleteLocalRef(clazz);
+	return JNI_VERSION_1_6;
+}
+
+extern "C" JNIEXPORT void JNICALL JNI_OnUnload(JavaVM* vm, void* reserved) {
+	XkbStopLocker();
+}
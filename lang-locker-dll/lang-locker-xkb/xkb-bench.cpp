@@ -0,0 +1,122 @@
+/*
+ * xkb-bench.cpp : benchmark of the re-lock latency of the XKB locking engine (see xkb-locker.h).
+ *
+ * Locks the first group, then switches the group from a separate X connection in bursts, like a storm of
+ * the user switches, and measures the time until the locked group is restored. Exits with non-zero status
+ * if the group is not restored, so it may be used as a headless check, e.g. with Xvfb:
+ *   g++ -std=c++11 -O2 -I../lang-locker-dll xkb-bench.cpp xkb-locker.cpp -lX11 -lpthread -lrt -o xkb-bench
+ *   xvfb-run -a sh -c 'setxkbmap -layout us,de && ./xkb-bench'
+ *
+ * Usage: xkb-bench [bursts [switches per burst]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <poll.h>
+#include <vector>
+#include <algorithm>
+#include <X11/Xlib.h>
+#include <X11/XKBlib.h>
+
+#include "xkb-locker.h"
+
+// the time to wait for the locked group to be restored after a burst
+const int RESTORE_TIMEOUT_MS = 1000;
+
+static double NowMicros() {
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// Waits for a state event which reports the locked group, with the serial not less than the specified one,
+// i.e. the state after the last switch of the burst
+static bool WaitForGroup(Display* display, int xkbEventBase, int group, unsigned long serial) {
+	double deadline = NowMicros() + RESTORE_TIMEOUT_MS * 1000.0;
+	for (;;) {
+		while (XPending(display)) {
+			XEvent event;
+			XNextEvent(display, &event);
+			XkbEvent* xkbEvent = (XkbEvent*)&event;
+			if (event.type == xkbEventBase && xkbEvent->any.xkb_type == XkbStateNotify
+				&& xkbEvent->state.serial >= serial && xkbEvent->state.locked_group == group) {
+				return true;
+			}
+		}
+		int timeout = (int)((deadline - NowMicros()) / 1000);
+		if (timeout <= 0) {
+			return false;
+		}
+		pollfd fd = { ConnectionNumber(display), POLLIN, 0 };
+		poll(&fd, 1, timeout);
+	}
+}
+
+int main(int argc, char* argv[]) {
+	int bursts = argc > 1 ? atoi(argv[1]) : 1000;
+	int burstSize = argc > 2 ? atoi(argv[2]) : 1;
+	if (bursts <= 0 || burstSize <= 0) {
+		fprintf(stderr, "Usage: xkb-bench [bursts [switches per burst]]\n");
+		return 2;
+	}
+
+	int xkbEventBase = 0, major = XkbMajorVersion, minor = XkbMinorVersion, reason = 0;
+	Display* display = XkbOpenDisplay(NULL, &xkbEventBase, NULL, &major, &minor, &reason);
+	if (!display) {
+		fprintf(stderr, "Cannot open the X display with XKB, reason=%d\n", reason);
+		return 2;
+	}
+	XkbDescPtr desc = XkbGetMap(display, 0, XkbUseCoreKbd);
+	int groups = desc && XkbGetControls(display, XkbGroupsWrapMask, desc) == Success ? desc->ctrls->num_groups : 0;
+	if (desc) {
+		XkbFreeKeyboard(desc, 0, True);
+	}
+	if (groups < 2) {
+		fprintf(stderr, "At least 2 layouts are required, e.g. run 'setxkbmap -layout us,de' first\n");
+		XCloseDisplay(display);
+		return 2;
+	}
+	XkbSelectEventDetails(display, XkbUseCoreKbd, XkbStateNotify, XkbGroupLockMask, XkbGroupLockMask);
+
+	if (XkbLockInputLanguage(1) != 1) {
+		fprintf(stderr, "Failed to lock the first group\n");
+		return 1;
+	}
+
+	std::vector<double> latencies;
+	int missed = 0;
+	for (int i = 0; i < bursts; i++) {
+		double start = NowMicros();
+		unsigned long serial = 0;
+		for (int j = 0; j < burstSize; j++) {
+			serial = NextRequest(display);
+			XkbLockGroup(display, XkbUseCoreKbd, 1 + (i + j) % (groups - 1));
+		}
+		XFlush(display);
+		if (WaitForGroup(display, xkbEventBase, 0, serial)) {
+			latencies.push_back(NowMicros() - start);
+		}
+		else {
+			missed++;
+		}
+	}
+
+	XkbUnlockInputLanguage();
+	long long reverts = XkbGetRevertCount();
+	XkbStopLocker();
+	XCloseDisplay(display);
+
+	printf("groups: %d, bursts: %d, switches per burst: %d\n", groups, bursts, burstSize);
+	printf("restored: %d, missed: %d, reverts: %lld\n", (int)latencies.size(), missed, reverts);
+	if (!latencies.empty()) {
+		std::sort(latencies.begin(), latencies.end());
+		double sum = 0;
+		for (double latency : latencies) {
+			sum += latency;
+		}
+		printf("re-lock latency, us: avg %.1f, p50 %.1f, p99 %.1f, max %.1f\n", sum / latencies.size(),
+			latencies[latencies.size() / 2], latencies[latencies.size() * 99 / 100], latencies.back());
+	}
+	return missed ? 1 : 0;
+}
@@ -0,0 +1,356 @@
+/*
+ * xkb-locker.cpp : the locking engine for X11, see xkb-locker.h
+ *
+ * Two display connections are used, each by a single thread, so that XInitThreads() is not required (the JVM may
+ * have opened its own displays before the library is loaded):
+ *  - the command connection is used by the lock/unlock functions, serialized by commandMutex
+ *  - the event connection is used only by the event thread, which waits both for the X events and for the stop
+ *    request written to wakePipe
+ *
+ * The library is built on Linux together with JNIXkbLockEngine.cpp, e.g.
+ *   g++ -std=c++11 -O2 -shared -fPIC -I../lang-locker-dll -I$JAVA_HOME/include -I$JAVA_HOME/include/linux \
+ *     xkb-locker.cpp JNIXkbLockEngine.cpp -lX11 -lpthread -lrt -o liblang-locker.so
+ *
+ * The lock state may be shared by the IDE instances of the user, like in lang-locker.dll (see shared-lock.h),
+ * if LANGLOCKER_SHARED_LOCK environment variable is set. The XKB group is global for the keyboard anyway, so the
+ * event thread of each instance just follows the shared state at the next group change.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <atomic>
+#include <mutex>
+#include <X11/Xlib.h>
+#include <X11/XKBlib.h>
+
+#include "xkb-locker.h"
+#include "shared-lock-format.h"
+
+LockStatusBlock lockStatus;
+
+static std::mutex commandMutex;
+static Display* commandDisplay = NULL;
+static Display* eventDisplay = NULL;
+static int xkbEventBase = 0;
+
+static pthread_t eventThread;
+static bool eventThreadStarted = false;
+static int wakePipe[2] = { -1, -1 };
+static std::atomic<bool> stopping(false);
+
+// the locked group, or -1 if not locked
+static std::atomic<int> lockedGroup(-1);
+static std::atomic<int64_t> revertCount(0);
+
+// the shared lock state, or NULL if not enabled, and its generation applied or published by this process
+static SharedLockState* sharedLock = NULL;
+static std::atomic<uint32_t> appliedSharedGeneration(0);
+
+static void Log(const char* msg, int error = 0) {
+	if (error) {
+		fprintf(stderr, "lang-locker: %s, error=%d\n", msg, error);
+	}
+	else {
+		fprintf(stderr, "lang-locker: %s\n", msg);
+	}
+}
+
+//
+// The status block, see lock-status.cpp for the Windows counterpart
+//
+
+static void BeginStatusWrite() {
+	uint32_t seq = lockStatus.sequence.load(std::memory_order_relaxed);
+	for (;;) {
+		if (seq & 1) {
+			seq = lockStatus.sequence.load(std::memory_order_relaxed);
+		}
+		else if (lockStatus.sequence.compare_exchange_weak(seq, seq + 1, std::memory_order_acquire)) {
+			break;
+		}
+	}
+	std::atomic_thread_fence(std::memory_order_release);
+}
+
+static void EndStatusWrite() {
+	lockStatus.sequence.fetch_add(1, std::memory_order_release);
+}
+
+static void PublishStatus(int currentGroup, bool revert) {
+	BeginStatusWrite();
+	lockStatus.version = LOCK_STATUS_VERSION;
+	lockStatus.lockedLanguage = lockedGroup.load(std::memory_order_relaxed) + 1;
+	if (currentGroup >= 0) {
+		lockStatus.currentLanguage = currentGroup + 1;
+	}
+	if (revert) {
+		lockStatus.revertCount++;
+	}
+	EndStatusWrite();
+}
+
+static void PublishError(int error) {
+	BeginStatusWrite();
+	lockStatus.lastError = (uint32_t)error;
+	EndStatusWrite();
+}
+
+//
+// The shared lock state
+//
+
+static void OpenSharedLock() {
+	const char* enabled = getenv("LANGLOCKER_SHARED_LOCK");
+	if (sharedLock || !enabled || !*enabled || strcmp(enabled, "0") == 0) {
+		return;
+	}
+	// the segments are global, so the user is a part of the name
+	char name[64];
+	snprintf(name, sizeof(name), "/lang-locker-shared-lock-%u", (unsigned)getuid());
+	int fd = shm_open(name, O_RDWR | O_CREAT, 0600);
+	if (fd < 0) {
+		Log("Failed to open the shared lock state", errno);
+		return;
+	}
+	// the new segment is zero-filled, i.e. "unlocked" at the generation 0
+	void* view = ftruncate(fd, sizeof(SharedLockState)) == 0
+		? mmap(NULL, sizeof(SharedLockState), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+	close(fd);
+	if (view == MAP_FAILED) {
+		Log("Failed to map the shared lock state", errno);
+		return;
+	}
+	SharedLockState* state = (SharedLockState*)view;
+	if (state->version && state->version != SHARED_LOCK_VERSION) {
+		Log("Unsupported version of the shared lock state", (int)state->version);
+		munmap(view, sizeof(SharedLockState));
+		return;
+	}
+	sharedLock = state;
+}
+
+static void CloseSharedLock() {
+	if (sharedLock) {
+		munmap(sharedLock, sizeof(SharedLockState));
+		sharedLock = NULL;
+	}
+}
+
+static void PublishSharedLock(int group) {
+	if (sharedLock) {
+		appliedSharedGeneration = WriteSharedLock(sharedLock, group + 1, (uint32_t)getpid());
+	}
+}
+
+// Applies the lock state changed by another instance, if any
+static void CheckSharedLock() {
+	SharedLockState* state = sharedLock;
+	if (!state || state->generation.load(std::memory_order_relaxed) == appliedSharedGeneration.load(std::memory_order_relaxed)) {
+		return;
+	}
+	int64_t language;
+	uint32_t generation;
+	if (!ReadSharedLock(state, language, generation)) {
+		// being written for too long, retried at the next event
+		return;
+	}
+	if (appliedSharedGeneration.exchange(generation) != generation && language >= 0 && language <= XKB_MAX_GROUPS) {
+		lockedGroup.store((int)language - 1, std::memory_order_release);
+		PublishStatus(-1, false);
+	}
+}
+
+//
+// The event thread
+//
+
+static void OnStateNotify(const XkbStateNotifyEvent& state) {
+	CheckSharedLock();
+	int group = lockedGroup.load(std::memory_order_acquire);
+	if (group < 0 || state.locked_group == group) {
+		return;
+	}
+	// re-lock within one round trip of the event; the resulting StateNotify matches the locked group
+	XkbLockGroup(eventDisplay, XkbUseCoreKbd, group);
+	XFlush(eventDisplay);
+	revertCount.fetch_add(1, std::memory_order_relaxed);
+	PublishStatus(group, true);
+}
+
+static void ProcessEvents() {
+	while (XPending(eventDisplay)) {
+		XEvent event;
+		XNextEvent(eventDisplay, &event);
+		if (event.type == xkbEventBase) {
+			XkbEvent* xkbEvent = (XkbEvent*)&event;
+			if (xkbEvent->any.xkb_type == XkbStateNotify) {
+				OnStateNotify(xkbEvent->state);
+			}
+		}
+	}
+}
+
+static void* EventThreadProc(void*) {
+	pollfd fds[2];
+	fds[0].fd = ConnectionNumber(eventDisplay);
+	fds[0].events = POLLIN;
+	fds[1].fd = wakePipe[0];
+	fds[1].events = POLLIN;
+
+	while (!stopping.load(std::memory_order_acquire)) {
+		// the events may be already read into the queue of Xlib, so check them before waiting for the socket
+		ProcessEvents();
+		if (poll(fds, 2, -1) < 0 && errno != EINTR) {
+			Log("Failed to wait for X events", errno);
+			break;
+		}
+		if (fds[0].revents & (POLLERR | POLLHUP)) {
+			Log("The X connection is closed");
+			break;
+		}
+		if (fds[1].revents & POLLIN) {
+			char buf[16];
+			if (read(wakePipe[0], buf, sizeof(buf)) < 0) {
+				break;
+			}
+		}
+	}
+	return NULL;
+}
+
+static Display* OpenXkbDisplay() {
+	int major = XkbMajorVersion, minor = XkbMinorVersion, reason = 0;
+	Display* display = XkbOpenDisplay(NULL, &xkbEventBase, NULL, &major, &minor, &reason);
+	if (!display) {
+		Log("Failed to open the X display with XKB", reason);
+	}
+	return display;
+}
+
+// Opens the connections and starts the event thread, if not yet. Called under commandMutex
+static bool StartLocker() {
+	if (eventThreadStarted) {
+		return true;
+	}
+	OpenSharedLock();
+	if (!commandDisplay && !(commandDisplay = OpenXkbDisplay())) {
+		return false;
+	}
+	if (!eventDisplay && !(eventDisplay = OpenXkbDisplay())) {
+		return false;
+	}
+	if (!XkbSelectEventDetails(eventDisplay, XkbUseCoreKbd, XkbStateNotify, XkbGroupLockMask, XkbGroupLockMask)) {
+		Log("Failed to select XKB state events");
+		return false;
+	}
+	XFlush(eventDisplay);
+
+	if (wakePipe[0] < 0 && pipe(wakePipe) != 0) {
+		Log("Failed to create the wake pipe", errno);
+		return false;
+	}
+	stopping.store(false, std::memory_order_relaxed);
+	int error = pthread_create(&eventThread, NULL, EventThreadProc, NULL);
+	if (error) {
+		Log("Failed to start the XKB event thread", error);
+		return false;
+	}
+	eventThreadStarted = true;
+	return true;
+}
+
+void XkbStopLocker() {
+	std::lock_guard<std::mutex> guard(commandMutex);
+	if (eventThreadStarted) {
+		stopping.store(true, std::memory_order_release);
+		if (write(wakePipe[1], "", 1) < 0) {
+			Log("Failed to wake the XKB event thread", errno);
+		}
+		pthread_join(eventThread, NULL);
+		eventThreadStarted = false;
+	}
+	if (eventDisplay) {
+		XCloseDisplay(eventDisplay);
+		eventDisplay = NULL;
+	}
+	if (commandDisplay) {
+		XCloseDisplay(commandDisplay);
+		commandDisplay = NULL;
+	}
+	CloseSharedLock();
+	for (int i = 0; i < 2; i++) {
+		if (wakePipe[i] >= 0) {
+			close(wakePipe[i]);
+			wakePipe[i] = -1;
+		}
+	}
+}
+
+static int GetGroupCount() {
+	XkbDescPtr desc = XkbGetMap(commandDisplay, 0, XkbUseCoreKbd);
+	if (!desc) {
+		return 0;
+	}
+	int count = 0;
+	if (XkbGetControls(commandDisplay, XkbGroupsWrapMask, desc) == Success) {
+		count = desc->ctrls->num_groups;
+	}
+	XkbFreeKeyboard(desc, 0, True);
+	return count;
+}
+
+int64_t XkbLockInputLanguage(int64_t language) {
+	std::lock_guard<std::mutex> guard(commandMutex);
+	if (!StartLocker()) {
+		return 0;
+	}
+
+	XkbStateRec state;
+	if (XkbGetState(commandDisplay, XkbUseCoreKbd, &state) != Success) {
+		Log("Failed to get the XKB state");
+		return 0;
+	}
+	int group = language ? (int)(language - 1) : state.locked_group;
+	if (group < 0 || group >= GetGroupCount()) {
+		Log("Unknown XKB group", group);
+		PublishError(EINVAL);
+		return 0;
+	}
+
+	// the event thread shall not revert the switch to the new group
+	lockedGroup.store(group, std::memory_order_release);
+	if (group != state.locked_group) {
+		if (!XkbLockGroup(commandDisplay, XkbUseCoreKbd, group)) {
+			lockedGroup.store(-1, std::memory_order_release);
+			PublishError(EIO);
+			PublishStatus(state.locked_group, false);
+			return 0;
+		}
+		XSync(commandDisplay, False);
+	}
+	PublishStatus(group, false);
+	PublishSharedLock(group);
+	return group + 1;
+}
+
+void XkbUnlockInputLanguage() {
+	std::lock_guard<std::mutex> guard(commandMutex);
+	lockedGroup.store(-1, std::memory_order_release);
+	PublishStatus(-1, false);
+	PublishSharedLock(-1);
+}
+
+int64_t XkbGetLockedLanguage() {
+	return lockedGroup.load(std::memory_order_acquire) + 1;
+}
+
+int64_t XkbGetRevertCount() {
+	return revertCount.load(std::memory_order_relaxed);
+}
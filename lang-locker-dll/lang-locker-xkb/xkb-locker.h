@@ -0,0 +1,39 @@
+/*
+ * xkb-locker.h : the locking engine for X11, based on the XKB group locking.
+ *
+ * Implements the same contract as LockInputLanguage()/UnlockInputLanguage() of lang-locker.dll. The "language"
+ * is the XKB group (layout) of the core keyboard, and its ID is the group index + 1, so that 0 still means
+ * "none" or "current" in the Java API.
+ *
+ * Unlike the Windows hooks, the switches are not intercepted within the IDE process: a dedicated event thread
+ * subscribes to XkbStateNotify events for the locked group, and re-locks the group as soon as it is changed.
+ * The XKB groups are global for the keyboard, so the lock also applies while other applications are focused.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+
+// lock-status.h is shared with lang-locker.dll, which uses the Windows types
+typedef void* HKL;
+typedef uint32_t DWORD;
+#include "lock-status.h"
+
+// The number of the groups supported by XKB (XkbNumKbdGroups)
+const int XKB_MAX_GROUPS = 4;
+
+// If the language is 0, locks the current group, otherwise locks the group of the language, switching to it
+// if needed. Returns the ID of the locked group, or 0 if failed, e.g. if there is no X display
+int64_t XkbLockInputLanguage(int64_t language);
+
+void XkbUnlockInputLanguage();
+
+// Returns the ID of the locked group, or 0 if not locked
+int64_t XkbGetLockedLanguage();
+
+// Returns the number of the group switches reverted by the event thread
+int64_t XkbGetRevertCount();
+
+// Stops the event thread and closes the display connections. The next lock starts them again
+void XkbStopLocker();